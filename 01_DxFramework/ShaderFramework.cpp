@@ -21,6 +21,11 @@
 LPDIRECT3D9             gpD3D = NULL;					// D3D
 LPDIRECT3DDEVICE9       gpD3DDevice = NULL;				// D3D device
 
+// the device type and vertex processing the device was made with. shown
+// on screen, so a run on the reference rasterizer or with software vertex
+// processing isn't taken for a hardware one
+char					gDeviceDescription[64] = "";
+
 // Fonts
 ID3DXFont*              gpFont = NULL;
 
@@ -175,6 +180,13 @@ void RenderInfo()
 
 	// show debug keys
 	gpFont->DrawText(NULL, "Demo Framework\n\nESC: Quit demo", -1, &rct, 0, fontColor);
+
+	// the device in use, at the bottom
+	rct.left = WIN_WIDTH / 3;
+	rct.right = WIN_WIDTH * 2 / 3;
+	rct.top = WIN_HEIGHT - 30;
+	rct.bottom = WIN_HEIGHT - 5;
+	gpFont->DrawText(NULL, gDeviceDescription, -1, &rct, 0, fontColor);
 }
 
 //------------------------------------------------------------
@@ -234,14 +246,50 @@ bool InitD3D(HWND hWnd)
 	d3dpp.FullScreen_RefreshRateInHz = 0;
 	d3dpp.PresentationInterval = D3DPRESENT_INTERVAL_ONE;
 
+	// decide where the vs_2_0/ps_2_0 shaders get executed. without
+	// vertex shader 2.0 hardware, the runtime's software vertex processing
+	// runs them on the CPU. without ps_2_0 this falls back to the
+	// reference rasterizer, which is only installed with the DirectX SDK
+	// and takes seconds per frame. either way the choice is reported
+	D3DDEVTYPE deviceType = D3DDEVTYPE_HAL;
+	DWORD vertexProcessing = D3DCREATE_HARDWARE_VERTEXPROCESSING;
+
+	D3DCAPS9 caps;
+	if (FAILED(gpD3D->GetDeviceCaps(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, &caps))
+		|| caps.PixelShaderVersion < D3DPS_VERSION(2, 0))
+	{
+		deviceType = D3DDEVTYPE_REF;
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+	}
+	else if (!(caps.DevCaps & D3DDEVCAPS_HWTRANSFORMANDLIGHT)
+		|| caps.VertexShaderVersion < D3DVS_VERSION(2, 0))
+	{
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+	}
+
 	// create D3D device
-	if (FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, hWnd,
-		D3DCREATE_HARDWARE_VERTEXPROCESSING,
+	if (FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, deviceType, hWnd,
+		vertexProcessing,
 		&d3dpp, &gpD3DDevice)))
 	{
-		return false;
+		// hardware vertex processing can still be refused (e.g. out of
+		// video memory), so try once more with software vertex processing
+		if (vertexProcessing == D3DCREATE_SOFTWARE_VERTEXPROCESSING
+			|| FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, deviceType, hWnd,
+			D3DCREATE_SOFTWARE_VERTEXPROCESSING,
+			&d3dpp, &gpD3DDevice)))
+		{
+			return false;
+		}
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
 	}
 
+	sprintf(gDeviceDescription, "Device: %s, %s VP",
+		(deviceType == D3DDEVTYPE_REF) ? "REF" : "HAL",
+		(vertexProcessing == D3DCREATE_SOFTWARE_VERTEXPROCESSING) ? "SW" : "HW");
+	OutputDebugString(gDeviceDescription);
+	OutputDebugString("\n");
+
 	return true;
 }
 
@@ -266,6 +314,17 @@ LPD3DXEFFECT LoadShader(const char * filename)
 
 #if _DEBUG
 	dwShaderFlags |= D3DXSHADER_DEBUG;
+#else
+	// release builds use the effect precompiled by fxc at build time
+	// (custom build step in the project), so HLSL isn't parsed and
+	// compiled on every launch. fall back to the source if it's missing
+	char compiledFilename[MAX_PATH];
+	_snprintf(compiledFilename, MAX_PATH, "%so", filename);
+	compiledFilename[MAX_PATH - 1] = '\0';
+	if (GetFileAttributes(compiledFilename) != INVALID_FILE_ATTRIBUTES)
+	{
+		filename = compiledFilename;
+	}
 #endif
 
 	D3DXCreateEffectFromFile(gpD3DDevice, filename,
@@ -28,21 +28,29 @@ struct VS_INPUT
 	float3 mNormal: NORMAL;
 };
 
+// position in every cascade's tile of the shadow map: atlas UV in xy,
+// light depth in z. and the pixel's texel of the contact shadow mask,
+// before dividing by w
 struct VS_OUTPUT
 {
 	float4 mPosition: POSITION;
-	float4 mClipPosition: TEXCOORD1;
-	float mDiffuse : TEXCOORD2;
+	float4 mContactPosition : TEXCOORD0;
+	float3 mShadowPosition[4] : TEXCOORD1;
+	float mDiffuse : TEXCOORD5;
+	float mViewDepth : TEXCOORD6;
+	float4 mObjectColor : COLOR0;
 };
 
 float4x4 gWorldMatrix : World;
-float4x4 gLightViewMatrix
+float4 gObjectColor
 <
-	string UIName = "gLightViewMatrix";
-	string UIWidget = "Numeric";
-	bool UIVisible = false;
-> = float4x4(1.00, 0.00, 0.00, 0.00, 0.00, 1.00, 0.00, 0.00, 0.00, 0.00, 1.00, 0.00, 0.00, 0.00, 0.00, 1.00);
-float4x4 gLightProjectionMatrix : Projection;
+	string UIName = "gObjectColor";
+	string UIWidget = "Color";
+	bool UIVisible = true;
+> = float4(1.00, 1.00, 0.00, 1.00);
+
+// world to atlas UV and depth, one per cascade
+float4x4 gShadowMatrices[4];
 
 float4 gWorldLightPosition
 <
@@ -56,24 +64,75 @@ float4 gWorldLightPosition
 
 float4x4 gViewProjectionMatrix : ViewProjection;
 
-VS_OUTPUT ApplyShadowShader_ApplyShadowTorus_Vertex_Shader_vs_main(VS_INPUT Input)
+// screen sized mask of the contact shadows, 0 where a short march
+// towards the light hit the scene (ContactShadow.fx). a strength of 0
+// leaves it out
+texture ContactShadowMap_Tex;
+sampler2D ContactShadowSampler = sampler_state
 {
-	VS_OUTPUT Output;
+	Texture = (ContactShadowMap_Tex);
+	MinFilter = Point;
+	MagFilter = Point;
+	MipFilter = None;
+	AddressU = Clamp;
+	AddressV = Clamp;
+};
 
-	float4x4 lightViewMatrix = gLightViewMatrix;
+float gContactShadowStrength = 0;
 
-	float4 worldPosition = mul(Input.mPosition, gWorldMatrix);
+// half a screen pixel, from pixel centers to texel centers
+float2 gHalfPixel = float2(0.5 / 800, 0.5 / 600);
+
+// clip position to the mask's texel, for tex2Dproj
+float4 ContactShadowPosition(float4 clipPosition)
+{
+	float2 uv = clipPosition.xy * float2(0.5f, -0.5f) + (0.5f + gHalfPixel) * clipPosition.w;
+	return float4(uv, 0, clipPosition.w);
+}
+
+VS_OUTPUT ApplyShadowVertex(VS_INPUT Input, float4x3 worldMatrix, float4 objectColor)
+{
+	VS_OUTPUT Output;
+
+	float4 worldPosition = float4(mul(Input.mPosition, worldMatrix), 1);
 	Output.mPosition = mul(worldPosition, gViewProjectionMatrix);
 
-	Output.mClipPosition = mul(worldPosition, lightViewMatrix);
-	Output.mClipPosition = mul(Output.mClipPosition, gLightProjectionMatrix);
+	// the projections are orthographic, so w is 1 and the positions can
+	// be interpolated as they are
+	for (int i = 0; i < 4; ++i)
+	{
+		Output.mShadowPosition[i] = mul(worldPosition, gShadowMatrices[i]).xyz;
+	}
+
+	// w of a perspective projection is the view distance
+	Output.mViewDepth = Output.mPosition.w;
+	Output.mContactPosition = ContactShadowPosition(Output.mPosition);
 
 	float3 lightDir = normalize(worldPosition.xyz - gWorldLightPosition.xyz);
-	float3 worldNormal = normalize(mul(Input.mNormal, (float3x3)gWorldMatrix));
+	float3 worldNormal = normalize(mul(Input.mNormal, (float3x3)worldMatrix));
 	Output.mDiffuse = dot(-lightDir, worldNormal);
 
+	Output.mObjectColor = objectColor;
+
 	return Output;
 }
+
+VS_OUTPUT ApplyShadowShader_ApplyShadowTorus_Vertex_Shader_vs_main(VS_INPUT Input)
+{
+	return ApplyShadowVertex(Input, (float4x3)gWorldMatrix, gObjectColor);
+}
+
+// batched draws: the world matrix and color of up to DRAW_BATCH_SIZE
+// objects, drawn as instances. stream 1 holds every instance's index
+#define DRAW_BATCH_SIZE 48
+
+float4x3 gInstanceWorlds[DRAW_BATCH_SIZE];
+float4 gInstanceColors[DRAW_BATCH_SIZE];
+
+VS_OUTPUT ApplyShadowShader_ApplyShadowBatched_Vertex_Shader_vs_main(VS_INPUT Input, float instance : TEXCOORD7)
+{
+	return ApplyShadowVertex(Input, gInstanceWorlds[instance], gInstanceColors[instance]);
+}
 texture ShadowMap_Tex
 <
 	string ResourceName = ".\\";
@@ -81,38 +140,334 @@ texture ShadowMap_Tex
 sampler2D ShadowSampler = sampler_state
 {
 	Texture = (ShadowMap_Tex);
+	MinFilter = Point;
+	MagFilter = Point;
+	MipFilter = None;
+	AddressU = Clamp;
+	AddressV = Clamp;
 };
-float4 gObjectColor
-<
-	string UIName = "gObjectColor";
-	string UIWidget = "Color";
-	bool UIVisible = true;
-> = float4(1.00, 1.00, 0.00, 1.00);
+
+// blurred mean depth and mean squared depth, in the same atlas layout
+texture MomentMap_Tex;
+sampler2D MomentSampler = sampler_state
+{
+	Texture = (MomentMap_Tex);
+	MinFilter = Linear;
+	MagFilter = Linear;
+	MipFilter = None;
+	AddressU = Clamp;
+	AddressV = Clamp;
+};
+
+// far view distance of every cascade
+float4 gCascadeSplits;
+
+// depth bias of every cascade
+float4 gDepthBias;
+
+// 1 tints the cascades
+float gShowCascades = 0;
+
+// shadow map size in texels, and its inverse
+float2 gShadowMapSize = float2(2048, 1.0 / 2048);
+
+// radius of the Poisson disk in shadow texels
+float gPoissonRadius = 1.5;
+
+// steps the shadow map stores depth in: 65535 for 16 bit UNORM, 2^24 - 1
+// otherwise
+float gDepthSteps = 16777215;
+
+// smallest variance, against acne on flat receivers, and the fraction of
+// the lit probability cut off against light bleeding
+float gMinVariance = 0.000001;
+float gLightBleedReduction = 0.2;
 
 struct PS_INPUT
 {
-	float4 mClipPosition: TEXCOORD1;
-	float mDiffuse : TEXCOORD2;
+	float4 mContactPosition : TEXCOORD0;
+	float3 mShadowPosition[4] : TEXCOORD1;
+	float mDiffuse : TEXCOORD5;
+	float mViewDepth : TEXCOORD6;
+	float4 mObjectColor : COLOR0;
 };
 
+struct PS_POISSON_INPUT
+{
+	float4 mContactPosition : TEXCOORD0;
+	float3 mShadowPosition[4] : TEXCOORD1;
+	float mDiffuse : TEXCOORD5;
+	float mViewDepth : TEXCOORD6;
+	float4 mObjectColor : COLOR0;
+	float2 mScreenPosition : VPOS;
+};
+
+// pick the first cascade reaching past this pixel. cascade has a 1 for
+// the chosen one, and is all 0 beyond the last cascade. returns whether
+// the pixel can be in shadow at all
+bool SelectCascade(float3 shadowPositions[4], float viewDepth, out float3 shadowPosition, out float4 cascade)
+{
+	float4 beyond = viewDepth > gCascadeSplits;
+	cascade = float4(1, beyond.xyz) - beyond;
+
+	shadowPosition = shadowPositions[0] * cascade.x
+		+ shadowPositions[1] * cascade.y
+		+ shadowPositions[2] * cascade.z
+		+ shadowPositions[3] * cascade.w;
+
+	// the shadow map holds depth rounded to its storage. rounding the
+	// receiver's depth the same way compares like with like
+	shadowPosition.z = floor(shadowPosition.z * gDepthSteps + 0.5f) / gDepthSteps;
+
+	// a tightly fitted cascade doesn't cover the receivers nothing can
+	// shadow, so their position falls outside of the cascade's tile
+	float2 tileOrigin = float2(cascade.y + cascade.w, cascade.z + cascade.w) * 0.5f;
+	float2 tilePosition = shadowPosition.xy - tileOrigin;
+	return beyond.w == 0 && all(tilePosition >= 0) && all(tilePosition <= 0.5f);
+}
+
+float ContactLit(float4 contactPosition)
+{
+	return lerp(1, tex2Dproj(ContactShadowSampler, contactPosition).r, gContactShadowStrength);
+}
+
+// darkens the unlit part and tints the cascades
+float4 ShadePixel(float4 objectColor, float diffuse, float lit, float4 cascade)
+{
+	float3 rgb = saturate(diffuse) * objectColor.rgb;
+	rgb *= lerp(0.5f, 1.0f, lit);
+
+	float3 cascadeTint = float3(1, 0.6, 0.6) * cascade.x + float3(0.6, 1, 0.6) * cascade.y
+		+ float3(0.6, 0.6, 1) * cascade.z + float3(1, 1, 0.6) * cascade.w;
+	rgb *= lerp(1, cascadeTint, gShowCascades * dot(cascade, 1));
+
+	return(float4(rgb, 1.0f));
+}
+
+// hard shadow: 1 tap, one comparison
 float4 ApplyShadowShader_ApplyShadowTorus_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
 {
-	float3 rgb = saturate(Input.mDiffuse) * gObjectColor;
+	float3 shadowPosition;
+	float4 cascade;
+	bool canBeShadowed = SelectCascade(Input.mShadowPosition, Input.mViewDepth, shadowPosition, cascade);
+
+	float currentDepth = shadowPosition.z;
+	float shadowDepth = tex2D(ShadowSampler, shadowPosition.xy).r;
+
+	float lit = 1;
+	if (canBeShadowed && currentDepth > shadowDepth + dot(gDepthBias, cascade))
+	{
+		lit = 0;
+	}
+
+	return ShadePixel(Input.mObjectColor, Input.mDiffuse, min(lit, ContactLit(Input.mContactPosition)), cascade);
+}
+
+// 2x2 PCF: 4 taps, compared one by one and then weighted bilinearly,
+// like hardware shadow map filtering
+float4 ApplyShadowShader_ApplyShadowPCF_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	float3 shadowPosition;
+	float4 cascade;
+	bool canBeShadowed = SelectCascade(Input.mShadowPosition, Input.mViewDepth, shadowPosition, cascade);
+
+	// the four texels around the position, centers at integers
+	float2 texelPosition = shadowPosition.xy * gShadowMapSize.x - 0.5f;
+	float2 weight = frac(texelPosition);
+	float2 topLeft = (texelPosition - weight + 0.5f) * gShadowMapSize.y;
+
+	float4 shadowDepths;
+	shadowDepths.x = tex2D(ShadowSampler, topLeft).r;
+	shadowDepths.y = tex2D(ShadowSampler, topLeft + float2(gShadowMapSize.y, 0)).r;
+	shadowDepths.z = tex2D(ShadowSampler, topLeft + float2(0, gShadowMapSize.y)).r;
+	shadowDepths.w = tex2D(ShadowSampler, topLeft + gShadowMapSize.yy).r;
+
+	float4 isLit = shadowPosition.z <= shadowDepths + dot(gDepthBias, cascade);
+	float lit = lerp(lerp(isLit.x, isLit.y, weight.x), lerp(isLit.z, isLit.w, weight.x), weight.y);
+
+	lit = canBeShadowed ? lit : 1;
+	return ShadePixel(Input.mObjectColor, Input.mDiffuse, min(lit, ContactLit(Input.mContactPosition)), cascade);
+}
 
-	float currentDepth = Input.mClipPosition.z / Input.mClipPosition.w;
+// Poisson disk PCF: 12 taps on a disk rotated per screen pixel, which
+// turns banding into noise. (shader model 3 for VPOS and the loop)
+static const float2 PoissonDisk[12] =
+{
+	float2(-0.326, -0.406), float2(-0.840, -0.074), float2(-0.696, 0.457),
+	float2(-0.203, 0.621), float2(0.962, -0.195), float2(0.473, -0.480),
+	float2(0.519, 0.767), float2(0.185, -0.893), float2(0.507, 0.064),
+	float2(0.896, 0.412), float2(-0.322, -0.933), float2(-0.792, -0.598)
+};
 
-	float2 uv = Input.mClipPosition.xy / Input.mClipPosition.w;
-	uv.y = -uv.y;
-	uv = uv * 0.5 + 0.5;
+float4 ApplyShadowShader_ApplyShadowPoisson_Pixel_Shader_ps_main(PS_POISSON_INPUT Input) : COLOR
+{
+	float3 shadowPosition;
+	float4 cascade;
+	bool canBeShadowed = SelectCascade(Input.mShadowPosition, Input.mViewDepth, shadowPosition, cascade);
 
-	float shadowDepth = tex2D(ShadowSampler, uv).r;
+	// pseudo random angle from the screen position
+	float angle = frac(sin(dot(Input.mScreenPosition, float2(12.9898, 78.233))) * 43758.5453) * 6.2831853;
+	float2 rotation;
+	sincos(angle, rotation.y, rotation.x);
+	float2x2 rotationMatrix = float2x2(rotation.x, -rotation.y, rotation.y, rotation.x) * gPoissonRadius * gShadowMapSize.y;
 
-	if (currentDepth > shadowDepth + 0.0000125f)
+	float depth = shadowPosition.z - dot(gDepthBias, cascade);
+	float lit = 0;
+	for (int i = 0; i < 12; ++i)
 	{
-		rgb *= 0.5f;
+		float2 offset = mul(PoissonDisk[i], rotationMatrix);
+		lit += depth <= tex2D(ShadowSampler, shadowPosition.xy + offset).r;
 	}
+	lit /= 12;
 
-	return(float4(rgb, 1.0f));
+	lit = canBeShadowed ? lit : 1;
+	return ShadePixel(Input.mObjectColor, Input.mDiffuse, min(lit, ContactLit(Input.mContactPosition)), cascade);
+}
+
+// variance shadow map: 1 bilinear tap of the blurred moments and
+// Chebyshev's inequality. the blur costs 2 passes of 5 taps per shadow
+// map texel (ShadowMoments.fx), independent of the screen
+float4 ApplyShadowShader_ApplyShadowVSM_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	float3 shadowPosition;
+	float4 cascade;
+	bool canBeShadowed = SelectCascade(Input.mShadowPosition, Input.mViewDepth, shadowPosition, cascade);
+
+	float2 moments = tex2D(MomentSampler, shadowPosition.xy).rg;
+	float variance = max(moments.y - moments.x * moments.x, gMinVariance);
+	float depthDelta = shadowPosition.z - moments.x;
+
+	// upper bound of the lit fraction. the tail is cut off, since it
+	// only lights up shadows behind other shadows
+	float lit = variance / (variance + depthDelta * depthDelta);
+	lit = saturate((lit - gLightBleedReduction) / (1 - gLightBleedReduction));
+	lit = (depthDelta <= 0) ? 1 : lit;
+
+	lit = canBeShadowed ? lit : 1;
+	return ShadePixel(Input.mObjectColor, Input.mDiffuse, min(lit, ContactLit(Input.mContactPosition)), cascade);
+}
+
+// omnidirectional shadow of the point light from a cube map holding the
+// distance to the light. hard comparison only
+texture CubeShadowMap_Tex;
+samplerCUBE CubeShadowSampler = sampler_state
+{
+	Texture = (CubeShadowMap_Tex);
+	MinFilter = POINT;
+	MagFilter = POINT;
+	MipFilter = NONE;
+};
+
+float gLightRange = 3000;
+float gCubeDepthBias = 0.0003;
+
+struct VS_OMNI_OUTPUT
+{
+	float4 mPosition : POSITION;
+	float3 mLightToPosition : TEXCOORD1;
+	float mDiffuse : TEXCOORD5;
+};
+
+VS_OMNI_OUTPUT ApplyShadowShader_ApplyShadowOmni_Vertex_Shader_vs_main(VS_INPUT Input)
+{
+	VS_OMNI_OUTPUT Output;
+
+	float4 worldPosition = mul(Input.mPosition, gWorldMatrix);
+	Output.mPosition = mul(worldPosition, gViewProjectionMatrix);
+	Output.mLightToPosition = worldPosition.xyz - gWorldLightPosition.xyz;
+
+	float3 lightDir = normalize(Output.mLightToPosition);
+	float3 worldNormal = normalize(mul(Input.mNormal, (float3x3)gWorldMatrix));
+	Output.mDiffuse = dot(-lightDir, worldNormal);
+
+	return Output;
+}
+
+float4 ApplyShadowShader_ApplyShadowOmni_Pixel_Shader_ps_main(float3 lightToPosition : TEXCOORD1, float diffuse : TEXCOORD5) : COLOR
+{
+	float depth = length(lightToPosition) / gLightRange;
+	float shadowDepth = texCUBE(CubeShadowSampler, lightToPosition).r;
+	float lit = depth <= shadowDepth + gCubeDepthBias;
+
+	return ShadePixel(gObjectColor, diffuse, lit, float4(0, 0, 0, 0));
+}
+
+// spot lights sharing one shadow atlas, one row of texels per light:
+// the 4 rows of its shadow matrix, its position, color and atlas region
+// (min and max UV). a light's cone ends at the edge of its region. a
+// position w of 0 is a light that got no region, and casts no shadow.
+// ps_3_0 can't index constants in a loop, but it can compute where to
+// read a texture
+#define MAX_SPOT_LIGHTS 24
+#define SPOT_LIGHT_TEXELS 7
+
+texture SpotLights_Tex;
+sampler2D SpotLightSampler = sampler_state
+{
+	Texture = (SpotLights_Tex);
+	MinFilter = Point;
+	MagFilter = Point;
+	MipFilter = None;
+	AddressU = Clamp;
+	AddressV = Clamp;
+};
+
+int gNumSpotLights = 0;
+float gSpotDepthBias = 0.0025;
+
+float4 SpotLightTexel(float row, int column)
+{
+	return tex2Dlod(SpotLightSampler, float4((column + 0.5) / SPOT_LIGHT_TEXELS, row, 0, 0));
+}
+
+struct VS_ATLAS_OUTPUT
+{
+	float4 mPosition : POSITION;
+	float3 mWorldPosition : TEXCOORD1;
+	float3 mWorldNormal : TEXCOORD2;
+};
+
+VS_ATLAS_OUTPUT ApplyShadowShader_ApplyShadowAtlas_Vertex_Shader_vs_main(VS_INPUT Input)
+{
+	VS_ATLAS_OUTPUT Output;
+
+	float4 worldPosition = mul(Input.mPosition, gWorldMatrix);
+	Output.mPosition = mul(worldPosition, gViewProjectionMatrix);
+	Output.mWorldPosition = worldPosition.xyz;
+	Output.mWorldNormal = mul(Input.mNormal, (float3x3)gWorldMatrix);
+
+	return Output;
+}
+
+// every light in one pass: 1 tap of its region per light, hard comparison
+float4 ApplyShadowShader_ApplyShadowAtlas_Pixel_Shader_ps_main(float3 worldPosition : TEXCOORD1, float3 worldNormal : TEXCOORD2) : COLOR
+{
+	float3 normal = normalize(worldNormal);
+	float3 light = 0.2f;
+
+	for (int i = 0; i < gNumSpotLights; ++i)
+	{
+		float row = (i + 0.5) / MAX_SPOT_LIGHTS;
+		float4x4 shadowMatrix = float4x4(SpotLightTexel(row, 0), SpotLightTexel(row, 1),
+			SpotLightTexel(row, 2), SpotLightTexel(row, 3));
+
+		float4 shadowPosition = mul(float4(worldPosition, 1), shadowMatrix);
+		float2 uv = shadowPosition.xy / shadowPosition.w;
+		float4 region = SpotLightTexel(row, 6);
+		if (shadowPosition.w > 0 && all(uv >= region.xy) && all(uv <= region.zw))
+		{
+			float4 lightPosition = SpotLightTexel(row, 4);
+			float3 lightToPosition = worldPosition - lightPosition.xyz;
+			float depth = length(lightToPosition) / gLightRange;
+			float shadowDepth = tex2Dlod(ShadowSampler, float4(uv, 0, 0)).r;
+			float lit = max(depth <= shadowDepth + gSpotDepthBias, 1 - lightPosition.w);
+
+			float diffuse = saturate(dot(-normalize(lightToPosition), normal));
+			light += SpotLightTexel(row, 5).rgb * diffuse * saturate(1 - depth) * lit;
+		}
+	}
+
+	return float4(gObjectColor.rgb * light, 1);
 }
 
 //--------------------------------------------------------------//
@@ -127,3 +482,84 @@ technique ApplyShadowShader
 	}
 }
 
+technique ApplyShadowPCF
+{
+	pass ApplyShadowTorus
+	{
+		VertexShader = compile vs_2_0 ApplyShadowShader_ApplyShadowTorus_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 ApplyShadowShader_ApplyShadowPCF_Pixel_Shader_ps_main();
+	}
+}
+
+technique ApplyShadowPoisson
+{
+	pass ApplyShadowTorus
+	{
+		VertexShader = compile vs_3_0 ApplyShadowShader_ApplyShadowTorus_Vertex_Shader_vs_main();
+		PixelShader = compile ps_3_0 ApplyShadowShader_ApplyShadowPoisson_Pixel_Shader_ps_main();
+	}
+}
+
+technique ApplyShadowVSM
+{
+	pass ApplyShadowTorus
+	{
+		VertexShader = compile vs_2_0 ApplyShadowShader_ApplyShadowTorus_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 ApplyShadowShader_ApplyShadowVSM_Pixel_Shader_ps_main();
+	}
+}
+
+technique ApplyShadowOmni
+{
+	pass ApplyShadowTorus
+	{
+		VertexShader = compile vs_2_0 ApplyShadowShader_ApplyShadowOmni_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 ApplyShadowShader_ApplyShadowOmni_Pixel_Shader_ps_main();
+	}
+}
+
+technique ApplyShadowAtlas
+{
+	pass ApplyShadowTorus
+	{
+		VertexShader = compile vs_3_0 ApplyShadowShader_ApplyShadowAtlas_Vertex_Shader_vs_main();
+		PixelShader = compile ps_3_0 ApplyShadowShader_ApplyShadowAtlas_Pixel_Shader_ps_main();
+	}
+}
+
+// the filters again, for batched draws. (instancing needs shader model 3)
+technique ApplyShadowShaderBatched
+{
+	pass ApplyShadowTorus
+	{
+		VertexShader = compile vs_3_0 ApplyShadowShader_ApplyShadowBatched_Vertex_Shader_vs_main();
+		PixelShader = compile ps_3_0 ApplyShadowShader_ApplyShadowTorus_Pixel_Shader_ps_main();
+	}
+}
+
+technique ApplyShadowPCFBatched
+{
+	pass ApplyShadowTorus
+	{
+		VertexShader = compile vs_3_0 ApplyShadowShader_ApplyShadowBatched_Vertex_Shader_vs_main();
+		PixelShader = compile ps_3_0 ApplyShadowShader_ApplyShadowPCF_Pixel_Shader_ps_main();
+	}
+}
+
+technique ApplyShadowPoissonBatched
+{
+	pass ApplyShadowTorus
+	{
+		VertexShader = compile vs_3_0 ApplyShadowShader_ApplyShadowBatched_Vertex_Shader_vs_main();
+		PixelShader = compile ps_3_0 ApplyShadowShader_ApplyShadowPoisson_Pixel_Shader_ps_main();
+	}
+}
+
+technique ApplyShadowVSMBatched
+{
+	pass ApplyShadowTorus
+	{
+		VertexShader = compile vs_3_0 ApplyShadowShader_ApplyShadowBatched_Vertex_Shader_vs_main();
+		PixelShader = compile ps_3_0 ApplyShadowShader_ApplyShadowVSM_Pixel_Shader_ps_main();
+	}
+}
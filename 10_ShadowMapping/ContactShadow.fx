@@ -0,0 +1,158 @@
+//**************************************************************//
+//  Effect File exported by RenderMonkey 1.6
+//
+//  - Although many improvements were made to RenderMonkey FX  
+//    file export, there are still situations that may cause   
+//    compilation problems once the file is exported, such as  
+//    occasional naming conflicts for methods, since FX format 
+//    does not support any notions of name spaces. You need to 
+//    try to create workspaces in such a way as to minimize    
+//    potential naming conflicts on export.                    
+//    
+//  - Note that to minimize resulting name collisions in the FX 
+//    file, RenderMonkey will mangle names for passes, shaders  
+//    and function names as necessary to reduce name conflicts. 
+//**************************************************************//
+
+//--------------------------------------------------------------//
+// ContactShadow
+//--------------------------------------------------------------//
+// short shadows the shadow map is too coarse for, where the casters
+// touch the receivers. SceneDepth draws the view depth of the scene,
+// through the same draw queue as the lighting pass. ContactShadow marches
+// from every pixel towards the light over that depth, on a pre-transformed
+// quad over the screen. a pixel is in contact shadow if a step lands
+// behind the scene, but by less than the thickness objects are assumed
+// to have. (MarchContactShadow4() in ShaderFramework.cpp does the same on
+// the CPU)
+//--------------------------------------------------------------//
+
+float4x4 gWorldMatrix : World;
+float4x4 gViewProjectionMatrix : ViewProjection;
+
+// view distance of the far plane. depth is stored divided by it, so
+// the target's clear color of 1 is nothing drawn
+float gFarDepth = 10000;
+
+struct VS_DEPTH_OUTPUT
+{
+	float4 mPosition : POSITION;
+	float mViewDepth : TEXCOORD0;
+};
+
+VS_DEPTH_OUTPUT SceneDepthVertex(float4 position, float4x3 worldMatrix)
+{
+	VS_DEPTH_OUTPUT Output;
+
+	float4 worldPosition = float4(mul(position, worldMatrix), 1);
+	Output.mPosition = mul(worldPosition, gViewProjectionMatrix);
+
+	// w of a perspective projection is the view distance
+	Output.mViewDepth = Output.mPosition.w / gFarDepth;
+
+	return Output;
+}
+
+VS_DEPTH_OUTPUT ContactShadow_SceneDepth_Vertex_Shader_vs_main(float4 position : POSITION)
+{
+	return SceneDepthVertex(position, (float4x3)gWorldMatrix);
+}
+
+// batched draws, like ApplyShadow.fx
+#define DRAW_BATCH_SIZE 48
+
+float4x3 gInstanceWorlds[DRAW_BATCH_SIZE];
+
+VS_DEPTH_OUTPUT ContactShadow_SceneDepthBatched_Vertex_Shader_vs_main(float4 position : POSITION, float instance : TEXCOORD7)
+{
+	return SceneDepthVertex(position, gInstanceWorlds[instance]);
+}
+
+float4 ContactShadow_SceneDepth_Pixel_Shader_ps_main(float viewDepth : TEXCOORD0) : COLOR
+{
+	return float4(viewDepth.xxx, 1);
+}
+
+texture SceneDepth_Tex;
+sampler2D SceneDepthSampler = sampler_state
+{
+	Texture = (SceneDepth_Tex);
+	MinFilter = Point;
+	MagFilter = Point;
+	MipFilter = None;
+	AddressU = Clamp;
+	AddressV = Clamp;
+};
+
+// scale of the projection matrix in x and y
+float2 gProjectionScale;
+
+// view space direction towards the light, how far to march along it,
+// and the steps it takes
+float3 gViewLightDirection;
+float gContactDistance = 10;
+int gContactSteps = 8;
+
+// a step this much behind the scene is occluded, up to the thickness
+float gContactBias = 0.5;
+float gContactThickness = 5;
+
+float4 ContactShadow_ContactShadow_Pixel_Shader_ps_main(float2 uv : TEXCOORD0) : COLOR
+{
+	float depth = tex2D(SceneDepthSampler, uv).r * gFarDepth;
+	if (depth >= gFarDepth)
+	{
+		return 1;
+	}
+
+	// view position of the pixel, back from its depth
+	float2 ndc = float2(uv.x * 2 - 1, 1 - uv.y * 2);
+	float3 position = float3(ndc / gProjectionScale * depth, depth);
+	float3 marchStep = gViewLightDirection * (gContactDistance / gContactSteps);
+
+	float occluded = 0;
+	for (int i = 0; i < gContactSteps; ++i)
+	{
+		position += marchStep;
+
+		float2 stepUV = position.xy * gProjectionScale / position.z * float2(0.5, -0.5) + 0.5;
+		float depthDelta = position.z - tex2Dlod(SceneDepthSampler, float4(stepUV, 0, 0)).r * gFarDepth;
+		if (depthDelta > gContactBias && depthDelta < gContactThickness)
+		{
+			occluded = 1;
+		}
+	}
+
+	return 1 - occluded;
+}
+
+//--------------------------------------------------------------//
+// Technique Section for ContactShadow
+//--------------------------------------------------------------//
+technique SceneDepth
+{
+	pass SceneDepth
+	{
+		VertexShader = compile vs_2_0 ContactShadow_SceneDepth_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 ContactShadow_SceneDepth_Pixel_Shader_ps_main();
+	}
+}
+
+technique SceneDepthBatched
+{
+	pass SceneDepth
+	{
+		VertexShader = compile vs_3_0 ContactShadow_SceneDepthBatched_Vertex_Shader_vs_main();
+		PixelShader = compile ps_3_0 ContactShadow_SceneDepth_Pixel_Shader_ps_main();
+	}
+}
+
+technique ContactShadow
+{
+	pass ContactShadow
+	{
+		ZEnable = false;
+		VertexShader = NULL;
+		PixelShader = compile ps_3_0 ContactShadow_ContactShadow_Pixel_Shader_ps_main();
+	}
+}
@@ -77,6 +77,103 @@ float4 CreateShadowShader_CreateShadow_Pixel_Shader_ps_main(PS_INPUT Input) : CO
 	return float4(depth.xxx, 1);
 }
 
+// dynamic casters are drawn over the static casters' depth copied from
+// the cache, so they keep whichever of the two is nearer to the light
+float4x4 gShadowMatrix;
+
+texture StaticShadowMap_Tex;
+sampler2D StaticShadowSampler = sampler_state
+{
+	Texture = (StaticShadowMap_Tex);
+	MinFilter = Point;
+	MagFilter = Point;
+	MipFilter = None;
+};
+
+struct VS_DYNAMIC_OUTPUT
+{
+	float4 mPosition: POSITION;
+	float4 mClipPosition: TEXCOORD1;
+	float2 mAtlasPosition: TEXCOORD2;
+};
+
+VS_DYNAMIC_OUTPUT CreateShadowShader_CreateDynamicShadow_Vertex_Shader_vs_main(VS_INPUT Input)
+{
+	VS_DYNAMIC_OUTPUT Output;
+
+	float4 worldPosition = mul(Input.mPosition, gWorldMatrix);
+	Output.mPosition = mul(worldPosition, gLightViewMatrix);
+	Output.mPosition = mul(Output.mPosition, gLightProjectionMatrix);
+
+	Output.mClipPosition = Output.mPosition;
+	Output.mAtlasPosition = mul(worldPosition, gShadowMatrix).xy;
+
+	return Output;
+}
+
+struct PS_DYNAMIC_INPUT
+{
+	float4 mClipPosition: TEXCOORD1;
+	float2 mAtlasPosition: TEXCOORD2;
+};
+
+float4 CreateShadowShader_CreateDynamicShadow_Pixel_Shader_ps_main(PS_DYNAMIC_INPUT Input) : COLOR
+{
+	float depth = Input.mClipPosition.z / Input.mClipPosition.w;
+	float staticDepth = tex2D(StaticShadowSampler, Input.mAtlasPosition).r;
+	return float4(min(depth, staticDepth).xxx, 1);
+}
+
+// depth-only: positions in, nothing but depth out
+float4 CreateShadowShader_CreateShadowDepthOnly_Vertex_Shader_vs_main(float4 position : POSITION) : POSITION
+{
+	float4 worldPosition = mul(position, gWorldMatrix);
+	return mul(mul(worldPosition, gLightViewMatrix), gLightProjectionMatrix);
+}
+
+// copies the static casters' depth from a depth-only cache into the
+// depth buffer, on a pre-transformed quad
+float4 CreateShadowShader_RestoreStaticShadowDepth_Pixel_Shader_ps_main(float2 uv : TEXCOORD0, out float depth : DEPTH) : COLOR
+{
+	depth = tex2D(StaticShadowSampler, uv).r;
+	return 0;
+}
+
+// copies a static cache into the shadow map of the color path, where
+// their formats differ and StretchRect can't
+float4 CreateShadowShader_RestoreStaticShadowColor_Pixel_Shader_ps_main(float2 uv : TEXCOORD0) : COLOR
+{
+	float depth = tex2D(StaticShadowSampler, uv).r;
+	return float4(depth.xxx, 1);
+}
+
+// cube map of the point light: distance to the light, scaled down to
+// 0-1 by the light's range
+float gLightRange = 3000;
+
+struct VS_CUBE_OUTPUT
+{
+	float4 mPosition: POSITION;
+	float3 mLightToPosition: TEXCOORD1;
+};
+
+VS_CUBE_OUTPUT CreateShadowShader_CreateCubeShadow_Vertex_Shader_vs_main(float4 position : POSITION)
+{
+	VS_CUBE_OUTPUT Output;
+
+	float4 worldPosition = mul(position, gWorldMatrix);
+	Output.mPosition = mul(mul(worldPosition, gLightViewMatrix), gLightProjectionMatrix);
+	Output.mLightToPosition = worldPosition.xyz - gWorldLightPosition.xyz;
+
+	return Output;
+}
+
+float4 CreateShadowShader_CreateCubeShadow_Pixel_Shader_ps_main(float3 lightToPosition : TEXCOORD1) : COLOR
+{
+	float depth = length(lightToPosition) / gLightRange;
+	return float4(depth.xxx, 1);
+}
+
 float4x4 CreateShadowShader_CreateShadow_Pixel_Shader_gWorldMatrix;
 float4x4 CreateShadowShader_CreateShadow_Pixel_Shader_gLightViewMatrix;
 float4x4 CreateShadowShader_CreateShadow_Pixel_Shader_gLightProjectionMatrix;
@@ -100,3 +197,54 @@ technique CreateShadowShader
 	}
 }
 
+technique CreateDynamicShadowShader
+{
+	pass CreateDynamicShadow
+	{
+		VertexShader = compile vs_2_0 CreateShadowShader_CreateDynamicShadow_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 CreateShadowShader_CreateDynamicShadow_Pixel_Shader_ps_main();
+	}
+}
+
+technique CreateShadowDepthOnly
+{
+	pass CreateShadow
+	{
+		ColorWriteEnable = 0;
+		VertexShader = compile vs_2_0 CreateShadowShader_CreateShadowDepthOnly_Vertex_Shader_vs_main();
+		PixelShader = NULL;
+	}
+}
+
+technique RestoreStaticShadowDepth
+{
+	pass RestoreDepth
+	{
+		ColorWriteEnable = 0;
+		ZEnable = true;
+		ZFunc = Always;
+		ZWriteEnable = true;
+		VertexShader = NULL;
+		PixelShader = compile ps_2_0 CreateShadowShader_RestoreStaticShadowDepth_Pixel_Shader_ps_main();
+	}
+}
+
+technique RestoreStaticShadowColor
+{
+	pass RestoreColor
+	{
+		ZEnable = false;
+		ZWriteEnable = false;
+		VertexShader = NULL;
+		PixelShader = compile ps_2_0 CreateShadowShader_RestoreStaticShadowColor_Pixel_Shader_ps_main();
+	}
+}
+
+technique CreateCubeShadow
+{
+	pass CreateShadow
+	{
+		VertexShader = compile vs_2_0 CreateShadowShader_CreateCubeShadow_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 CreateShadowShader_CreateCubeShadow_Pixel_Shader_ps_main();
+	}
+}
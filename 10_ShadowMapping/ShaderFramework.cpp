@@ -12,6 +12,12 @@
 
 #include "ShaderFramework.h"
 #include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <stdlib.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
 
 #define PI           3.14159265f
 #define FOV          (PI/4.0f)							// Field of View
@@ -28,6 +34,11 @@
 LPDIRECT3D9             gpD3D = NULL;					// D3D
 LPDIRECT3DDEVICE9       gpD3DDevice = NULL;				// D3D device
 
+// the device type and vertex processing the device was made with. shown
+// on screen, so a run on the reference rasterizer or with software vertex
+// processing isn't taken for a hardware one
+char					gDeviceDescription[64] = "";
+
 // Fonts
 ID3DXFont*              gpFont = NULL;
 
@@ -35,9 +46,15 @@ ID3DXFont*              gpFont = NULL;
 LPD3DXMESH				gpTorus = NULL;
 LPD3DXMESH				gpDisc = NULL;
 
+// the same models with nothing but positions, for the depth-only shadow pass
+LPD3DXMESH				gpTorusPositions = NULL;
+LPD3DXMESH				gpDiscPositions = NULL;
+
 // Shaders
 LPD3DXEFFECT			gpApplyShadowShader = NULL;
 LPD3DXEFFECT			gpCreateShadowShader = NULL;
+LPD3DXEFFECT			gpShadowMomentsShader = NULL;
+LPD3DXEFFECT			gpContactShadowShader = NULL;
 
 // Textures
 
@@ -61,6 +78,178 @@ D3DXVECTOR4				gDiscColor(0, 1, 1, 1);
 LPDIRECT3DTEXTURE9		gpShadowRenderTarget = NULL;
 LPDIRECT3DSURFACE9		gpShadowDepthStencil = NULL;
 
+// depth of the static casters only, copied into the shadow map wherever
+// the dynamic casters have to be drawn again
+LPDIRECT3DTEXTURE9		gpStaticShadowCache = NULL;
+
+// keep the static casters in a cache instead of drawing every caster
+// every frame. (the color path's cache needs StretchRect from textures,
+// unless it's copied back by a shader)
+bool					gCacheStaticShadows = true;
+
+// storage of the color path, and what the hardware can render to
+int						gShadowStorage = SHADOW_STORAGE_32F;
+bool					gIsShadowStorageSupported[NUM_SHADOW_STORAGES];
+
+// display name of every storage, and its bytes per texel for the shadow
+// map with its depth buffer and for the static cache
+const char*				gShadowStorageNames[NUM_SHADOW_STORAGES] =
+{
+	"32-bit float", "16-bit unorm", "32-bit, 16-bit cache"
+};
+const DWORD				gShadowStorageBytes[NUM_SHADOW_STORAGES][2] =
+{
+	{ 8, 4 }, { 4, 2 }, { 8, 2 }
+};
+
+// depth-only shadow maps: INTZ depth textures read back as depth, with a
+// NULL format color target that takes no memory. null where unsupported
+LPDIRECT3DTEXTURE9		gpShadowDepthMap = NULL;
+LPDIRECT3DTEXTURE9		gpStaticShadowDepthCache = NULL;
+LPDIRECT3DSURFACE9		gpNullRenderTarget = NULL;
+bool					gUseDepthOnlyShadows = false;
+
+// cube shadow map of the point light, with its depth buffer
+LPDIRECT3DCUBETEXTURE9	gpCubeShadowMap = NULL;
+LPDIRECT3DSURFACE9		gpCubeShadowDepthStencil = NULL;
+
+// light the scene is lit by: LIGHT_MODE_
+int						gLightMode = LIGHT_MODE_DIRECTIONAL;
+
+// cube faces that had no casters last frame, and so are still cleared
+bool					gIsCubeFaceEmpty[6];
+
+// triangles drawn into every cube face this frame
+DWORD					gCubeFaceTriangles[6];
+
+// spot lights, how many of them are on, and the angle of their ring
+SpotLight				gSpotLights[MAX_SPOT_LIGHTS];
+int						gNumSpotLights = 8;
+float					gSpotRotation = 0.0f;
+
+// quadtree of the shadow atlas, allocated again every frame
+BYTE					gAtlasNodes[ATLAS_NODES];
+
+// the atlas' lighting pass loops over the lights, so it needs shader model 3.
+// it reads them from a float texture, one row per light
+bool					gIsShadowAtlasSupported = false;
+LPDIRECT3DTEXTURE9		gpSpotLightData = NULL;
+
+// GPU time of the cascades' shadow pass on the color and the depth-only
+// path, of every cube face, and of the atlas' shadow and lighting pass.
+// negative while unknown
+GPUTimer				gGPUTimers[NUM_GPU_TIMERS];
+int						gCurrentGPUTimer = 0;
+float					gShadowPassMilliseconds[2] = { -1.0f, -1.0f };
+float					gCubeFaceMilliseconds[6] = { -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f };
+float					gAtlasMilliseconds[2] = { -1.0f, -1.0f };
+
+// blurred depth moments for variance shadow mapping, and the target of
+// the horizontal blur pass
+LPDIRECT3DTEXTURE9		gpMomentRenderTarget = NULL;
+LPDIRECT3DTEXTURE9		gpMomentBlurTarget = NULL;
+
+// how the shadow map is filtered, and what the hardware can run
+int						gShadowFilter = SHADOW_FILTER_PCF;
+bool					gIsShadowFilterSupported[NUM_SHADOW_FILTERS];
+
+// ApplyShadow.fx technique and display name of every filter
+const char*				gShadowFilterTechniques[NUM_SHADOW_FILTERS] =
+{
+	"ApplyShadowShader", "ApplyShadowPCF", "ApplyShadowPoisson", "ApplyShadowVSM"
+};
+const char*				gShadowFilterNames[NUM_SHADOW_FILTERS] =
+{
+	"hard", "2x2 PCF", "Poisson PCF", "VSM"
+};
+
+// ApplyShadow.fx technique of every filter for batched draws, and whether
+// the hardware can run it
+const char*				gShadowFilterBatchedTechniques[NUM_SHADOW_FILTERS] =
+{
+	"ApplyShadowShaderBatched", "ApplyShadowPCFBatched", "ApplyShadowPoissonBatched", "ApplyShadowVSMBatched"
+};
+bool					gIsBatchedFilterSupported[NUM_SHADOW_FILTERS];
+
+// lighting pass draws queued this frame, and whether they're drawn in
+// batches of instances or one by one
+DrawItem*				gpDrawItems = NULL;
+int						gNumDrawItems = 0;
+bool					gBatchDraws = true;
+
+// instancing: the meshes' vertices in stream 0 with the index of the
+// instance in stream 1, and the buffer of indices. NULL without shader
+// model 3. meshes of another FVF are drawn one by one
+LPDIRECT3DVERTEXDECLARATION9	gpInstanceDeclaration = NULL;
+LPDIRECT3DVERTEXBUFFER9	gpInstanceIndexBuffer = NULL;
+DWORD					gInstanceFVF = 0;
+
+// the crowd: how many objects (so that the lighting pass draws 2, 10,
+// 1k and 100k), and their world matrices and colors
+const int				gCrowdSizes[NUM_CROWD_SIZES] = { 0, 8, 998, 99998 };
+int						gCrowdSize = 0;
+D3DXMATRIX*				gpCrowdWorlds = NULL;
+D3DXVECTOR4*			gpCrowdColors = NULL;
+
+// CPU time of queueing and submitting the lighting pass for every crowd
+// size, one by one and batched. negative while unknown
+float					gSubmitMilliseconds[NUM_CROWD_SIZES][2] =
+{
+	{ -1.0f, -1.0f }, { -1.0f, -1.0f }, { -1.0f, -1.0f }, { -1.0f, -1.0f }
+};
+
+// screen space contact shadows: the view depth of the scene and the
+// mask marched over it, both the size of the screen. the march loops
+// over a constant, so it needs shader model 3
+LPDIRECT3DTEXTURE9		gpSceneDepthTarget = NULL;
+LPDIRECT3DTEXTURE9		gpContactShadowTarget = NULL;
+bool					gIsContactShadowSupported = false;
+bool					gContactShadows = true;
+int						gContactSteps = 8;
+
+// measured on request: the step counts, the fraction of the pixels
+// around the torus they shadow differently from the reference, and the
+// fewest steps within CONTACT_ERROR_TARGET (-1 for none). negative
+// while unmeasured
+const int				gContactMeasuredSteps[NUM_CONTACT_MEASUREMENTS] = { 0, 1, 2, 4, 8, 16, 32 };
+float					gContactErrors[NUM_CONTACT_MEASUREMENTS] = { -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f };
+int						gContactStepsNeeded = -1;
+bool					gMeasureContactShadows = false;
+
+// shadow cascades of this frame
+ShadowCascade			gCascades[NUM_CASCADES];
+
+// tint every cascade in its own color
+bool					gShowCascades = false;
+
+// fit the cascades to the casters and receivers instead of the whole
+// view frustum slice
+bool					gTightShadowFit = true;
+
+// bounding volumes of the models in object space
+D3DXVECTOR3				gTorusBoundingCenter(0, 0, 0);
+float					gTorusBoundingRadius = 0.0f;
+D3DXVECTOR3				gTorusBoundingMin(0, 0, 0);
+D3DXVECTOR3				gTorusBoundingMax(0, 0, 0);
+D3DXVECTOR3				gDiscBoundingCenter(0, 0, 0);
+float					gDiscBoundingRadius = 0.0f;
+D3DXVECTOR3				gDiscBoundingMin(0, 0, 0);
+D3DXVECTOR3				gDiscBoundingMax(0, 0, 0);
+
+// triangle statistics of the camera pass in this frame
+TriangleStats			gTriangleStats;
+
+// clip space positions for counting the triangles, sized for the
+// largest mesh at load time
+D3DXVECTOR4*			gpClipPositions = NULL;
+DWORD					gNumClipPositions = 0;
+
+// guard band of the device in screen space
+float					gGuardBandLeft = 0.0f;
+float					gGuardBandTop = 0.0f;
+float					gGuardBandRight = WIN_WIDTH;
+float					gGuardBandBottom = WIN_HEIGHT;
+
 //-----------------------------------------------------------------------
 // Program entry point/message loop
 //-----------------------------------------------------------------------
@@ -144,6 +333,90 @@ void ProcessInput(HWND hWnd, WPARAM keyPress)
 	case VK_ESCAPE:
 		PostMessage(hWnd, WM_DESTROY, 0L, 0L);
 		break;
+	case 'C':
+		gShowCascades = !gShowCascades;
+		break;
+	case 'F':
+		gTightShadowFit = !gTightShadowFit;
+		break;
+	case 'S':
+		gCacheStaticShadows = !gCacheStaticShadows;
+		break;
+	case 'D':
+		// the other path's shadow map and cache are out of date
+		if (gpShadowDepthMap)
+		{
+			gUseDepthOnlyShadows = !gUseDepthOnlyShadows;
+			InvalidateStaticShadowCache();
+		}
+		break;
+	case 'M':
+		// next storage this hardware can render to. the targets are made
+		// again, so the caches are empty
+		{
+			int storage = gShadowStorage;
+			do
+			{
+				storage = (storage + 1) % NUM_SHADOW_STORAGES;
+			} while (!gIsShadowStorageSupported[storage]);
+
+			ReleaseShadowStorage();
+			if (!CreateShadowStorage(storage))
+			{
+				ReleaseShadowStorage();
+				CreateShadowStorage(SHADOW_STORAGE_32F);
+			}
+
+			InvalidateStaticShadowCache();
+		}
+		break;
+	case 'O':
+		if (gpCubeShadowMap)
+		{
+			SetLightMode((gLightMode == LIGHT_MODE_POINT) ? LIGHT_MODE_DIRECTIONAL : LIGHT_MODE_POINT);
+		}
+		break;
+	case 'L':
+		if (gIsShadowAtlasSupported)
+		{
+			SetLightMode((gLightMode == LIGHT_MODE_SPOTS) ? LIGHT_MODE_DIRECTIONAL : LIGHT_MODE_SPOTS);
+		}
+		break;
+	case VK_ADD:
+	case VK_OEM_PLUS:
+		gNumSpotLights = min(gNumSpotLights + 1, MAX_SPOT_LIGHTS);
+		break;
+	case VK_SUBTRACT:
+	case VK_OEM_MINUS:
+		gNumSpotLights = max(gNumSpotLights - 1, 1);
+		break;
+	case 'B':
+		gBatchDraws = !gBatchDraws;
+		break;
+	case 'N':
+		gCrowdSize = (gCrowdSize + 1) % NUM_CROWD_SIZES;
+		BuildCrowd(gCrowdSizes[gCrowdSize]);
+		break;
+	case 'K':
+		gContactShadows = !gContactShadows;
+		break;
+	case VK_OEM_4:
+		gContactSteps = max(gContactSteps - 1, 1);
+		break;
+	case VK_OEM_6:
+		gContactSteps = min(gContactSteps + 1, MAX_CONTACT_STEPS);
+		break;
+	case 'R':
+		// only the cascades have contact shadows
+		gMeasureContactShadows = gIsContactShadowSupported && gLightMode == LIGHT_MODE_DIRECTIONAL;
+		break;
+	case 'P':
+		// next filter this hardware can run. the hard one always can
+		do
+		{
+			gShadowFilter = (gShadowFilter + 1) % NUM_SHADOW_FILTERS;
+		} while (!gIsShadowFilterSupported[gShadowFilter]);
+		break;
 	}
 }
 
@@ -185,33 +458,30 @@ void RenderFrame()
 // draw 3D objects and so on
 void RenderScene()
 {
-	// create light-view matrix
+	// create light-view matrix. the shadow treats the light as
+	// directional, shining from its position towards the origin
 	D3DXMATRIXA16 matLightView;
 	{
 		D3DXVECTOR3 vEyePt(gWorldLightPosition.x, gWorldLightPosition.y, gWorldLightPosition.z);
+		D3DXVec3Normalize(&vEyePt, &vEyePt);
+		vEyePt *= LIGHT_DISTANCE;
 		D3DXVECTOR3 vLookatPt(0.0f, 0.0f, 0.0f);
 		D3DXVECTOR3 vUpVec(0.0f, 1.0f, 0.0f);
 		D3DXMatrixLookAtLH(&matLightView, &vEyePt, &vLookatPt, &vUpVec);
 	}
 
-	// create light-projection matrix
-	D3DXMATRIXA16 matLightProjection;
-	{
-		D3DXMatrixPerspectiveFovLH(&matLightProjection, D3DX_PI / 4.0f, 1, 1, 3000);
-	}
-
 	// create view/projection matrix
+	D3DXMATRIXA16 matView;
+	D3DXMATRIXA16 matProjection;
 	D3DXMATRIXA16 matViewProjection;
 	{
 		// make the view matrix
-		D3DXMATRIXA16 matView;
 		D3DXVECTOR3 vEyePt(gWorldCameraPosition.x, gWorldCameraPosition.y, gWorldCameraPosition.z);
 		D3DXVECTOR3 vLookatPt(0.0f, 0.0f, 0.0f);
 		D3DXVECTOR3 vUpVec(0.0f, 1.0f, 0.0f);
 		D3DXMatrixLookAtLH(&matView, &vEyePt, &vLookatPt, &vUpVec);
 
 		// projection matrix
-		D3DXMATRIXA16			matProjection;
 		D3DXMatrixPerspectiveFovLH(&matProjection, FOV, ASPECT_RATIO, NEAR_PLANE, FAR_PLANE);
 
 		D3DXMatrixMultiply(&matViewProjection, &matView, &matProjection);
@@ -242,6 +512,50 @@ void RenderScene()
 		D3DXMatrixMultiply(&matDiscWorld, &matScale, &matTrans);
 	}
 
+	// light space bounds of the models. both of them cast shadows and
+	// receive them
+	D3DXVECTOR3 torusMin, torusMax;
+	D3DXVECTOR3 discMin, discMax;
+	D3DXVECTOR3 sceneMin, sceneMax;
+	{
+		D3DXMATRIXA16 matWorldLightView;
+		D3DXMatrixMultiply(&matWorldLightView, &matTorusWorld, &matLightView);
+		TransformBoundingBox(&matWorldLightView, &gTorusBoundingMin, &gTorusBoundingMax, &torusMin, &torusMax);
+
+		D3DXMatrixMultiply(&matWorldLightView, &matDiscWorld, &matLightView);
+		TransformBoundingBox(&matWorldLightView, &gDiscBoundingMin, &gDiscBoundingMax, &discMin, &discMax);
+
+		// the cascades are fitted to a sphere around the torus' origin,
+		// not to its box. the box changes as the torus spins, which would
+		// move the tight fit and redraw the static cache every frame. the
+		// torus only spins about its origin, so the sphere stays exactly
+		// the same, bit for bit
+		D3DXVECTOR3 torusCenter(matTorusWorld._41, matTorusWorld._42, matTorusWorld._43);
+		float torusRadius = D3DXVec3Length(&gTorusBoundingCenter) + gTorusBoundingRadius;
+		D3DXVec3TransformCoord(&torusCenter, &torusCenter, &matLightView);
+
+		D3DXVECTOR3 extent(torusRadius, torusRadius, torusRadius);
+		D3DXVECTOR3 torusSphereMin = torusCenter - extent;
+		D3DXVECTOR3 torusSphereMax = torusCenter + extent;
+		D3DXVec3Minimize(&sceneMin, &torusSphereMin, &discMin);
+		D3DXVec3Maximize(&sceneMax, &torusSphereMax, &discMax);
+	}
+
+	// split the view frustum and fit a light projection to every part
+	ComputeShadowCascades(&matView, &matLightView, &sceneMin, &sceneMax, &sceneMin, &sceneMax);
+
+	// find out how the camera pass' triangles are going to be culled
+	ZeroMemory(&gTriangleStats, sizeof(gTriangleStats));
+	{
+		D3DXMATRIXA16 matWorldViewProjection;
+
+		D3DXMatrixMultiply(&matWorldViewProjection, &matTorusWorld, &matViewProjection);
+		CountTriangles(gpTorus, &matWorldViewProjection, &gTriangleStats);
+
+		D3DXMatrixMultiply(&matWorldViewProjection, &matDiscWorld, &matViewProjection);
+		CountTriangles(gpDisc, &matWorldViewProjection, &gTriangleStats);
+	}
+
 	// current hardware backbuffer and depth buffer
 	LPDIRECT3DSURFACE9 pHWBackBuffer = NULL;
 	LPDIRECT3DSURFACE9 pHWDepthStencilBuffer = NULL;
@@ -252,42 +566,53 @@ void RenderScene()
 	// 1. create shadow
 	//////////////////////////////
 
-	// use shadow render target and depth buffer
-	LPDIRECT3DSURFACE9 pShadowSurface = NULL;
-	if (SUCCEEDED(gpShadowRenderTarget->GetSurfaceLevel(0, &pShadowSurface)))
+	// the light is directional for the cascades, and a point light for
+	// the cube map. the spot lights share the atlas, and their lighting is
+	// timed along with it
+	LPDIRECT3DTEXTURE9 pShadowMap = NULL;
+	if (gLightMode == LIGHT_MODE_POINT)
 	{
-		gpD3DDevice->SetRenderTarget(0, pShadowSurface);
-		pShadowSurface->Release();
-		pShadowSurface = NULL;
+		RenderCubeShadowMap(&matTorusWorld, &matDiscWorld);
 	}
-	gpD3DDevice->SetDepthStencilSurface(gpShadowDepthStencil);
-
-	// clears the shadow info from last frame
-	gpD3DDevice->Clear(0, NULL, (D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER), 0xFFFFFFFF, 1.0f, 0);
+	else if (gLightMode == LIGHT_MODE_SPOTS)
+	{
+		UpdateSpotLights(&matView, &matViewProjection);
+		AllocateShadowAtlas();
 
-	// set global variables for shadow creating shader
-	gpCreateShadowShader->SetMatrix("gWorldMatrix", &matTorusWorld);
-	gpCreateShadowShader->SetMatrix("gLightViewMatrix", &matLightView);
-	gpCreateShadowShader->SetMatrix("gLightProjectionMatrix", &matLightProjection);
+		BeginGPUTimer(SHADOW_PASS_ATLAS);
+		RenderShadowAtlas(&matTorusWorld, &matDiscWorld);
+		MarkGPUTimer();
+	}
+	else
+	{
+		pShadowMap = RenderCascadeShadowMaps(&matLightView, &matTorusWorld, &matDiscWorld, &torusMin, &torusMax);
+	}
 
-	// begin CreateShadow shader
+	// contact shadows of the directional light: the scene's depth goes
+	// through the hardware depth buffer first, which is cleared again
+	// for the lighting pass
+	bool hasContactShadows = gIsContactShadowSupported && gLightMode == LIGHT_MODE_DIRECTIONAL
+		&& (gContactShadows || gMeasureContactShadows);
+	if (hasContactShadows)
 	{
-		UINT numPasses = 0;
-		gpCreateShadowShader->Begin(&numPasses, NULL);
+		D3DXVECTOR3 viewLightDirection(gWorldLightPosition.x, gWorldLightPosition.y, gWorldLightPosition.z);
+		D3DXVec3TransformNormal(&viewLightDirection, &viewLightDirection, &matView);
+		D3DXVec3Normalize(&viewLightDirection, &viewLightDirection);
+
+		gpD3DDevice->SetDepthStencilSurface(pHWDepthStencilBuffer);
+		RenderSceneDepth(&matViewProjection, &matTorusWorld, &matDiscWorld);
+
+		if (gMeasureContactShadows)
 		{
-			for (UINT i = 0; i < numPasses; ++i)
-			{
-				gpCreateShadowShader->BeginPass(i);
-				{
-					// draw the torus
-					gpTorus->DrawSubset(0);
-				}
-				gpCreateShadowShader->EndPass();
-			}
+			MeasureContactShadows(&matView, &matProjection, &matLightView, &matTorusWorld, &matDiscWorld, &viewLightDirection);
+			gMeasureContactShadows = false;
 		}
-		gpCreateShadowShader->End();
-	}
 
+		if (gContactShadows)
+		{
+			RenderContactShadows(&matProjection, &viewLightDirection);
+		}
+	}
 
 	//////////////////////////////
 	// 2. apply shadow
@@ -302,200 +627,2610 @@ void RenderScene()
 	pHWDepthStencilBuffer->Release();
 	pHWDepthStencilBuffer = NULL;
 
+	if (hasContactShadows)
+	{
+		gpD3DDevice->Clear(0, NULL, D3DCLEAR_ZBUFFER, 0, 1.0f, 0);
+	}
+
 
 	// set global variables for ApplyShadow shader
-	gpApplyShadowShader->SetMatrix("gWorldMatrix", &matTorusWorld);	//torus
 	gpApplyShadowShader->SetMatrix("gViewProjectionMatrix", &matViewProjection);
-	gpApplyShadowShader->SetMatrix("gLightViewMatrix", &matLightView);
-	gpApplyShadowShader->SetMatrix("gLightProjectionMatrix", &matLightProjection);
-
-	gpApplyShadowShader->SetVector("gWorldLightPosition", &gWorldLightPosition);
 
-	gpApplyShadowShader->SetVector("gObjectColor", &gTorusColor);
-
-	gpApplyShadowShader->SetTexture("ShadowMap_Tex", gpShadowRenderTarget);
-
-
-	// start a shader
-	UINT numPasses = 0;
-	gpApplyShadowShader->Begin(&numPasses, NULL);
+	D3DXMATRIX shadowMatrices[NUM_CASCADES];
+	D3DXVECTOR4 cascadeSplits;
+	D3DXVECTOR4 depthBias;
+	for (int i = 0; i < NUM_CASCADES; ++i)
 	{
-		for (UINT i = 0; i < numPasses; ++i)
-		{
-			gpApplyShadowShader->BeginPass(i);
-			{
-				// draw the torus
-				gpTorus->DrawSubset(0);
-
-				// draw the disc
-				gpApplyShadowShader->SetMatrix("gWorldMatrix", &matDiscWorld);
-				gpApplyShadowShader->SetVector("gObjectColor", &gDiscColor);
-				gpApplyShadowShader->CommitChanges();
-				gpDisc->DrawSubset(0);
-			}
-			gpApplyShadowShader->EndPass();
-		}
+		shadowMatrices[i] = gCascades[i].mShadowMatrix;
+		cascadeSplits[i] = gCascades[i].mFar;
+		depthBias[i] = gCascades[i].mDepthBias;
 	}
-	gpApplyShadowShader->End();
-}
-
-// display debug info
-void RenderInfo()
-{
-	// text color
-	D3DCOLOR fontColor = D3DCOLOR_ARGB(255, 255, 255, 255);
-
-	// location to display the text
-	RECT rct;
-	rct.left = 5;
-	rct.right = WIN_WIDTH / 3;
-	rct.top = 5;
-	rct.bottom = WIN_HEIGHT / 3;
+	gpApplyShadowShader->SetMatrixArray("gShadowMatrices", shadowMatrices, NUM_CASCADES);
+	gpApplyShadowShader->SetVector("gCascadeSplits", &cascadeSplits);
+	gpApplyShadowShader->SetVector("gDepthBias", &depthBias);
+	gpApplyShadowShader->SetFloat("gShowCascades", gShowCascades ? 1.0f : 0.0f);
 
-	// display debug key info
-	gpFont->DrawText(NULL, "Demo Framework\n\nESC: Exit", -1, &rct, 0, fontColor);
-}
+	gpApplyShadowShader->SetVector("gWorldLightPosition", &gWorldLightPosition);
 
-//------------------------------------------------------------
-// Initialization code
-//------------------------------------------------------------
-bool InitEverything(HWND hWnd)
-{
-	// init D3D
-	if (!InitD3D(hWnd))
+	if (gLightMode == LIGHT_MODE_SPOTS)
 	{
-		return false;
+		SetShadowAtlasConstants();
 	}
-
-	// create a render target
-	const int shadowMapSize = 2048;
-	if (FAILED(gpD3DDevice->CreateTexture(shadowMapSize, shadowMapSize,
-		1, D3DUSAGE_RENDERTARGET, D3DFMT_R32F,
-		D3DPOOL_DEFAULT, &gpShadowRenderTarget, NULL)))
+	else if (gLightMode == LIGHT_MODE_POINT)
 	{
-		return false;
+		gpApplyShadowShader->SetTexture("CubeShadowMap_Tex", gpCubeShadowMap);
+		gpApplyShadowShader->SetFloat("gLightRange", POINT_LIGHT_RANGE);
+		gpApplyShadowShader->SetFloat("gCubeDepthBias", CUBE_SHADOW_BIAS / POINT_LIGHT_RANGE);
+		gpApplyShadowShader->SetTechnique("ApplyShadowOmni");
 	}
-
-	// also need to make a depthbuffer which has same size as shadow map
-	if (FAILED(gpD3DDevice->CreateDepthStencilSurface(shadowMapSize, shadowMapSize,
-		D3DFMT_D24X8, D3DMULTISAMPLE_NONE, 0, TRUE,
-		&gpShadowDepthStencil, NULL)))
+	else
 	{
-		return false;
+		gpApplyShadowShader->SetTexture("ShadowMap_Tex", pShadowMap);
+		gpApplyShadowShader->SetTexture("MomentMap_Tex", gpMomentRenderTarget);
+		gpApplyShadowShader->SetFloat("gDepthSteps", GetShadowDepthSteps());
+		gpApplyShadowShader->SetTechnique(gShadowFilterTechniques[gShadowFilter]);
 	}
 
-	// loading models, shaders and textures
-	if (!LoadAssets())
-	{
-		return false;
-	}
+	gpApplyShadowShader->SetTexture("ContactShadowMap_Tex", gpContactShadowTarget);
+	gpApplyShadowShader->SetFloat("gContactShadowStrength", (hasContactShadows && gContactShadows) ? 1.0f : 0.0f);
 
-	// load fonts
-	if (FAILED(D3DXCreateFont(gpD3DDevice, 20, 10, FW_BOLD, 1, FALSE, DEFAULT_CHARSET,
-		OUT_DEFAULT_PRECIS, DEFAULT_QUALITY, (DEFAULT_PITCH | FF_DONTCARE),
-		"Arial", &gpFont)))
-	{
-		return false;
-	}
 
-	return true;
-}
+	// queue the objects, then draw them sorted by technique and mesh.
+	// only the cascades' filters have batched techniques
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER start;
+	LARGE_INTEGER end;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
 
-// init D3D object and device
-bool InitD3D(HWND hWnd)
-{
-	// D3D object
-	gpD3D = Direct3DCreate9(D3D_SDK_VERSION);
-	if (!gpD3D)
+	D3DXHANDLE technique = gpApplyShadowShader->GetCurrentTechnique();
+	D3DXHANDLE batchedTechnique = NULL;
+	if (gLightMode == LIGHT_MODE_DIRECTIONAL && gIsBatchedFilterSupported[gShadowFilter])
 	{
-		return false;
+		batchedTechnique = gpApplyShadowShader->GetTechniqueByName(gShadowFilterBatchedTechniques[gShadowFilter]);
 	}
 
-	// fill in the structure needed to create a D3D device
-	D3DPRESENT_PARAMETERS d3dpp;
-	ZeroMemory(&d3dpp, sizeof(d3dpp));
+	QueueScene(gpApplyShadowShader, technique, batchedTechnique, &matTorusWorld, &matDiscWorld);
+	FlushDraws();
 
-	d3dpp.BackBufferWidth = WIN_WIDTH;
-	d3dpp.BackBufferHeight = WIN_HEIGHT;
-	d3dpp.BackBufferFormat = D3DFMT_X8R8G8B8;
-	d3dpp.BackBufferCount = 1;
-	d3dpp.MultiSampleType = D3DMULTISAMPLE_NONE;
-	d3dpp.MultiSampleQuality = 0;
-	d3dpp.SwapEffect = D3DSWAPEFFECT_DISCARD;
-	d3dpp.hDeviceWindow = hWnd;
-	d3dpp.Windowed = TRUE;
-	d3dpp.EnableAutoDepthStencil = TRUE;
-	d3dpp.AutoDepthStencilFormat = D3DFMT_D24X8;
-	d3dpp.Flags = D3DPRESENTFLAG_DISCARD_DEPTHSTENCIL;
-	d3dpp.FullScreen_RefreshRateInHz = 0;
-	d3dpp.PresentationInterval = D3DPRESENT_INTERVAL_ONE;
+	QueryPerformanceCounter(&end);
+	float milliseconds = (float)((end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart);
+	float & average = gSubmitMilliseconds[gCrowdSize][(gBatchDraws && batchedTechnique) ? 1 : 0];
+	average = (average < 0.0f) ? milliseconds : average * 0.9f + milliseconds * 0.1f;
 
-	// create a D3D device
-	if (FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, hWnd,
-		D3DCREATE_HARDWARE_VERTEXPROCESSING,
-		&d3dpp, &gpD3DDevice)))
+	if (gLightMode == LIGHT_MODE_SPOTS)
 	{
-		return false;
+		EndGPUTimer();
 	}
-
-	return true;
 }
 
-bool LoadAssets()
+// draw the casters into every cascade's tile of the shadow map, and
+// return the shadow map of the path used
+LPDIRECT3DTEXTURE9 RenderCascadeShadowMaps(const D3DXMATRIX * pLightView, const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld,
+	const D3DXVECTOR3 * pTorusMin, const D3DXVECTOR3 * pTorusMax)
 {
-	// loading textures
+	// the disc never moves, so it's a static caster. the torus is dynamic
+	D3DXVECTOR3 torusCenter;
+	float torusRadius;
+	GetWorldBoundingSphere(pTorusWorld, &gTorusBoundingCenter, gTorusBoundingRadius, &torusCenter, &torusRadius);
+
+	D3DXVECTOR3 discCenter;
+	float discRadius;
+	GetWorldBoundingSphere(pDiscWorld, &gDiscBoundingCenter, gDiscBoundingRadius, &discCenter, &discRadius);
+
+	// the depth-only path keeps the shadow map in a depth texture and
+	// writes no color at all. the color path writes z/w into an R32F
+	// target next to a depth buffer
+	bool isDepthOnly = gUseDepthOnlyShadows;
+	LPDIRECT3DTEXTURE9 pShadowMap = isDepthOnly ? gpShadowDepthMap : gpShadowRenderTarget;
+	LPDIRECT3DTEXTURE9 pStaticCache = isDepthOnly ? gpStaticShadowDepthCache : gpStaticShadowCache;
+	DWORD clearFlags = isDepthOnly ? D3DCLEAR_ZBUFFER : (D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER);
+	const char * casterTechnique = isDepthOnly ? "CreateShadowDepthOnly" : "CreateShadowShader";
+	LPD3DXMESH pTorusCaster = isDepthOnly ? gpTorusPositions : gpTorus;
+	LPD3DXMESH pDiscCaster = isDepthOnly ? gpDiscPositions : gpDisc;
 
-	// loading shaders
-	gpApplyShadowShader = LoadShader("ApplyShadow.fx");
-	if (!gpApplyShadowShader)
+	LPDIRECT3DSURFACE9 pShadowSurface = NULL;
+	pShadowMap->GetSurfaceLevel(0, &pShadowSurface);
+
+	LPDIRECT3DSURFACE9 pStaticSurface = NULL;
+	if (pStaticCache)
 	{
-		return false;
+		pStaticCache->GetSurfaceLevel(0, &pStaticSurface);
 	}
 
-	gpCreateShadowShader = LoadShader("CreateShadow.fx");
-	if (!gpCreateShadowShader)
+	gpCreateShadowShader->SetMatrix("gLightViewMatrix", pLightView);
+
+	bool isCaching = gCacheStaticShadows && pStaticSurface;
+
+	BeginGPUTimer(isDepthOnly ? SHADOW_PASS_DEPTH_ONLY : SHADOW_PASS_COLOR);
+
+	// draw every cascade into its tile, skipping casters outside of it
+	for (int cascade = 0; cascade < NUM_CASCADES; ++cascade)
 	{
-		return false;
+		ShadowCascade & shadowCascade = gCascades[cascade];
+		shadowCascade.mStaticTriangles = 0;
+		shadowCascade.mDynamicTriangles = 0;
+
+		RECT tileRect = { (cascade % 2) * CASCADE_SIZE, (cascade / 2) * CASCADE_SIZE,
+			(cascade % 2 + 1) * CASCADE_SIZE, (cascade / 2 + 1) * CASCADE_SIZE };
+		D3DVIEWPORT9 viewport = { tileRect.left, tileRect.top, CASCADE_SIZE, CASCADE_SIZE, 0.0f, 1.0f };
+
+		bool hasStaticCaster = IsSphereInCascade(&shadowCascade, pLightView, &discCenter, discRadius);
+		bool hasDynamicCaster = IsSphereInCascade(&shadowCascade, pLightView, &torusCenter, torusRadius);
+
+		gpCreateShadowShader->SetMatrix("gLightProjectionMatrix", &shadowCascade.mLightProjection);
+
+		if (!isCaching)
+		{
+			// draw everything into the shadow map directly
+			SetShadowRenderTarget(pShadowSurface, isDepthOnly);
+			gpD3DDevice->SetViewport(&viewport);
+			gpD3DDevice->Clear(0, NULL, clearFlags, 0xFFFFFFFF, 1.0f, 0);
+
+			gpCreateShadowShader->SetTechnique(casterTechnique);
+			if (hasStaticCaster)
+			{
+				gpCreateShadowShader->SetMatrix("gWorldMatrix", pDiscWorld);
+				DrawShadowCaster(pDiscCaster);
+				shadowCascade.mStaticTriangles = gpDisc->GetNumFaces();
+			}
+
+			if (hasDynamicCaster)
+			{
+				gpCreateShadowShader->SetMatrix("gWorldMatrix", pTorusWorld);
+				DrawShadowCaster(pTorusCaster);
+				shadowCascade.mDynamicTriangles = gpTorus->GetNumFaces();
+			}
+
+			shadowCascade.mRedrawnTexels = CASCADE_SIZE * CASCADE_SIZE;
+			shadowCascade.mIsStaticCached = false;
+			continue;
+		}
+
+		// the static casters are drawn into the cache again only when
+		// the cascade's projection has changed
+		bool isStaticRedrawn = !shadowCascade.mIsStaticCached
+			|| memcmp(&shadowCascade.mCachedProjection, &shadowCascade.mLightProjection, sizeof(D3DXMATRIX)) != 0;
+		if (isStaticRedrawn)
+		{
+			SetShadowRenderTarget(pStaticSurface, isDepthOnly);
+			gpD3DDevice->SetViewport(&viewport);
+			gpD3DDevice->Clear(0, NULL, clearFlags, 0xFFFFFFFF, 1.0f, 0);
+
+			if (hasStaticCaster)
+			{
+				gpCreateShadowShader->SetTechnique(casterTechnique);
+				gpCreateShadowShader->SetMatrix("gWorldMatrix", pDiscWorld);
+				DrawShadowCaster(pDiscCaster);
+				shadowCascade.mStaticTriangles = gpDisc->GetNumFaces();
+			}
+
+			shadowCascade.mCachedProjection = shadowCascade.mLightProjection;
+			shadowCascade.mIsStaticCached = true;
+		}
+
+		// the dynamic casters' texels of this frame and of the last one
+		// (to erase their old shadow) are all that change
+		RECT dynamicRect;
+		SetRectEmpty(&dynamicRect);
+		if (hasDynamicCaster)
+		{
+			GetShadowMapRect(&shadowCascade, cascade, pTorusMin, pTorusMax, &dynamicRect);
+		}
+
+		RECT dirtyRect = tileRect;
+		if (!isStaticRedrawn)
+		{
+			UnionRect(&dirtyRect, &dynamicRect, &shadowCascade.mDynamicRect);
+		}
+		shadowCascade.mDynamicRect = dynamicRect;
+		shadowCascade.mRedrawnTexels = (dirtyRect.right - dirtyRect.left) * (dirtyRect.bottom - dirtyRect.top);
+
+		if (IsRectEmpty(&dirtyRect))
+		{
+			continue;
+		}
+
+		if (isDepthOnly)
+		{
+			// put the static casters' depth back into the depth buffer.
+			// the depth test then keeps the nearer depth of the dynamic casters
+			SetShadowRenderTarget(pShadowSurface, true);
+			gpD3DDevice->SetViewport(&viewport);
+			RestoreStaticShadow(pStaticCache, &dirtyRect, true);
+
+			if (!IsRectEmpty(&dynamicRect))
+			{
+				gpCreateShadowShader->SetTechnique(casterTechnique);
+				gpCreateShadowShader->SetMatrix("gWorldMatrix", pTorusWorld);
+				DrawShadowCaster(pTorusCaster);
+				shadowCascade.mDynamicTriangles = gpTorus->GetNumFaces();
+			}
+			continue;
+		}
+
+		// put the static casters' depth back, then draw the dynamic
+		// casters over it. their shader keeps the nearer of the two depths.
+		// a 16 bit cache can't be copied into a 32 bit map, so it's drawn
+		if (gShadowStorage == SHADOW_STORAGE_32F_CACHE_16)
+		{
+			SetShadowRenderTarget(pShadowSurface, false);
+			gpD3DDevice->SetViewport(&viewport);
+			RestoreStaticShadow(pStaticCache, &dirtyRect, false);
+		}
+		else
+		{
+			gpD3DDevice->StretchRect(pStaticSurface, &dirtyRect, pShadowSurface, &dirtyRect, D3DTEXF_NONE);
+		}
+
+		if (IsRectEmpty(&dynamicRect))
+		{
+			continue;
+		}
+
+		SetShadowRenderTarget(pShadowSurface, false);
+		gpD3DDevice->SetViewport(&viewport);
+		gpD3DDevice->Clear(1, (const D3DRECT*)&dynamicRect, D3DCLEAR_ZBUFFER, 0, 1.0f, 0);
+
+		gpCreateShadowShader->SetTechnique("CreateDynamicShadowShader");
+		gpCreateShadowShader->SetMatrix("gWorldMatrix", pTorusWorld);
+		gpCreateShadowShader->SetMatrix("gShadowMatrix", &shadowCascade.mShadowMatrix);
+		gpCreateShadowShader->SetTexture("StaticShadowMap_Tex", gpStaticShadowCache);
+		DrawShadowCaster(gpTorus);
+		shadowCascade.mDynamicTriangles = gpTorus->GetNumFaces();
 	}
 
+	EndGPUTimer();
 
-	// loading models
-	gpTorus = LoadModel("torus.x");
-	if (!gpTorus)
+	pShadowSurface->Release();
+	pShadowSurface = NULL;
+	if (pStaticSurface)
 	{
-		return false;
+		pStaticSurface->Release();
+		pStaticSurface = NULL;
 	}
 
-	gpDisc = LoadModel("disc.x");
-	if (!gpDisc)
+	// variance shadow maps need the blurred moments of the depth
+	if (gShadowFilter == SHADOW_FILTER_VSM)
 	{
-		return false;
+		RenderShadowMoments(pShadowMap);
 	}
 
-	return true;
+	return pShadowMap;
 }
 
-// loading shaders
-LPD3DXEFFECT LoadShader(const char * filename)
+// draw the casters into the faces of the cube shadow map they touch.
+// faces without casters are only cleared, and only when a caster has
+// just left them
+void RenderCubeShadowMap(const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld)
 {
-	LPD3DXEFFECT ret = NULL;
+	const int numCasters = 2;
+	LPD3DXMESH casters[numCasters] = { gpTorus, gpDisc };
+	const D3DXMATRIX * casterWorlds[numCasters] = { pTorusWorld, pDiscWorld };
 
-	LPD3DXBUFFER pError = NULL;
-	DWORD dwShaderFlags = 0;
+	D3DXVECTOR3 casterCenters[numCasters];
+	float casterRadii[numCasters];
+	GetWorldBoundingSphere(pTorusWorld, &gTorusBoundingCenter, gTorusBoundingRadius, &casterCenters[0], &casterRadii[0]);
+	GetWorldBoundingSphere(pDiscWorld, &gDiscBoundingCenter, gDiscBoundingRadius, &casterCenters[1], &casterRadii[1]);
 
-#if _DEBUG
-	dwShaderFlags |= D3DXSHADER_DEBUG;
-#endif
+	// look direction and up vector of every face, in D3DCUBEMAP_FACES order
+	static const D3DXVECTOR3 faceDirections[6] =
+	{
+		D3DXVECTOR3(1, 0, 0), D3DXVECTOR3(-1, 0, 0), D3DXVECTOR3(0, 1, 0),
+		D3DXVECTOR3(0, -1, 0), D3DXVECTOR3(0, 0, 1), D3DXVECTOR3(0, 0, -1)
+	};
+	static const D3DXVECTOR3 faceUps[6] =
+	{
+		D3DXVECTOR3(0, 1, 0), D3DXVECTOR3(0, 1, 0), D3DXVECTOR3(0, 0, -1),
+		D3DXVECTOR3(0, 0, 1), D3DXVECTOR3(0, 1, 0), D3DXVECTOR3(0, 1, 0)
+	};
 
-	D3DXCreateEffectFromFile(gpD3DDevice, filename,
-		NULL, NULL, dwShaderFlags, NULL, &ret, &pError);
+	D3DXVECTOR3 lightPosition(gWorldLightPosition.x, gWorldLightPosition.y, gWorldLightPosition.z);
 
-	// if failed at loading shaders, display compile error
-	// to output window
-	if (!ret && pError)
+	// every face sees 90 degrees
+	D3DXMATRIXA16 matProjection;
+	D3DXMatrixPerspectiveFovLH(&matProjection, PI / 2.0f, 1.0f, NEAR_PLANE, POINT_LIGHT_RANGE);
+
+	gpD3DDevice->SetDepthStencilSurface(gpCubeShadowDepthStencil);
+
+	gpCreateShadowShader->SetTechnique("CreateCubeShadow");
+	gpCreateShadowShader->SetMatrix("gLightProjectionMatrix", &matProjection);
+	gpCreateShadowShader->SetVector("gWorldLightPosition", &gWorldLightPosition);
+	gpCreateShadowShader->SetFloat("gLightRange", POINT_LIGHT_RANGE);
+
+	BeginGPUTimer(SHADOW_PASS_CUBE);
+	for (int face = 0; face < 6; ++face)
 	{
-		int size = pError->GetBufferSize();
-		void *ack = pError->GetBufferPointer();
+		gCubeFaceTriangles[face] = 0;
+
+		D3DXVECTOR3 lookAt = lightPosition + faceDirections[face];
+		D3DXMATRIXA16 matView;
+		D3DXMatrixLookAtLH(&matView, &lightPosition, &lookAt, &faceUps[face]);
+
+		D3DXMATRIXA16 matViewProjection;
+		D3DXMatrixMultiply(&matViewProjection, &matView, &matProjection);
+
+		bool isCasterInFace[numCasters];
+		bool hasCaster = false;
+		for (int i = 0; i < numCasters; ++i)
+		{
+			isCasterInFace[i] = IsSphereInFrustum(&matViewProjection, &casterCenters[i], casterRadii[i]);
+			hasCaster = hasCaster || isCasterInFace[i];
+		}
+
+		if (hasCaster || !gIsCubeFaceEmpty[face])
+		{
+			LPDIRECT3DSURFACE9 pFaceSurface = NULL;
+			if (SUCCEEDED(gpCubeShadowMap->GetCubeMapSurface((D3DCUBEMAP_FACES)face, 0, &pFaceSurface)))
+			{
+				gpD3DDevice->SetRenderTarget(0, pFaceSurface);
+				pFaceSurface->Release();
+				pFaceSurface = NULL;
+			}
+
+			gpD3DDevice->Clear(0, NULL, (D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER), 0xFFFFFFFF, 1.0f, 0);
+
+			gpCreateShadowShader->SetMatrix("gLightViewMatrix", &matView);
+			for (int i = 0; i < numCasters; ++i)
+			{
+				if (isCasterInFace[i])
+				{
+					gpCreateShadowShader->SetMatrix("gWorldMatrix", casterWorlds[i]);
+					DrawShadowCaster(casters[i]);
+					gCubeFaceTriangles[face] += casters[i]->GetNumFaces();
+				}
+			}
+		}
+		gIsCubeFaceEmpty[face] = !hasCaster;
+
+		// the timestamp between two faces ends the one and begins the other
+		if (face < 5)
+		{
+			MarkGPUTimer();
+		}
+	}
+	EndGPUTimer();
+}
+
+// whether a world space sphere touches the frustum of a view-projection
+// matrix. (the planes come straight from the matrix' columns)
+bool IsSphereInFrustum(const D3DXMATRIX * pViewProjection, const D3DXVECTOR3 * pCenter, float radius)
+{
+	const D3DXMATRIX & m = *pViewProjection;
+	D3DXPLANE planes[6] =
+	{
+		D3DXPLANE(m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41),	// left
+		D3DXPLANE(m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41),	// right
+		D3DXPLANE(m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42),	// bottom
+		D3DXPLANE(m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42),	// top
+		D3DXPLANE(m._13, m._23, m._33, m._43),									// near
+		D3DXPLANE(m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43)	// far
+	};
+
+	for (int i = 0; i < 6; ++i)
+	{
+		D3DXPlaneNormalize(&planes[i], &planes[i]);
+		if (D3DXPlaneDotCoord(&planes[i], pCenter) < -radius)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// add an object to the draws of this frame. the last one is drawn one
+// by one when there's no batched technique
+void QueueDraw(LPD3DXEFFECT pEffect, D3DXHANDLE technique, D3DXHANDLE batchedTechnique,
+	LPD3DXMESH pMesh, const D3DXMATRIX * pWorld, const D3DXVECTOR4 * pColor)
+{
+	if (gNumDrawItems == MAX_DRAW_ITEMS)
+	{
+		return;
+	}
+
+	DrawItem & item = gpDrawItems[gNumDrawItems++];
+	item.mEffect = pEffect;
+	item.mTechnique = technique;
+	item.mBatchedTechnique = batchedTechnique;
+	item.mMesh = pMesh;
+	item.mWorld = *pWorld;
+	item.mColor = *pColor;
+}
+
+// draw the queued objects, with one Begin/End per effect and technique.
+// batched, the objects' constants are set DRAW_BATCH_SIZE at a time and
+// drawn as instances. one by one, every object costs a commit and a draw
+void FlushDraws()
+{
+	qsort(gpDrawItems, gNumDrawItems, sizeof(DrawItem), CompareDrawItems);
+
+	int first = 0;
+	while (first < gNumDrawItems)
+	{
+		const DrawItem & firstItem = gpDrawItems[first];
+		int last = first + 1;
+		while (last < gNumDrawItems && gpDrawItems[last].mEffect == firstItem.mEffect
+			&& gpDrawItems[last].mTechnique == firstItem.mTechnique
+			&& gpDrawItems[last].mBatchedTechnique == firstItem.mBatchedTechnique)
+		{
+			++last;
+		}
+
+		bool isBatched = gBatchDraws && firstItem.mBatchedTechnique;
+		LPD3DXEFFECT pEffect = firstItem.mEffect;
+		pEffect->SetTechnique(isBatched ? firstItem.mBatchedTechnique : firstItem.mTechnique);
+
+		DrawParameters parameters;
+		parameters.mWorld = pEffect->GetParameterByName(NULL, "gWorldMatrix");
+		parameters.mColor = pEffect->GetParameterByName(NULL, "gObjectColor");
+		parameters.mInstanceWorlds = pEffect->GetParameterByName(NULL, "gInstanceWorlds");
+		parameters.mInstanceColors = pEffect->GetParameterByName(NULL, "gInstanceColors");
+
+		UINT numPasses = 0;
+		pEffect->Begin(&numPasses, NULL);
+		{
+			for (UINT i = 0; i < numPasses; ++i)
+			{
+				pEffect->BeginPass(i);
+				{
+					if (isBatched)
+					{
+						DrawBatched(&gpDrawItems[first], last - first, &parameters);
+					}
+					else
+					{
+						DrawEach(&gpDrawItems[first], last - first, &parameters);
+					}
+				}
+				pEffect->EndPass();
+			}
+		}
+		pEffect->End();
+
+		first = last;
+	}
+
+	gNumDrawItems = 0;
+}
+
+// order of draws: by effect, technique, then mesh
+int CompareDrawItems(const void * pLeft, const void * pRight)
+{
+	const DrawItem * left = (const DrawItem *)pLeft;
+	const DrawItem * right = (const DrawItem *)pRight;
+
+	UINT_PTR leftKeys[4] = { (UINT_PTR)left->mEffect, (UINT_PTR)left->mTechnique,
+		(UINT_PTR)left->mBatchedTechnique, (UINT_PTR)left->mMesh };
+	UINT_PTR rightKeys[4] = { (UINT_PTR)right->mEffect, (UINT_PTR)right->mTechnique,
+		(UINT_PTR)right->mBatchedTechnique, (UINT_PTR)right->mMesh };
+	for (int i = 0; i < 4; ++i)
+	{
+		if (leftKeys[i] != rightKeys[i])
+		{
+			return (leftKeys[i] < rightKeys[i]) ? -1 : 1;
+		}
+	}
+
+	return 0;
+}
+
+// objects of one technique, each with its own constants and draw
+void DrawEach(const DrawItem * pItems, int numItems, const DrawParameters * pParameters)
+{
+	for (int i = 0; i < numItems; ++i)
+	{
+		LPD3DXEFFECT pEffect = pItems[i].mEffect;
+		if (pParameters->mWorld)
+		{
+			pEffect->SetMatrix(pParameters->mWorld, &pItems[i].mWorld);
+		}
+		if (pParameters->mColor)
+		{
+			pEffect->SetVector(pParameters->mColor, &pItems[i].mColor);
+		}
+		pEffect->CommitChanges();
+		pItems[i].mMesh->DrawSubset(0);
+	}
+}
+
+// objects of one technique, sorted by mesh: their constants packed into
+// arrays, and one instanced draw per DRAW_BATCH_SIZE of them
+void DrawBatched(const DrawItem * pItems, int numItems, const DrawParameters * pParameters)
+{
+	LPD3DXEFFECT pEffect = pItems[0].mEffect;
+	D3DXMATRIX worlds[DRAW_BATCH_SIZE];
+	D3DXVECTOR4 colors[DRAW_BATCH_SIZE];
+
+	int first = 0;
+	while (first < numItems)
+	{
+		LPD3DXMESH pMesh = pItems[first].mMesh;
+		int count = 0;
+		while (first + count < numItems && count < DRAW_BATCH_SIZE && pItems[first + count].mMesh == pMesh)
+		{
+			worlds[count] = pItems[first + count].mWorld;
+			colors[count] = pItems[first + count].mColor;
+			++count;
+		}
+
+		if (pMesh->GetFVF() != gInstanceFVF)
+		{
+			DrawEach(&pItems[first], count, pParameters);
+			first += count;
+			continue;
+		}
+
+		if (pParameters->mInstanceWorlds)
+		{
+			pEffect->SetMatrixArray(pParameters->mInstanceWorlds, worlds, count);
+		}
+		if (pParameters->mInstanceColors)
+		{
+			pEffect->SetVectorArray(pParameters->mInstanceColors, colors, count);
+		}
+		pEffect->CommitChanges();
+		DrawInstances(pMesh, count);
+
+		first += count;
+	}
+}
+
+// draw the first instances of a mesh. every instance reads its index
+// from stream 1
+void DrawInstances(LPD3DXMESH pMesh, int numInstances)
+{
+	LPDIRECT3DVERTEXBUFFER9 pVertexBuffer = NULL;
+	LPDIRECT3DINDEXBUFFER9 pIndexBuffer = NULL;
+	if (FAILED(pMesh->GetVertexBuffer(&pVertexBuffer)))
+	{
+		return;
+	}
+
+	if (FAILED(pMesh->GetIndexBuffer(&pIndexBuffer)))
+	{
+		pVertexBuffer->Release();
+		return;
+	}
+
+	gpD3DDevice->SetVertexDeclaration(gpInstanceDeclaration);
+	gpD3DDevice->SetStreamSource(0, pVertexBuffer, 0, pMesh->GetNumBytesPerVertex());
+	gpD3DDevice->SetStreamSourceFreq(0, D3DSTREAMSOURCE_INDEXEDDATA | numInstances);
+	gpD3DDevice->SetStreamSource(1, gpInstanceIndexBuffer, 0, sizeof(float));
+	gpD3DDevice->SetStreamSourceFreq(1, D3DSTREAMSOURCE_INSTANCEDATA | 1);
+	gpD3DDevice->SetIndices(pIndexBuffer);
+
+	gpD3DDevice->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, pMesh->GetNumVertices(), 0, pMesh->GetNumFaces());
+
+	gpD3DDevice->SetStreamSourceFreq(0, 1);
+	gpD3DDevice->SetStreamSourceFreq(1, 1);
+	gpD3DDevice->SetStreamSource(1, NULL, 0, 0);
+
+	pVertexBuffer->Release();
+	pVertexBuffer = NULL;
+	pIndexBuffer->Release();
+	pIndexBuffer = NULL;
+}
+
+// place the crowd on a square grid over the disc, with every torus
+// scaled to fit its cell
+void BuildCrowd(int numObjects)
+{
+	int side = (int)ceilf(sqrtf((float)numObjects));
+	if (side == 0)
+	{
+		return;
+	}
+
+	float spacing = CROWD_AREA / side;
+	float scale = 0.4f * spacing / gTorusBoundingRadius;
+	float height = -40.0f + 2.0f * gDiscBoundingMax.y + scale * gTorusBoundingRadius;
+
+	for (int i = 0; i < numObjects; ++i)
+	{
+		float x = -CROWD_AREA / 2 + (i % side + 0.5f) * spacing;
+		float z = -CROWD_AREA / 2 + (i / side + 0.5f) * spacing;
+
+		D3DXMATRIXA16 matScale;
+		D3DXMatrixScaling(&matScale, scale, scale, scale);
+		D3DXMATRIXA16 matTrans;
+		D3DXMatrixTranslation(&matTrans, x, height, z);
+		D3DXMatrixMultiply(&gpCrowdWorlds[i], &matScale, &matTrans);
+
+		gpCrowdColors[i] = D3DXVECTOR4(0.5f + 0.5f * sinf(i * 0.7f), 0.5f + 0.5f * sinf(i * 1.3f),
+			0.5f + 0.5f * sinf(i * 2.1f), 1.0f);
+	}
+}
+
+// queue the torus, the disc and the crowd
+void QueueScene(LPD3DXEFFECT pEffect, D3DXHANDLE technique, D3DXHANDLE batchedTechnique,
+	const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld)
+{
+	QueueDraw(pEffect, technique, batchedTechnique, gpTorus, pTorusWorld, &gTorusColor);
+	QueueDraw(pEffect, technique, batchedTechnique, gpDisc, pDiscWorld, &gDiscColor);
+	for (int i = 0; i < gCrowdSizes[gCrowdSize]; ++i)
+	{
+		QueueDraw(pEffect, technique, batchedTechnique, gpTorus, &gpCrowdWorlds[i], &gpCrowdColors[i]);
+	}
+}
+
+// move the spot lights around their ring, and size their atlas regions
+// by how large their cones are on screen
+void UpdateSpotLights(const D3DXMATRIX * pView, const D3DXMATRIX * pViewProjection)
+{
+	static const D3DXVECTOR4 colors[6] =
+	{
+		D3DXVECTOR4(1, 0.3f, 0.3f, 1), D3DXVECTOR4(0.3f, 1, 0.3f, 1), D3DXVECTOR4(0.3f, 0.3f, 1, 1),
+		D3DXVECTOR4(1, 1, 0.3f, 1), D3DXVECTOR4(0.3f, 1, 1, 1), D3DXVECTOR4(1, 0.3f, 1, 1)
+	};
+
+	gSpotRotation += 0.2f * PI / 180.0f;
+	if (gSpotRotation > 2 * PI)
+	{
+		gSpotRotation -= 2 * PI;
+	}
+
+	// sphere around a cone: through its apex and the rim of its base.
+	// (for cones up to 90 degrees, where the center is inside the cone)
+	float tanHalfAngle = tanf(SPOT_LIGHT_FOV / 2.0f);
+	float coneRadius = SPOT_LIGHT_RANGE * (1.0f + tanHalfAngle * tanHalfAngle) / 2.0f;
+
+	D3DXMATRIXA16 matProjection;
+	D3DXMatrixPerspectiveFovLH(&matProjection, SPOT_LIGHT_FOV, 1.0f, NEAR_PLANE, SPOT_LIGHT_RANGE);
+
+	for (int i = 0; i < gNumSpotLights; ++i)
+	{
+		SpotLight & light = gSpotLights[i];
+
+		// every light points down at the disc, a bit inside of the ring
+		float angle = gSpotRotation + 2 * PI * i / gNumSpotLights;
+		light.mPosition = D3DXVECTOR3(cosf(angle) * SPOT_RING_RADIUS, SPOT_RING_HEIGHT, sinf(angle) * SPOT_RING_RADIUS);
+		D3DXVECTOR3 target(light.mPosition.x * 0.25f, -40.0f, light.mPosition.z * 0.25f);
+		D3DXVECTOR3 up(0.0f, 1.0f, 0.0f);
+		D3DXMatrixLookAtLH(&light.mView, &light.mPosition, &target, &up);
+		light.mProjection = matProjection;
+		light.mColor = colors[i % 6];
+
+		// diameter of the cone on screen, in pixels. a cone the camera is
+		// in gets the largest region
+		D3DXVECTOR3 direction = target - light.mPosition;
+		D3DXVec3Normalize(&direction, &direction);
+		D3DXVECTOR3 coneCenter = light.mPosition + direction * coneRadius;
+
+		light.mRegionSize = 0;
+		if (!IsSphereInFrustum(pViewProjection, &coneCenter, coneRadius))
+		{
+			continue;
+		}
+
+		D3DXVECTOR3 viewCenter;
+		D3DXVec3TransformCoord(&viewCenter, &coneCenter, pView);
+		float pixels = (float)ATLAS_MAX_REGION;
+		if (viewCenter.z > coneRadius)
+		{
+			pixels = coneRadius * WIN_HEIGHT / (viewCenter.z * tanf(FOV / 2.0f));
+		}
+
+		// the next power of two up, so regions are quadtree nodes
+		light.mRegionSize = ATLAS_MIN_REGION;
+		while (light.mRegionSize < ATLAS_MAX_REGION && light.mRegionSize < pixels)
+		{
+			light.mRegionSize *= 2;
+		}
+	}
+}
+
+// hand out atlas regions, largest wish first. when the wishes add up to
+// more than the atlas, they are all halved until they fit, so every light
+// loses some resolution instead of some lights losing their shadow.
+// power of two squares that fit by area always fit in the quadtree when
+// placed largest first. a light that still doesn't fit gets the largest
+// free region below its wish, and is lit without a shadow without one
+void AllocateShadowAtlas()
+{
+	memset(gAtlasNodes, ATLAS_NODE_FREE, sizeof(gAtlasNodes));
+
+	for (;;)
+	{
+		DWORD wantedTexels = 0;
+		bool canShrink = false;
+		for (int i = 0; i < gNumSpotLights; ++i)
+		{
+			int regionSize = gSpotLights[i].mRegionSize;
+			wantedTexels += regionSize * regionSize;
+			canShrink = canShrink || regionSize > ATLAS_MIN_REGION;
+		}
+
+		if (wantedTexels <= ATLAS_SIZE * ATLAS_SIZE || !canShrink)
+		{
+			break;
+		}
+
+		for (int i = 0; i < gNumSpotLights; ++i)
+		{
+			SpotLight & light = gSpotLights[i];
+			if (light.mRegionSize > ATLAS_MIN_REGION)
+			{
+				light.mRegionSize /= 2;
+			}
+		}
+	}
+
+	int order[MAX_SPOT_LIGHTS];
+	for (int i = 0; i < gNumSpotLights; ++i)
+	{
+		int j = i;
+		for (; j > 0 && gSpotLights[order[j - 1]].mRegionSize < gSpotLights[i].mRegionSize; --j)
+		{
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+	}
+
+	for (int i = 0; i < gNumSpotLights; ++i)
+	{
+		SpotLight & light = gSpotLights[order[i]];
+		SetRectEmpty(&light.mAtlasRect);
+		if (light.mRegionSize == 0)
+		{
+			continue;
+		}
+
+		int level = 0;
+		while ((ATLAS_SIZE >> level) > light.mRegionSize)
+		{
+			++level;
+		}
+
+		for (; level < ATLAS_LEVELS; ++level)
+		{
+			if (AllocateAtlasNode(0, 0, 0, 0, level, &light.mAtlasRect))
+			{
+				break;
+			}
+		}
+	}
+}
+
+// find a free node on a level of the quadtree below a node, and mark the
+// nodes on the way down as split. children of node n are 4n+1 to 4n+4
+bool AllocateAtlasNode(int node, int level, int x, int y, int wantedLevel, RECT * pRect)
+{
+	BYTE & state = gAtlasNodes[node];
+	if (state == ATLAS_NODE_USED)
+	{
+		return false;
+	}
+
+	int size = ATLAS_SIZE >> level;
+	if (level == wantedLevel)
+	{
+		if (state != ATLAS_NODE_FREE)
+		{
+			return false;
+		}
+
+		state = ATLAS_NODE_USED;
+		SetRect(pRect, x, y, x + size, y + size);
+		return true;
+	}
+
+	int half = size / 2;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (AllocateAtlasNode(4 * node + 1 + i, level + 1, x + (i % 2) * half, y + (i / 2) * half, wantedLevel, pRect))
+		{
+			state = ATLAS_NODE_SPLIT;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// draw every spot light's casters into its atlas region, as distance to
+// the light like the cube map
+void RenderShadowAtlas(const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld)
+{
+	const int numCasters = 2;
+	LPD3DXMESH casters[numCasters] = { gpTorus, gpDisc };
+	const D3DXMATRIX * casterWorlds[numCasters] = { pTorusWorld, pDiscWorld };
+
+	D3DXVECTOR3 casterCenters[numCasters];
+	float casterRadii[numCasters];
+	GetWorldBoundingSphere(pTorusWorld, &gTorusBoundingCenter, gTorusBoundingRadius, &casterCenters[0], &casterRadii[0]);
+	GetWorldBoundingSphere(pDiscWorld, &gDiscBoundingCenter, gDiscBoundingRadius, &casterCenters[1], &casterRadii[1]);
+
+	LPDIRECT3DSURFACE9 pAtlasSurface = NULL;
+	gpShadowRenderTarget->GetSurfaceLevel(0, &pAtlasSurface);
+	SetShadowRenderTarget(pAtlasSurface, false);
+	pAtlasSurface->Release();
+	pAtlasSurface = NULL;
+
+	gpCreateShadowShader->SetTechnique("CreateCubeShadow");
+	gpCreateShadowShader->SetFloat("gLightRange", SPOT_LIGHT_RANGE);
+
+	for (int i = 0; i < gNumSpotLights; ++i)
+	{
+		SpotLight & light = gSpotLights[i];
+		light.mTriangles = 0;
+		if (IsRectEmpty(&light.mAtlasRect))
+		{
+			continue;
+		}
+
+		int regionSize = light.mAtlasRect.right - light.mAtlasRect.left;
+		D3DVIEWPORT9 viewport = { light.mAtlasRect.left, light.mAtlasRect.top, regionSize, regionSize, 0.0f, 1.0f };
+		gpD3DDevice->SetViewport(&viewport);
+		gpD3DDevice->Clear(0, NULL, (D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER), 0xFFFFFFFF, 1.0f, 0);
+
+		D3DXMATRIXA16 matViewProjection;
+		D3DXMatrixMultiply(&matViewProjection, &light.mView, &light.mProjection);
+		GetSpotShadowMatrix(&light, &light.mAtlasRect, &light.mShadowMatrix);
+
+		D3DXVECTOR4 lightPosition(light.mPosition.x, light.mPosition.y, light.mPosition.z, 1.0f);
+		gpCreateShadowShader->SetMatrix("gLightViewMatrix", &light.mView);
+		gpCreateShadowShader->SetMatrix("gLightProjectionMatrix", &light.mProjection);
+		gpCreateShadowShader->SetVector("gWorldLightPosition", &lightPosition);
+
+		for (int j = 0; j < numCasters; ++j)
+		{
+			if (IsSphereInFrustum(&matViewProjection, &casterCenters[j], casterRadii[j]))
+			{
+				gpCreateShadowShader->SetMatrix("gWorldMatrix", casterWorlds[j]);
+				DrawShadowCaster(casters[j]);
+				light.mTriangles += casters[j]->GetNumFaces();
+			}
+		}
+	}
+}
+
+// clip space of a spot light to its region of the atlas, moved by half a
+// texel to hit texel centers. the shader divides by w afterwards
+void GetSpotShadowMatrix(const SpotLight * pLight, const RECT * pRect, D3DXMATRIX * pOut)
+{
+	int regionSize = pRect->right - pRect->left;
+	float scale = 0.5f * regionSize / ATLAS_SIZE;
+	D3DXMATRIXA16 matRegion(
+		scale, 0, 0, 0,
+		0, -scale, 0, 0,
+		0, 0, 1, 0,
+		(pRect->left + 0.5f * regionSize + 0.5f) / ATLAS_SIZE,
+		(pRect->top + 0.5f * regionSize + 0.5f) / ATLAS_SIZE, 0, 1);
+
+	D3DXMatrixMultiply(pOut, &pLight->mView, &pLight->mProjection);
+	D3DXMatrixMultiply(pOut, pOut, &matRegion);
+}
+
+// the lights on screen, for the lighting pass. every light is a row of
+// gpSpotLightData. a light without a region of the atlas still lights
+// its cone, without a shadow: it gets the whole atlas as its region,
+// just to find its cone, and a position w of 0
+void SetShadowAtlasConstants()
+{
+	int numLights = 0;
+	D3DLOCKED_RECT lockedRect;
+	if (SUCCEEDED(gpSpotLightData->LockRect(0, &lockedRect, NULL, 0)))
+	{
+		for (int i = 0; i < gNumSpotLights; ++i)
+		{
+			const SpotLight & light = gSpotLights[i];
+			if (light.mRegionSize == 0)
+			{
+				continue;
+			}
+
+			bool isShadowed = !IsRectEmpty(&light.mAtlasRect);
+			RECT rect = light.mAtlasRect;
+			D3DXMATRIXA16 matShadow = light.mShadowMatrix;
+			if (!isShadowed)
+			{
+				SetRect(&rect, 0, 0, ATLAS_SIZE, ATLAS_SIZE);
+				GetSpotShadowMatrix(&light, &rect, &matShadow);
+			}
+
+			D3DXVECTOR4 * row = (D3DXVECTOR4*)((BYTE*)lockedRect.pBits + numLights * lockedRect.Pitch);
+			for (int j = 0; j < 4; ++j)
+			{
+				row[j] = D3DXVECTOR4(matShadow.m[j]);
+			}
+			row[4] = D3DXVECTOR4(light.mPosition.x, light.mPosition.y, light.mPosition.z, isShadowed ? 1.0f : 0.0f);
+			row[5] = light.mColor;
+			row[6] = D3DXVECTOR4((float)rect.left, (float)rect.top, (float)rect.right, (float)rect.bottom) / (float)ATLAS_SIZE;
+			++numLights;
+		}
+
+		gpSpotLightData->UnlockRect(0);
+	}
+
+	gpApplyShadowShader->SetTexture("SpotLights_Tex", gpSpotLightData);
+	gpApplyShadowShader->SetInt("gNumSpotLights", numLights);
+	gpApplyShadowShader->SetFloat("gLightRange", SPOT_LIGHT_RANGE);
+	gpApplyShadowShader->SetFloat("gSpotDepthBias", SPOT_SHADOW_BIAS / SPOT_LIGHT_RANGE);
+	gpApplyShadowShader->SetTexture("ShadowMap_Tex", gpShadowRenderTarget);
+	gpApplyShadowShader->SetTechnique("ApplyShadowAtlas");
+}
+
+// display debug info
+void RenderInfo()
+{
+	// text color
+	D3DCOLOR fontColor = D3DCOLOR_ARGB(255, 255, 255, 255);
+
+	// location to display the text
+	RECT rct;
+	rct.left = 5;
+	rct.right = WIN_WIDTH / 3;
+	rct.top = 5;
+	rct.bottom = WIN_HEIGHT * 2 / 3;
+
+	// display debug key info
+	gpFont->DrawText(NULL, "Demo Framework\n\nESC: Exit\nC: Show Cascades\nF: Tight Shadow Fit\nS: Static Shadow Cache\nP: Shadow Filter\nD: Depth-only Shadows\nO: Omni Light\nM: Shadow Storage\nL: Spot Light Atlas\n+/-: Spot Lights\nB: Batch Draws\nN: Crowd Size\nK: Contact Shadows\n[/]: Contact Steps\nR: Measure Contact", -1, &rct, 0, fontColor);
+
+	// display draw submission: objects in the lighting pass, and millions
+	// of them queued and submitted per CPU second for every crowd size
+	char batchText[512];
+	int batchLength = sprintf(batchText, "Objects: %d, %s\nMobj/s: single / batched",
+		gCrowdSizes[gCrowdSize] + 2,
+		!gpInstanceDeclaration ? "no batching" : gBatchDraws ? "batched" : "one by one");
+
+	const char * crowdNames[NUM_CROWD_SIZES] = { "2", "10", "1k", "100k" };
+	for (int i = 1; i < NUM_CROWD_SIZES; ++i)
+	{
+		char rates[2][16];
+		for (int j = 0; j < 2; ++j)
+		{
+			float milliseconds = gSubmitMilliseconds[i][j];
+			if (milliseconds <= 0.0f)
+			{
+				strcpy(rates[j], "?");
+			}
+			else
+			{
+				sprintf(rates[j], "%.2f", (gCrowdSizes[i] + 2) / (milliseconds * 1000.0f));
+			}
+		}
+		batchLength += sprintf(batchText + batchLength, "\n  %s: %s / %s", crowdNames[i], rates[0], rates[1]);
+	}
+
+	// display the contact shadows, and once measured, the steps they
+	// need and the error of every step count in percent
+	char contactSteps[16];
+	sprintf(contactSteps, "%d steps", gContactSteps);
+	batchLength += sprintf(batchText + batchLength, "\nContact: %s",
+		!gIsContactShadowSupported ? "unsupported" : gContactShadows ? contactSteps : "off");
+
+	if (gContactErrors[0] >= 0.0f)
+	{
+		char stepsNeeded[16];
+		sprintf(stepsNeeded, "%d", gContactStepsNeeded);
+		batchLength += sprintf(batchText + batchLength, "\n  within %.0f%% of %dx: %s steps\n  0-2: %.1f %.1f %.1f%%\n  4-32: %.1f %.1f %.1f %.1f%%",
+			CONTACT_ERROR_TARGET * 100.0f, CONTACT_REFERENCE_SCALE, (gContactStepsNeeded < 0) ? "no" : stepsNeeded,
+			gContactErrors[0] * 100.0f, gContactErrors[1] * 100.0f, gContactErrors[2] * 100.0f,
+			gContactErrors[3] * 100.0f, gContactErrors[4] * 100.0f, gContactErrors[5] * 100.0f, gContactErrors[6] * 100.0f);
+	}
+
+	rct.top = WIN_HEIGHT * 2 / 3;
+	rct.bottom = WIN_HEIGHT - 5;
+	gpFont->DrawText(NULL, batchText, -1, &rct, 0, fontColor);
+
+	// display triangle statistics
+	const TriangleStats & stats = gTriangleStats;
+	DWORD culled = stats.mOffScreen + stats.mBackFacing + stats.mZeroArea + stats.mNoSample;
+
+	char text[1024];
+	int length = sprintf(text, "Triangles: %u\nDrawn: %u\nCulled: %u\n"
+		"  off screen: %u\n  back facing: %u\n  zero area: %u\n  no sample: %u\n"
+		"Clipped: %u",
+		stats.mSubmitted, stats.mSubmitted - culled, culled,
+		stats.mOffScreen, stats.mBackFacing, stats.mZeroArea, stats.mNoSample,
+		stats.mGuardBandClipped);
+
+	const char * lightNames[3] = { "directional", "point (cube map)", "spots (atlas)" };
+	length += sprintf(text + length, "\nLight: %s\nShadow fit: %s\nShadow filter: %s",
+		lightNames[gLightMode], gTightShadowFit ? "tight" : "stable",
+		(gLightMode == LIGHT_MODE_DIRECTIONAL) ? gShadowFilterNames[gShadowFilter] : "hard");
+
+	if (gLightMode == LIGHT_MODE_SPOTS)
+	{
+		// display the atlas: lights with a region, regions of every size,
+		// the part of the atlas they cover, and the cost of it all
+		DWORD regionCounts[ATLAS_LEVELS] = { 0 };
+		DWORD visibleLights = 0;
+		DWORD shadowedLights = 0;
+		DWORD usedTexels = 0;
+		DWORD shadowTriangles = 0;
+		for (int i = 0; i < gNumSpotLights; ++i)
+		{
+			const SpotLight & light = gSpotLights[i];
+			if (light.mRegionSize > 0)
+			{
+				++visibleLights;
+			}
+
+			if (IsRectEmpty(&light.mAtlasRect))
+			{
+				continue;
+			}
+
+			DWORD regionSize = light.mAtlasRect.right - light.mAtlasRect.left;
+			int level = 0;
+			while ((DWORD)(ATLAS_SIZE >> level) > regionSize)
+			{
+				++level;
+			}
+
+			++regionCounts[level];
+			++shadowedLights;
+			usedTexels += regionSize * regionSize;
+			shadowTriangles += light.mTriangles;
+		}
+
+		char milliseconds[3][16];
+		FormatMilliseconds(gAtlasMilliseconds[0], milliseconds[0]);
+		FormatMilliseconds(gAtlasMilliseconds[1], milliseconds[1]);
+		FormatMilliseconds((gAtlasMilliseconds[0] < 0.0f || shadowedLights == 0) ? -1.0f
+			: (gAtlasMilliseconds[0] + gAtlasMilliseconds[1]) / shadowedLights, milliseconds[2]);
+
+		length += sprintf(text + length, "\nSpot lights: %d, %u on screen, %u shadowed\nAtlas: %u%% used\n"
+			"  1024: %u  512: %u\n  256: %u  128: %u\nShadow pass: %u tris, %s ms\nLighting: %s ms\n"
+			"Per light: %s ms",
+			gNumSpotLights, visibleLights, shadowedLights, (DWORD)(usedTexels * 100.0 / (ATLAS_SIZE * ATLAS_SIZE) + 0.5),
+			regionCounts[1], regionCounts[2], regionCounts[3], regionCounts[4],
+			shadowTriangles, milliseconds[0], milliseconds[1], milliseconds[2]);
+	}
+	else if (gLightMode == LIGHT_MODE_POINT)
+	{
+		// display the cube faces: triangles drawn into them and GPU time
+		const char * faceNames[6] = { "+X", "-X", "+Y", "-Y", "+Z", "-Z" };
+		for (int i = 0; i < 6; ++i)
+		{
+			char milliseconds[16];
+			FormatMilliseconds(gCubeFaceMilliseconds[i], milliseconds);
+			length += sprintf(text + length, "\nFace %s: %u tris, %s ms",
+				faceNames[i], gCubeFaceTriangles[i], milliseconds);
+		}
+	}
+	else
+	{
+		// cost of the shadow pass in this frame
+		DWORD shadowTriangles = 0;
+		DWORD shadowTexels = 0;
+		for (int i = 0; i < NUM_CASCADES; ++i)
+		{
+			shadowTriangles += gCascades[i].mStaticTriangles + gCascades[i].mDynamicTriangles;
+			shadowTexels += gCascades[i].mRedrawnTexels;
+		}
+
+		bool canCache = (gUseDepthOnlyShadows ? gpStaticShadowDepthCache : gpStaticShadowCache) != NULL;
+		length += sprintf(text + length, "\nStatic cache: %s\nShadow pass: %u tris, %u%% texels",
+			!canCache ? "unsupported" : gCacheStaticShadows ? "on" : "off",
+			shadowTriangles, (DWORD)(shadowTexels * 100.0 / (SHADOW_MAP_SIZE * SHADOW_MAP_SIZE) + 0.5));
+
+		// memory (shadow map + static cache) and GPU time of both shadow
+		// paths. the color path needs a target and a depth buffer in its
+		// storage, the depth-only one a single INTZ texture
+		const DWORD shadowMapMB = SHADOW_MAP_SIZE * SHADOW_MAP_SIZE / (1024 * 1024);
+		char milliseconds[2][16];
+		FormatMilliseconds(gShadowPassMilliseconds[SHADOW_PASS_COLOR], milliseconds[0]);
+		FormatMilliseconds(gShadowPassMilliseconds[SHADOW_PASS_DEPTH_ONLY], milliseconds[1]);
+
+		length += sprintf(text + length, "\nShadow path: %s\n  color %u+%u MB, %s ms\n  depth %u+%u MB, %s ms",
+			!gpShadowDepthMap ? "color (no INTZ)" : gUseDepthOnlyShadows ? "depth only" : "color",
+			shadowMapMB * gShadowStorageBytes[gShadowStorage][0], shadowMapMB * gShadowStorageBytes[gShadowStorage][1],
+			milliseconds[0], shadowMapMB * 4, shadowMapMB * 4, milliseconds[1]);
+
+		// world distance between two depths the shadow map can tell apart,
+		// in the nearest and the farthest cascade. acne starts where the
+		// bias doesn't cover it
+		float depthSteps = GetShadowDepthSteps();
+		length += sprintf(text + length, "\nShadow storage: %s\n  depth step %.4f-%.4f",
+			gUseDepthOnlyShadows ? "24-bit INTZ" : gShadowStorageNames[gShadowStorage],
+			(gCascades[0].mLightMax.z - gCascades[0].mLightMin.z) / depthSteps,
+			(gCascades[NUM_CASCADES - 1].mLightMax.z - gCascades[NUM_CASCADES - 1].mLightMin.z) / depthSteps);
+
+		// display the cascades: view distances, shadow texels across one
+		// screen pixel at the near and far end, static and dynamic triangles
+		// drawn into them
+		float pixelSizeAtUnitDistance = 2.0f * tanf(FOV / 2.0f) / WIN_HEIGHT;
+		for (int i = 0; i < NUM_CASCADES; ++i)
+		{
+			const ShadowCascade & cascade = gCascades[i];
+			length += sprintf(text + length, "\nCascade %d: %.0f-%.0f\n  %.2f-%.2f tx/px, %u+%u tris",
+				i, cascade.mNear, cascade.mFar,
+				cascade.mNear * pixelSizeAtUnitDistance / cascade.mTexelWorldSize,
+				cascade.mFar * pixelSizeAtUnitDistance / cascade.mTexelWorldSize,
+				cascade.mStaticTriangles, cascade.mDynamicTriangles);
+		}
+	}
+
+	rct.left = WIN_WIDTH * 2 / 3;
+	rct.right = WIN_WIDTH - 5;
+	rct.bottom = WIN_HEIGHT - 5;
+	gpFont->DrawText(NULL, text, -1, &rct, 0, fontColor);
+
+	// the device in use, at the bottom
+	rct.left = WIN_WIDTH / 3;
+	rct.right = WIN_WIDTH * 2 / 3;
+	rct.top = WIN_HEIGHT - 30;
+	rct.bottom = WIN_HEIGHT - 5;
+	gpFont->DrawText(NULL, gDeviceDescription, -1, &rct, 0, fontColor);
+}
+
+// GPU time for display, or ? while it's unknown
+void FormatMilliseconds(float milliseconds, char * text)
+{
+	if (milliseconds < 0.0f)
+	{
+		strcpy(text, "?");
+	}
+	else
+	{
+		sprintf(text, "%.2f", milliseconds);
+	}
+}
+
+// split the view frustum up to SHADOW_DISTANCE with the practical split
+// scheme, then give every part an orthographic light projection.
+//
+// the stable fit covers the bounding sphere of the part, whose size
+// doesn't change when the camera turns, and is moved in whole texels
+// only, so shadow edges don't crawl as the camera moves.
+// the tight fit only covers the receivers inside the part, where a
+// caster can be in front of them, and starts at the nearest caster. it
+// spends every texel and all of the depth range on geometry that can
+// actually show a shadow, but shadow edges shimmer as the box changes
+void ComputeShadowCascades(const D3DXMATRIX * pView, const D3DXMATRIX * pLightView,
+	const D3DXVECTOR3 * pCasterMin, const D3DXVECTOR3 * pCasterMax,
+	const D3DXVECTOR3 * pReceiverMin, const D3DXVECTOR3 * pReceiverMax)
+{
+	D3DXMATRIXA16 matInverseView;
+	D3DXMatrixInverse(&matInverseView, NULL, pView);
+
+	float tanHalfFovY = tanf(FOV / 2.0f);
+	float tanHalfFovX = tanHalfFovY * ASPECT_RATIO;
+
+	// a 16 bit static cache rounds the static casters' depth even when
+	// the shadow map itself is 32 bit
+	float depthSteps = GetShadowDepthSteps();
+	if (!gUseDepthOnlyShadows && gShadowStorage == SHADOW_STORAGE_32F_CACHE_16 && gCacheStaticShadows)
+	{
+		depthSteps = DEPTH_STEPS_16;
+	}
+
+	for (int i = 0; i < NUM_CASCADES; ++i)
+	{
+		ShadowCascade & cascade = gCascades[i];
+
+		// logarithmic splits match the perspective's resolution, uniform
+		// ones keep the near cascades from getting too thin
+		float ratio = (i + 1) / (float)NUM_CASCADES;
+		float logSplit = NEAR_PLANE * powf(SHADOW_DISTANCE / NEAR_PLANE, ratio);
+		float uniformSplit = NEAR_PLANE + (SHADOW_DISTANCE - NEAR_PLANE) * ratio;
+		cascade.mNear = (i == 0) ? NEAR_PLANE : gCascades[i - 1].mFar;
+		cascade.mFar = CASCADE_SPLIT_LAMBDA * logSplit + (1.0f - CASCADE_SPLIT_LAMBDA) * uniformSplit;
+
+		// the part's corners in world space, with their bounding sphere
+		// and their bounding box in light space
+		D3DXVECTOR3 corners[8];
+		D3DXVECTOR3 center(0, 0, 0);
+		D3DXVECTOR3 sliceMin(FLT_MAX, FLT_MAX, FLT_MAX);
+		D3DXVECTOR3 sliceMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			float z = (corner & 4) ? cascade.mFar : cascade.mNear;
+			D3DXVECTOR3 viewCorner((corner & 1) ? z * tanHalfFovX : -z * tanHalfFovX,
+				(corner & 2) ? z * tanHalfFovY : -z * tanHalfFovY, z);
+			D3DXVec3TransformCoord(&corners[corner], &viewCorner, &matInverseView);
+			center += corners[corner] / 8.0f;
+
+			D3DXVECTOR3 lightCorner;
+			D3DXVec3TransformCoord(&lightCorner, &corners[corner], pLightView);
+			D3DXVec3Minimize(&sliceMin, &sliceMin, &lightCorner);
+			D3DXVec3Maximize(&sliceMax, &sliceMax, &lightCorner);
+		}
+
+		bool isFitted = false;
+		if (gTightShadowFit)
+		{
+			// receivers in the slice, and only where a caster can cover them
+			D3DXVECTOR3 fitMin, fitMax;
+			D3DXVec3Maximize(&fitMin, &sliceMin, pReceiverMin);
+			D3DXVec3Minimize(&fitMax, &sliceMax, pReceiverMax);
+			fitMin.x = max(fitMin.x, pCasterMin->x);
+			fitMin.y = max(fitMin.y, pCasterMin->y);
+			fitMax.x = min(fitMax.x, pCasterMax->x);
+			fitMax.y = min(fitMax.y, pCasterMax->y);
+
+			// nothing to shadow leaves the cascade with the stable fit
+			if (fitMin.x < fitMax.x && fitMin.y < fitMax.y && fitMin.z < fitMax.z
+				&& pCasterMin->z < fitMax.z)
+			{
+				cascade.mLightMin = D3DXVECTOR3(fitMin.x, fitMin.y, min(fitMin.z, pCasterMin->z));
+				cascade.mLightMax = fitMax;
+
+				// texels aren't square anymore. keep the larger side
+				cascade.mTexelWorldSize = max(fitMax.x - fitMin.x, fitMax.y - fitMin.y) / CASCADE_SIZE;
+				isFitted = true;
+			}
+		}
+
+		if (!isFitted)
+		{
+			float radius = 0.0f;
+			for (int corner = 0; corner < 8; ++corner)
+			{
+				D3DXVECTOR3 toCorner = corners[corner] - center;
+				radius = max(radius, D3DXVec3Length(&toCorner));
+			}
+			radius = ceilf(radius);
+
+			// snap the center to the texel grid in light space
+			cascade.mTexelWorldSize = 2.0f * radius / CASCADE_SIZE;
+
+			D3DXVECTOR3 lightCenter;
+			D3DXVec3TransformCoord(&lightCenter, &center, pLightView);
+			lightCenter.x = floorf(lightCenter.x / cascade.mTexelWorldSize) * cascade.mTexelWorldSize;
+			lightCenter.y = floorf(lightCenter.y / cascade.mTexelWorldSize) * cascade.mTexelWorldSize;
+
+			// everything between the light and the far side of the sphere
+			// can cast a shadow into it
+			cascade.mLightMin = D3DXVECTOR3(lightCenter.x - radius, lightCenter.y - radius, NEAR_PLANE);
+			cascade.mLightMax = D3DXVECTOR3(lightCenter.x + radius, lightCenter.y + radius, lightCenter.z + radius);
+		}
+
+		D3DXMatrixOrthoOffCenterLH(&cascade.mLightProjection,
+			cascade.mLightMin.x, cascade.mLightMax.x, cascade.mLightMin.y, cascade.mLightMax.y,
+			cascade.mLightMin.z, cascade.mLightMax.z);
+
+		// clip space to the cascade's tile in the atlas, moved by half a
+		// texel to hit texel centers
+		D3DXMATRIXA16 matTile(
+			0.25f, 0, 0, 0,
+			0, -0.25f, 0, 0,
+			0, 0, 1, 0,
+			0.25f + 0.5f * (i % 2) + 0.5f / SHADOW_MAP_SIZE, 0.25f + 0.5f * (i / 2) + 0.5f / SHADOW_MAP_SIZE, 0, 1);
+
+		D3DXMatrixMultiply(&cascade.mShadowMatrix, pLightView, &cascade.mLightProjection);
+		D3DXMatrixMultiply(&cascade.mShadowMatrix, &cascade.mShadowMatrix, &matTile);
+
+		// depth is linear in an orthographic projection, so the bias can
+		// be given in world units. plus a step of the coarsest storage the
+		// depth went through
+		cascade.mDepthBias = SHADOW_BIAS_TEXELS * cascade.mTexelWorldSize / (cascade.mLightMax.z - cascade.mLightMin.z)
+			+ 1.0f / depthSteps;
+	}
+}
+
+// atlas texels a light space box covers in a cascade's tile, with a
+// texel to spare on every side for rasterization rules
+void GetShadowMapRect(const ShadowCascade * pCascade, int cascade, const D3DXVECTOR3 * pMin, const D3DXVECTOR3 * pMax, RECT * pRect)
+{
+	float texelsPerUnitX = CASCADE_SIZE / (pCascade->mLightMax.x - pCascade->mLightMin.x);
+	float texelsPerUnitY = CASCADE_SIZE / (pCascade->mLightMax.y - pCascade->mLightMin.y);
+
+	// y points down in the shadow map
+	LONG left = (LONG)floorf((pMin->x - pCascade->mLightMin.x) * texelsPerUnitX) - 1;
+	LONG right = (LONG)ceilf((pMax->x - pCascade->mLightMin.x) * texelsPerUnitX) + 1;
+	LONG top = (LONG)floorf((pCascade->mLightMax.y - pMax->y) * texelsPerUnitY) - 1;
+	LONG bottom = (LONG)ceilf((pCascade->mLightMax.y - pMin->y) * texelsPerUnitY) + 1;
+
+	left = max(left, 0);
+	top = max(top, 0);
+	right = min(right, CASCADE_SIZE);
+	bottom = min(bottom, CASCADE_SIZE);
+
+	if (left >= right || top >= bottom)
+	{
+		SetRectEmpty(pRect);
+		return;
+	}
+
+	SetRect(pRect, left, top, right, bottom);
+	OffsetRect(pRect, (cascade % 2) * CASCADE_SIZE, (cascade / 2) * CASCADE_SIZE);
+}
+
+// blur the depth moments of every cascade: horizontally from the shadow
+// map into gpMomentBlurTarget, then vertically into gpMomentRenderTarget
+void RenderShadowMoments(LPDIRECT3DTEXTURE9 pShadowMap)
+{
+	// a depth-only shadow map can't be read while it's the depth buffer
+	gpD3DDevice->SetDepthStencilSurface(NULL);
+
+	// pre-transformed quad over the whole atlas. (pixel centers are at
+	// integer coordinates in D3D9)
+	const float size = SHADOW_MAP_SIZE;
+	float quad[4][6] =
+	{
+		{ -0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 0.0f },
+		{ size - 0.5f, -0.5f, 0.0f, 1.0f, 1.0f, 0.0f },
+		{ -0.5f, size - 0.5f, 0.0f, 1.0f, 0.0f, 1.0f },
+		{ size - 0.5f, size - 0.5f, 0.0f, 1.0f, 1.0f, 1.0f },
+	};
+
+	LPDIRECT3DTEXTURE9 renderTargets[2] = { gpMomentBlurTarget, gpMomentRenderTarget };
+
+	gpShadowMomentsShader->SetTexture("ShadowMap_Tex", pShadowMap);
+	gpShadowMomentsShader->SetTexture("MomentBlur_Tex", gpMomentBlurTarget);
+
+	UINT numPasses = 0;
+	gpShadowMomentsShader->Begin(&numPasses, NULL);
+	{
+		for (UINT i = 0; i < numPasses && i < 2; ++i)
+		{
+			LPDIRECT3DSURFACE9 pSurface = NULL;
+			if (SUCCEEDED(renderTargets[i]->GetSurfaceLevel(0, &pSurface)))
+			{
+				gpD3DDevice->SetRenderTarget(0, pSurface);
+				pSurface->Release();
+				pSurface = NULL;
+			}
+
+			gpShadowMomentsShader->BeginPass(i);
+			{
+				gpD3DDevice->SetFVF(D3DFVF_XYZRHW | D3DFVF_TEX1);
+				gpD3DDevice->DrawPrimitiveUP(D3DPT_TRIANGLESTRIP, 2, quad, sizeof(quad[0]));
+			}
+			gpShadowMomentsShader->EndPass();
+		}
+	}
+	gpShadowMomentsShader->End();
+}
+
+// render into a shadow map or static cache of either path. the
+// depth-only path needs a color target too, but its NULL format takes
+// no memory and is never written
+void SetShadowRenderTarget(LPDIRECT3DSURFACE9 pSurface, bool isDepthOnly)
+{
+	if (isDepthOnly)
+	{
+		gpD3DDevice->SetRenderTarget(0, gpNullRenderTarget);
+		gpD3DDevice->SetDepthStencilSurface(pSurface);
+	}
+	else
+	{
+		gpD3DDevice->SetRenderTarget(0, pSurface);
+		gpD3DDevice->SetDepthStencilSurface(gpShadowDepthStencil);
+	}
+}
+
+// copy a static cache into the current depth buffer (depth-only path) or
+// render target (color path), within an atlas rectangle
+void RestoreStaticShadow(LPDIRECT3DTEXTURE9 pStaticCache, const RECT * pRect, bool isDepthOnly)
+{
+	// pre-transformed quad over the rectangle. (pixel centers are at
+	// integer coordinates in D3D9)
+	const float size = SHADOW_MAP_SIZE;
+	float left = (float)pRect->left;
+	float top = (float)pRect->top;
+	float right = (float)pRect->right;
+	float bottom = (float)pRect->bottom;
+	float quad[4][6] =
+	{
+		{ left - 0.5f, top - 0.5f, 0.0f, 1.0f, left / size, top / size },
+		{ right - 0.5f, top - 0.5f, 0.0f, 1.0f, right / size, top / size },
+		{ left - 0.5f, bottom - 0.5f, 0.0f, 1.0f, left / size, bottom / size },
+		{ right - 0.5f, bottom - 0.5f, 0.0f, 1.0f, right / size, bottom / size },
+	};
+
+	gpCreateShadowShader->SetTechnique(isDepthOnly ? "RestoreStaticShadowDepth" : "RestoreStaticShadowColor");
+	gpCreateShadowShader->SetTexture("StaticShadowMap_Tex", pStaticCache);
+
+	UINT numPasses = 0;
+	gpCreateShadowShader->Begin(&numPasses, NULL);
+	{
+		for (UINT i = 0; i < numPasses; ++i)
+		{
+			gpCreateShadowShader->BeginPass(i);
+			{
+				gpD3DDevice->SetFVF(D3DFVF_XYZRHW | D3DFVF_TEX1);
+				gpD3DDevice->DrawPrimitiveUP(D3DPT_TRIANGLESTRIP, 2, quad, sizeof(quad[0]));
+			}
+			gpCreateShadowShader->EndPass();
+		}
+	}
+	gpCreateShadowShader->End();
+}
+
+// switch the light the scene is lit by. the cascades' static caches
+// weren't kept up to date while another light was on, and the atlas is
+// drawn over their shadow map, so they are drawn again from scratch
+void SetLightMode(int lightMode)
+{
+	gLightMode = lightMode;
+	InvalidateStaticShadowCache();
+}
+
+// the static caches have to be drawn again before they're used
+void InvalidateStaticShadowCache()
+{
+	for (int i = 0; i < NUM_CASCADES; ++i)
+	{
+		gCascades[i].mIsStaticCached = false;
+	}
+}
+
+// steps the shadow map stores depth in. 32 bit floats hold at least as
+// many as INTZ does between 0.5 and 1, and more below
+float GetShadowDepthSteps()
+{
+	return (!gUseDepthOnlyShadows && gShadowStorage == SHADOW_STORAGE_16) ? DEPTH_STEPS_16 : DEPTH_STEPS_24;
+}
+
+// draw a mesh with all passes of the shadow creating shader
+void DrawShadowCaster(LPD3DXMESH pMesh)
+{
+	UINT numPasses = 0;
+	gpCreateShadowShader->Begin(&numPasses, NULL);
+	{
+		for (UINT i = 0; i < numPasses; ++i)
+		{
+			gpCreateShadowShader->BeginPass(i);
+			{
+				pMesh->DrawSubset(0);
+			}
+			gpCreateShadowShader->EndPass();
+		}
+	}
+	gpCreateShadowShader->End();
+}
+
+// whether a world space sphere touches the light space box of a cascade
+bool IsSphereInCascade(const ShadowCascade * pCascade, const D3DXMATRIX * pLightView, const D3DXVECTOR3 * pCenter, float radius)
+{
+	D3DXVECTOR3 lightCenter;
+	D3DXVec3TransformCoord(&lightCenter, pCenter, pLightView);
+
+	return lightCenter.x + radius >= pCascade->mLightMin.x && lightCenter.x - radius <= pCascade->mLightMax.x
+		&& lightCenter.y + radius >= pCascade->mLightMin.y && lightCenter.y - radius <= pCascade->mLightMax.y
+		&& lightCenter.z + radius >= pCascade->mLightMin.z && lightCenter.z - radius <= pCascade->mLightMax.z;
+}
+
+// box around a transformed box. the center is transformed as a point,
+// the half extents by the absolute values of the matrix
+void TransformBoundingBox(const D3DXMATRIX * pMatrix, const D3DXVECTOR3 * pMin, const D3DXVECTOR3 * pMax, D3DXVECTOR3 * pOutMin, D3DXVECTOR3 * pOutMax)
+{
+	D3DXVECTOR3 center = (*pMin + *pMax) * 0.5f;
+	D3DXVECTOR3 extent = (*pMax - *pMin) * 0.5f;
+
+	D3DXVECTOR3 newCenter;
+	D3DXVec3TransformCoord(&newCenter, &center, pMatrix);
+
+	D3DXVECTOR3 newExtent;
+	for (int i = 0; i < 3; ++i)
+	{
+		newExtent[i] = fabsf(pMatrix->m[0][i]) * extent.x
+			+ fabsf(pMatrix->m[1][i]) * extent.y
+			+ fabsf(pMatrix->m[2][i]) * extent.z;
+	}
+
+	*pOutMin = newCenter - newExtent;
+	*pOutMax = newCenter + newExtent;
+}
+
+// move an object space bounding sphere into world space
+void GetWorldBoundingSphere(const D3DXMATRIX * pWorld, const D3DXVECTOR3 * pLocalCenter, float localRadius, D3DXVECTOR3 * pCenter, float * pRadius)
+{
+	D3DXVec3TransformCoord(pCenter, pLocalCenter, pWorld);
+
+	// the largest scale of the three axes
+	float scale = 0.0f;
+	for (int i = 0; i < 3; ++i)
+	{
+		D3DXVECTOR3 axis(pWorld->m[i][0], pWorld->m[i][1], pWorld->m[i][2]);
+		scale = max(scale, D3DXVec3Length(&axis));
+	}
+
+	*pRadius = localRadius * scale;
+}
+
+// classify the triangles of a mesh the way triangle setup does with the
+// default D3DCULL_CCW cull mode. (only for statistics. the GPU does the
+// actual culling)
+void CountTriangles(LPD3DXMESH pMesh, const D3DXMATRIX * pWorldViewProjection, TriangleStats * pStats)
+{
+	// find where the position is stored in a vertex
+	D3DVERTEXELEMENT9 decl[MAX_FVF_DECL_SIZE];
+	if (FAILED(pMesh->GetDeclaration(decl)))
+	{
+		return;
+	}
+
+	int positionOffset = -1;
+	for (int i = 0; decl[i].Stream != 0xFF; ++i)
+	{
+		if (decl[i].Usage == D3DDECLUSAGE_POSITION && decl[i].UsageIndex == 0)
+		{
+			positionOffset = decl[i].Offset;
+			break;
+		}
+	}
+
+	if (positionOffset < 0)
+	{
+		return;
+	}
+
+	DWORD numVertices = pMesh->GetNumVertices();
+	DWORD numFaces = pMesh->GetNumFaces();
+	if (numVertices > gNumClipPositions)
+	{
+		return;
+	}
+
+	// transform every vertex into clip space in one go
+	void * vertexData = NULL;
+	if (FAILED(pMesh->LockVertexBuffer(D3DLOCK_READONLY, &vertexData)))
+	{
+		return;
+	}
+
+	D3DXVECTOR4 * clipPositions = gpClipPositions;
+	D3DXVec3TransformArray(clipPositions, sizeof(D3DXVECTOR4),
+		(const D3DXVECTOR3*)((BYTE*)vertexData + positionOffset), pMesh->GetNumBytesPerVertex(),
+		pWorldViewProjection, numVertices);
+	pMesh->UnlockVertexBuffer();
+
+	void * indexData = NULL;
+	if (FAILED(pMesh->LockIndexBuffer(D3DLOCK_READONLY, &indexData)))
+	{
+		return;
+	}
+
+	bool is32BitIndex = (pMesh->GetOptions() & D3DXMESH_32BIT) != 0;
+
+	for (DWORD face = 0; face < numFaces; ++face)
+	{
+		++pStats->mSubmitted;
+
+		const D3DXVECTOR4 * v[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			DWORD index = is32BitIndex ? ((DWORD*)indexData)[face * 3 + i] : ((WORD*)indexData)[face * 3 + i];
+			v[i] = &clipPositions[index];
+		}
+
+		// entirely outside one of the frustum planes
+		if ((v[0]->x < -v[0]->w && v[1]->x < -v[1]->w && v[2]->x < -v[2]->w)
+			|| (v[0]->x > v[0]->w && v[1]->x > v[1]->w && v[2]->x > v[2]->w)
+			|| (v[0]->y < -v[0]->w && v[1]->y < -v[1]->w && v[2]->y < -v[2]->w)
+			|| (v[0]->y > v[0]->w && v[1]->y > v[1]->w && v[2]->y > v[2]->w)
+			|| (v[0]->z < 0 && v[1]->z < 0 && v[2]->z < 0)
+			|| (v[0]->z > v[0]->w && v[1]->z > v[1]->w && v[2]->z > v[2]->w))
+		{
+			++pStats->mOffScreen;
+			continue;
+		}
+
+		// to screen space. (pixel centers are at integer coordinates in D3D9)
+		float x[3];
+		float y[3];
+		bool needsClipping = false;
+		for (int i = 0; i < 3; ++i)
+		{
+			if (v[i]->z < 0)
+			{
+				needsClipping = true;
+				break;
+			}
+
+			x[i] = (v[i]->x / v[i]->w * 0.5f + 0.5f) * WIN_WIDTH;
+			y[i] = (-v[i]->y / v[i]->w * 0.5f + 0.5f) * WIN_HEIGHT;
+
+			if (x[i] < gGuardBandLeft || x[i] > gGuardBandRight
+				|| y[i] < gGuardBandTop || y[i] > gGuardBandBottom)
+			{
+				needsClipping = true;
+			}
+		}
+
+		// crosses the near plane or leaves the guard band
+		if (needsClipping)
+		{
+			++pStats->mGuardBandClipped;
+			continue;
+		}
+
+		// clockwise triangles have positive area since y points down
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+		if (area == 0.0f)
+		{
+			++pStats->mZeroArea;
+			continue;
+		}
+
+		if (area < 0.0f)
+		{
+			++pStats->mBackFacing;
+			continue;
+		}
+
+		// no pixel center inside the bounding box
+		float minX = min(x[0], min(x[1], x[2]));
+		float maxX = max(x[0], max(x[1], x[2]));
+		float minY = min(y[0], min(y[1], y[2]));
+		float maxY = max(y[0], max(y[1], y[2]));
+		if (ceilf(minX) > floorf(maxX) || ceilf(minY) > floorf(maxY))
+		{
+			++pStats->mNoSample;
+		}
+	}
+
+	pMesh->UnlockIndexBuffer();
+}
+
+//------------------------------------------------------------
+// Contact shadows
+//------------------------------------------------------------
+
+// draw the view depth of everything the lighting pass draws into the
+// scene depth target, over the current depth buffer
+void RenderSceneDepth(const D3DXMATRIX * pViewProjection, const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld)
+{
+	LPDIRECT3DSURFACE9 pSurface = NULL;
+	if (SUCCEEDED(gpSceneDepthTarget->GetSurfaceLevel(0, &pSurface)))
+	{
+		gpD3DDevice->SetRenderTarget(0, pSurface);
+		pSurface->Release();
+		pSurface = NULL;
+	}
+
+	// 1 is the far plane
+	gpD3DDevice->Clear(0, NULL, (D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER), 0xFFFFFFFF, 1.0f, 0);
+
+	gpContactShadowShader->SetMatrix("gViewProjectionMatrix", pViewProjection);
+	gpContactShadowShader->SetFloat("gFarDepth", FAR_PLANE);
+
+	D3DXHANDLE technique = gpContactShadowShader->GetTechniqueByName("SceneDepth");
+	D3DXHANDLE batchedTechnique = gpInstanceDeclaration ? gpContactShadowShader->GetTechniqueByName("SceneDepthBatched") : NULL;
+	QueueScene(gpContactShadowShader, technique, batchedTechnique, pTorusWorld, pDiscWorld);
+	FlushDraws();
+}
+
+// march every pixel towards the light over the scene depth, into the
+// contact shadow mask
+void RenderContactShadows(const D3DXMATRIX * pProjection, const D3DXVECTOR3 * pViewLightDirection)
+{
+	LPDIRECT3DSURFACE9 pSurface = NULL;
+	if (SUCCEEDED(gpContactShadowTarget->GetSurfaceLevel(0, &pSurface)))
+	{
+		gpD3DDevice->SetRenderTarget(0, pSurface);
+		pSurface->Release();
+		pSurface = NULL;
+	}
+	gpD3DDevice->SetDepthStencilSurface(NULL);
+
+	// pre-transformed quad over the screen. (pixel centers are at
+	// integer coordinates in D3D9)
+	const float width = WIN_WIDTH;
+	const float height = WIN_HEIGHT;
+	float quad[4][6] =
+	{
+		{ -0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 0.0f },
+		{ width - 0.5f, -0.5f, 0.0f, 1.0f, 1.0f, 0.0f },
+		{ -0.5f, height - 0.5f, 0.0f, 1.0f, 0.0f, 1.0f },
+		{ width - 0.5f, height - 0.5f, 0.0f, 1.0f, 1.0f, 1.0f },
+	};
+
+	D3DXVECTOR4 projectionScale(pProjection->_11, pProjection->_22, 0.0f, 0.0f);
+	D3DXVECTOR4 lightDirection(pViewLightDirection->x, pViewLightDirection->y, pViewLightDirection->z, 0.0f);
+
+	gpContactShadowShader->SetTexture("SceneDepth_Tex", gpSceneDepthTarget);
+	gpContactShadowShader->SetVector("gProjectionScale", &projectionScale);
+	gpContactShadowShader->SetVector("gViewLightDirection", &lightDirection);
+	gpContactShadowShader->SetFloat("gContactDistance", CONTACT_SHADOW_DISTANCE);
+	gpContactShadowShader->SetInt("gContactSteps", gContactSteps);
+	gpContactShadowShader->SetFloat("gContactBias", CONTACT_SHADOW_BIAS);
+	gpContactShadowShader->SetFloat("gContactThickness", CONTACT_SHADOW_THICKNESS);
+	gpContactShadowShader->SetFloat("gFarDepth", FAR_PLANE);
+	gpContactShadowShader->SetTechnique("ContactShadow");
+
+	UINT numPasses = 0;
+	gpContactShadowShader->Begin(&numPasses, NULL);
+	{
+		for (UINT i = 0; i < numPasses; ++i)
+		{
+			gpContactShadowShader->BeginPass(i);
+			{
+				gpD3DDevice->SetFVF(D3DFVF_XYZRHW | D3DFVF_TEX1);
+				gpD3DDevice->DrawPrimitiveUP(D3DPT_TRIANGLESTRIP, 2, quad, sizeof(quad[0]));
+			}
+			gpContactShadowShader->EndPass();
+		}
+	}
+	gpContactShadowShader->End();
+}
+
+// how many contact shadow steps it takes to come close to a shadow map
+// of CONTACT_REFERENCE_SCALE times the resolution. the cascade the torus
+// is in is drawn again at both resolutions, and the pixels within the
+// torus' bounding sphere, where it meets the disc, are shadowed by the
+// shadow map plus the contact shadows of every step count, marched on
+// the CPU. all of them are compared to the reference alone
+void MeasureContactShadows(const D3DXMATRIX * pView, const D3DXMATRIX * pProjection, const D3DXMATRIX * pLightView,
+	const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld, const D3DXVECTOR3 * pViewLightDirection)
+{
+	D3DXVECTOR3 torusCenter;
+	float torusRadius;
+	GetWorldBoundingSphere(pTorusWorld, &gTorusBoundingCenter, gTorusBoundingRadius, &torusCenter, &torusRadius);
+
+	D3DXVECTOR3 viewCenter;
+	D3DXVec3TransformCoord(&viewCenter, &torusCenter, pView);
+	int cascade = 0;
+	while (cascade < NUM_CASCADES && viewCenter.z > gCascades[cascade].mFar)
+	{
+		++cascade;
+	}
+
+	if (cascade == NUM_CASCADES)
+	{
+		return;
+	}
+
+	const ShadowCascade & shadowCascade = gCascades[cascade];
+	const int referenceSize = CASCADE_SIZE * CONTACT_REFERENCE_SCALE;
+
+	LPDIRECT3DSURFACE9 pSceneDepthSurface = NULL;
+	float * pSceneDepth = NULL;
+	if (SUCCEEDED(gpSceneDepthTarget->GetSurfaceLevel(0, &pSceneDepthSurface)))
+	{
+		pSceneDepth = ReadRenderTarget(pSceneDepthSurface, WIN_WIDTH, WIN_HEIGHT);
+		pSceneDepthSurface->Release();
+		pSceneDepthSurface = NULL;
+	}
+
+	float * pShadowMap = RenderMeasuredShadowMap(CASCADE_SIZE, &shadowCascade, pLightView, pTorusWorld, pDiscWorld);
+	float * pReferenceMap = RenderMeasuredShadowMap(referenceSize, &shadowCascade, pLightView, pTorusWorld, pDiscWorld);
+
+	if (pSceneDepth && pShadowMap && pReferenceMap)
+	{
+		for (int i = 0; i < WIN_WIDTH * WIN_HEIGHT; ++i)
+		{
+			pSceneDepth[i] *= FAR_PLANE;
+		}
+
+		// view space to the cascade's light clip space
+		D3DXMATRIXA16 matInverseView;
+		D3DXMatrixInverse(&matInverseView, NULL, pView);
+		D3DXMATRIXA16 matViewToShadow;
+		D3DXMatrixMultiply(&matViewToShadow, &matInverseView, pLightView);
+		D3DXMatrixMultiply(&matViewToShadow, &matViewToShadow, &shadowCascade.mLightProjection);
+
+		// the reference's texels are smaller, and so is its bias
+		float depthBias = shadowCascade.mDepthBias;
+		float referenceBias = depthBias / CONTACT_REFERENCE_SCALE;
+
+		DWORD measuredPixels = 0;
+		DWORD mismatches[NUM_CONTACT_MEASUREMENTS] = { 0 };
+
+		// 4 pixels at a time. (WIN_WIDTH is a multiple of 4)
+		for (int y = 0; y < WIN_HEIGHT; ++y)
+		{
+			for (int x = 0; x < WIN_WIDTH; x += 4)
+			{
+				float viewX[4];
+				float viewY[4];
+				float viewZ[4];
+				bool isMeasured[4];
+				bool isShadowed[4];
+				bool isReferenceShadowed[4];
+				bool hasMeasured = false;
+				for (int i = 0; i < 4; ++i)
+				{
+					// view position back from the depth, like ContactShadow.fx
+					float depth = pSceneDepth[y * WIN_WIDTH + x + i];
+					float ndcX = (x + i + 0.5f) / WIN_WIDTH * 2.0f - 1.0f;
+					float ndcY = 1.0f - (y + 0.5f) / WIN_HEIGHT * 2.0f;
+					D3DXVECTOR3 viewPosition(ndcX / pProjection->_11 * depth, ndcY / pProjection->_22 * depth, depth);
+					viewX[i] = viewPosition.x;
+					viewY[i] = viewPosition.y;
+					viewZ[i] = viewPosition.z;
+
+					D3DXVECTOR3 worldPosition;
+					D3DXVec3TransformCoord(&worldPosition, &viewPosition, &matInverseView);
+					D3DXVECTOR3 toCenter = worldPosition - torusCenter;
+					isMeasured[i] = depth < FAR_PLANE && depth >= shadowCascade.mNear && depth <= shadowCascade.mFar
+						&& D3DXVec3LengthSq(&toCenter) <= torusRadius * torusRadius;
+					if (!isMeasured[i])
+					{
+						continue;
+					}
+
+					D3DXVECTOR3 shadowPosition;
+					D3DXVec3TransformCoord(&shadowPosition, &viewPosition, &matViewToShadow);
+					isShadowed[i] = IsInMeasuredShadow(pShadowMap, CASCADE_SIZE, &shadowPosition, depthBias);
+					isReferenceShadowed[i] = IsInMeasuredShadow(pReferenceMap, referenceSize, &shadowPosition, referenceBias);
+
+					hasMeasured = true;
+					++measuredPixels;
+				}
+
+				if (!hasMeasured)
+				{
+					continue;
+				}
+
+				for (int j = 0; j < NUM_CONTACT_MEASUREMENTS; ++j)
+				{
+					float occluded[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+					if (gContactMeasuredSteps[j] > 0)
+					{
+						MarchContactShadow4(pSceneDepth, viewX, viewY, viewZ, pViewLightDirection, gContactMeasuredSteps[j], pProjection, occluded);
+					}
+
+					for (int i = 0; i < 4; ++i)
+					{
+						if (isMeasured[i] && (isShadowed[i] || occluded[i] > 0.0f) != isReferenceShadowed[i])
+						{
+							++mismatches[j];
+						}
+					}
+				}
+			}
+		}
+
+		// the torus can be off screen
+		if (measuredPixels > 0)
+		{
+			gContactStepsNeeded = -1;
+			for (int j = 0; j < NUM_CONTACT_MEASUREMENTS; ++j)
+			{
+				gContactErrors[j] = (float)mismatches[j] / measuredPixels;
+				if (gContactStepsNeeded < 0 && gContactErrors[j] <= CONTACT_ERROR_TARGET)
+				{
+					gContactStepsNeeded = gContactMeasuredSteps[j];
+				}
+			}
+		}
+	}
+
+	delete[] pSceneDepth;
+	delete[] pShadowMap;
+	delete[] pReferenceMap;
+}
+
+// the contact shadows of 4 pixels at once, marched like ContactShadow.fx
+// from their view positions: 1 where a step landed behind the scene
+void MarchContactShadow4(const float * pSceneDepth, const float * pX, const float * pY, const float * pZ,
+	const D3DXVECTOR3 * pViewLightDirection, int steps, const D3DXMATRIX * pProjection, float * pOccluded)
+{
+	float stepLength = CONTACT_SHADOW_DISTANCE / steps;
+	const __m128 stepX = _mm_set1_ps(pViewLightDirection->x * stepLength);
+	const __m128 stepY = _mm_set1_ps(pViewLightDirection->y * stepLength);
+	const __m128 stepZ = _mm_set1_ps(pViewLightDirection->z * stepLength);
+
+	// view position to pixel, and the pixels the texture addressing clamps to
+	const __m128 scaleX = _mm_set1_ps(pProjection->_11 * 0.5f * WIN_WIDTH);
+	const __m128 scaleY = _mm_set1_ps(-pProjection->_22 * 0.5f * WIN_HEIGHT);
+	const __m128 centerX = _mm_set1_ps(0.5f * WIN_WIDTH);
+	const __m128 centerY = _mm_set1_ps(0.5f * WIN_HEIGHT);
+	const __m128 maxX = _mm_set1_ps(WIN_WIDTH - 1.0f);
+	const __m128 maxY = _mm_set1_ps(WIN_HEIGHT - 1.0f);
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 bias = _mm_set1_ps(CONTACT_SHADOW_BIAS);
+	const __m128 thickness = _mm_set1_ps(CONTACT_SHADOW_THICKNESS);
+
+	__m128 x = _mm_loadu_ps(pX);
+	__m128 y = _mm_loadu_ps(pY);
+	__m128 z = _mm_loadu_ps(pZ);
+	__m128 occluded = zero;
+	for (int i = 0; i < steps; ++i)
+	{
+		x = _mm_add_ps(x, stepX);
+		y = _mm_add_ps(y, stepY);
+		z = _mm_add_ps(z, stepZ);
+
+		// the pixel point sampling picks. the division is exact, like the
+		// GPU's, so both pick the same pixels
+		__m128 inverseZ = _mm_div_ps(one, z);
+		__m128 pixelX = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(x, inverseZ), scaleX), centerX);
+		__m128 pixelY = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(y, inverseZ), scaleY), centerY);
+		pixelX = _mm_min_ps(_mm_max_ps(pixelX, zero), maxX);
+		pixelY = _mm_min_ps(_mm_max_ps(pixelY, zero), maxY);
+
+		// SSE2 can't gather, so the scene depth is read pixel by pixel
+		int columns[4];
+		int rows[4];
+		_mm_storeu_si128((__m128i*)columns, _mm_cvttps_epi32(pixelX));
+		_mm_storeu_si128((__m128i*)rows, _mm_cvttps_epi32(pixelY));
+		__m128 sceneDepth = _mm_setr_ps(pSceneDepth[rows[0] * WIN_WIDTH + columns[0]], pSceneDepth[rows[1] * WIN_WIDTH + columns[1]],
+			pSceneDepth[rows[2] * WIN_WIDTH + columns[2]], pSceneDepth[rows[3] * WIN_WIDTH + columns[3]]);
+
+		__m128 depthDelta = _mm_sub_ps(z, sceneDepth);
+		__m128 isOccluded = _mm_and_ps(_mm_cmpgt_ps(depthDelta, bias), _mm_cmplt_ps(depthDelta, thickness));
+		occluded = _mm_or_ps(occluded, isOccluded);
+	}
+
+	_mm_storeu_ps(pOccluded, _mm_and_ps(occluded, one));
+}
+
+// draw the casters into a shadow map of a cascade's projection at any
+// size, and read it back. NULL if the targets can't be made
+float * RenderMeasuredShadowMap(int size, const ShadowCascade * pCascade, const D3DXMATRIX * pLightView,
+	const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld)
+{
+	LPDIRECT3DSURFACE9 pRenderTarget = NULL;
+	LPDIRECT3DSURFACE9 pDepthStencil = NULL;
+	float * pDepths = NULL;
+	if (SUCCEEDED(gpD3DDevice->CreateRenderTarget(size, size, D3DFMT_R32F, D3DMULTISAMPLE_NONE, 0, FALSE, &pRenderTarget, NULL))
+		&& SUCCEEDED(gpD3DDevice->CreateDepthStencilSurface(size, size, D3DFMT_D24X8, D3DMULTISAMPLE_NONE, 0, TRUE, &pDepthStencil, NULL)))
+	{
+		gpD3DDevice->SetRenderTarget(0, pRenderTarget);
+		gpD3DDevice->SetDepthStencilSurface(pDepthStencil);
+		gpD3DDevice->Clear(0, NULL, (D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER), 0xFFFFFFFF, 1.0f, 0);
+
+		gpCreateShadowShader->SetTechnique("CreateShadowShader");
+		gpCreateShadowShader->SetMatrix("gLightViewMatrix", pLightView);
+		gpCreateShadowShader->SetMatrix("gLightProjectionMatrix", &pCascade->mLightProjection);
+
+		gpCreateShadowShader->SetMatrix("gWorldMatrix", pDiscWorld);
+		DrawShadowCaster(gpDisc);
+		gpCreateShadowShader->SetMatrix("gWorldMatrix", pTorusWorld);
+		DrawShadowCaster(gpTorus);
+
+		pDepths = ReadRenderTarget(pRenderTarget, size, size);
+	}
+
+	if (pRenderTarget)
+	{
+		pRenderTarget->Release();
+		pRenderTarget = NULL;
+	}
+
+	if (pDepthStencil)
+	{
+		pDepthStencil->Release();
+		pDepthStencil = NULL;
+	}
+
+	return pDepths;
+}
+
+// whether a position in light clip space is behind a measured shadow
+// map, sampled at the nearest texel like the cascades' atlas
+bool IsInMeasuredShadow(const float * pShadowMap, int size, const D3DXVECTOR3 * pShadowPosition, float bias)
+{
+	int x = (int)floorf((pShadowPosition->x * 0.5f + 0.5f) * size + 0.5f);
+	int y = (int)floorf((0.5f - pShadowPosition->y * 0.5f) * size + 0.5f);
+	x = max(0, min(x, size - 1));
+	y = max(0, min(y, size - 1));
+
+	return pShadowPosition->z > pShadowMap[y * size + x] + bias;
+}
+
+// copy a R32F render target into system memory. NULL if it can't be
+float * ReadRenderTarget(LPDIRECT3DSURFACE9 pSurface, int width, int height)
+{
+	LPDIRECT3DSURFACE9 pSystemSurface = NULL;
+	if (FAILED(gpD3DDevice->CreateOffscreenPlainSurface(width, height, D3DFMT_R32F, D3DPOOL_SYSTEMMEM, &pSystemSurface, NULL)))
+	{
+		return NULL;
+	}
+
+	float * pValues = NULL;
+	D3DLOCKED_RECT lockedRect;
+	if (SUCCEEDED(gpD3DDevice->GetRenderTargetData(pSurface, pSystemSurface))
+		&& SUCCEEDED(pSystemSurface->LockRect(&lockedRect, NULL, D3DLOCK_READONLY)))
+	{
+		pValues = new float[width * height];
+		for (int y = 0; y < height; ++y)
+		{
+			memcpy(pValues + y * width, (const BYTE*)lockedRect.pBits + y * lockedRect.Pitch, width * sizeof(float));
+		}
+		pSystemSurface->UnlockRect();
+	}
+
+	pSystemSurface->Release();
+	pSystemSurface = NULL;
+	return pValues;
+}
+
+//------------------------------------------------------------
+// GPU timers
+//------------------------------------------------------------
+
+// timestamp queries aren't supported everywhere. without them the
+// timers are left empty and the timings show as unknown
+void InitGPUTimers()
+{
+	for (int i = 0; i < NUM_GPU_TIMERS; ++i)
+	{
+		GPUTimer & timer = gGPUTimers[i];
+		ZeroMemory(&timer, sizeof(timer));
+
+		bool isCreated = SUCCEEDED(gpD3DDevice->CreateQuery(D3DQUERYTYPE_TIMESTAMPDISJOINT, &timer.mDisjoint))
+			&& SUCCEEDED(gpD3DDevice->CreateQuery(D3DQUERYTYPE_TIMESTAMPFREQ, &timer.mFrequency));
+		for (int j = 0; j < MAX_GPU_TIMESTAMPS && isCreated; ++j)
+		{
+			isCreated = SUCCEEDED(gpD3DDevice->CreateQuery(D3DQUERYTYPE_TIMESTAMP, &timer.mTimestamps[j]));
+		}
+
+		if (!isCreated)
+		{
+			OutputDebugString("GPU timestamps aren't supported\n");
+			ReleaseGPUTimers();
+			return;
+		}
+	}
+}
+
+void ReleaseGPUTimers()
+{
+	for (int i = 0; i < NUM_GPU_TIMERS; ++i)
+	{
+		GPUTimer & timer = gGPUTimers[i];
+		LPDIRECT3DQUERY9 * queries[2 + MAX_GPU_TIMESTAMPS] = { &timer.mDisjoint, &timer.mFrequency };
+		for (int j = 0; j < MAX_GPU_TIMESTAMPS; ++j)
+		{
+			queries[2 + j] = &timer.mTimestamps[j];
+		}
+
+		for (int j = 0; j < 2 + MAX_GPU_TIMESTAMPS; ++j)
+		{
+			if (*queries[j])
+			{
+				(*queries[j])->Release();
+				*queries[j] = NULL;
+			}
+		}
+		timer.mIssued = false;
+	}
+}
+
+// timers are used round robin, so a timer's results are read
+// NUM_GPU_TIMERS frames after it was issued, when the GPU is usually done
+// with them and reading doesn't stall
+void BeginGPUTimer(int shadowPass)
+{
+	GPUTimer & timer = gGPUTimers[gCurrentGPUTimer];
+	if (!timer.mDisjoint)
+	{
+		return;
+	}
+
+	if (timer.mIssued)
+	{
+		ReadGPUTimer(&timer);
+	}
+
+	timer.mDisjoint->Issue(D3DISSUE_BEGIN);
+	timer.mShadowPass = shadowPass;
+	timer.mNumTimestamps = 0;
+	MarkGPUTimer();
+}
+
+// timestamp in the middle of the timed work
+void MarkGPUTimer()
+{
+	GPUTimer & timer = gGPUTimers[gCurrentGPUTimer];
+	if (timer.mDisjoint && timer.mNumTimestamps < MAX_GPU_TIMESTAMPS)
+	{
+		timer.mTimestamps[timer.mNumTimestamps++]->Issue(D3DISSUE_END);
+	}
+}
+
+void EndGPUTimer()
+{
+	GPUTimer & timer = gGPUTimers[gCurrentGPUTimer];
+	if (timer.mDisjoint)
+	{
+		MarkGPUTimer();
+		timer.mFrequency->Issue(D3DISSUE_END);
+		timer.mDisjoint->Issue(D3DISSUE_END);
+		timer.mIssued = true;
+	}
+
+	gCurrentGPUTimer = (gCurrentGPUTimer + 1) % NUM_GPU_TIMERS;
+}
+
+// add the timer's result to the running averages of its pass: the whole
+// pass for the cascades, every face for the cube map, shadows and
+// lighting for the atlas. results that
+// aren't ready yet, or were disturbed by a clock change, are skipped
+void ReadGPUTimer(GPUTimer * pTimer)
+{
+	BOOL disjoint = TRUE;
+	UINT64 frequency = 0;
+	if (pTimer->mDisjoint->GetData(&disjoint, sizeof(disjoint), 0) != S_OK
+		|| pTimer->mFrequency->GetData(&frequency, sizeof(frequency), 0) != S_OK)
+	{
+		return;
+	}
+
+	UINT64 timestamps[MAX_GPU_TIMESTAMPS];
+	for (int i = 0; i < pTimer->mNumTimestamps; ++i)
+	{
+		if (pTimer->mTimestamps[i]->GetData(&timestamps[i], sizeof(timestamps[i]), 0) != S_OK)
+		{
+			return;
+		}
+	}
+
+	if (disjoint || frequency == 0 || pTimer->mNumTimestamps < 2)
+	{
+		return;
+	}
+
+	float * averages = NULL;
+	int numIntervals = 1;
+	if (pTimer->mShadowPass == SHADOW_PASS_CUBE)
+	{
+		averages = gCubeFaceMilliseconds;
+		numIntervals = min(pTimer->mNumTimestamps - 1, 6);
+	}
+	else if (pTimer->mShadowPass == SHADOW_PASS_ATLAS)
+	{
+		averages = gAtlasMilliseconds;
+		numIntervals = min(pTimer->mNumTimestamps - 1, 2);
+	}
+	else
+	{
+		averages = &gShadowPassMilliseconds[pTimer->mShadowPass];
+		timestamps[1] = timestamps[pTimer->mNumTimestamps - 1];
+	}
+
+	for (int i = 0; i < numIntervals; ++i)
+	{
+		float milliseconds = (float)((timestamps[i + 1] - timestamps[i]) * 1000.0 / frequency);
+		float & average = averages[i];
+		average = (average < 0.0f) ? milliseconds : average * 0.9f + milliseconds * 0.1f;
+	}
+}
+
+//------------------------------------------------------------
+// Initialization code
+//------------------------------------------------------------
+bool InitEverything(HWND hWnd)
+{
+	// init D3D
+	if (!InitD3D(hWnd))
+	{
+		return false;
+	}
+
+	// triangles reaching past the guard band have to be clipped for real.
+	// without a guard band, that's anything leaving the viewport
+	D3DCAPS9 caps;
+	if (SUCCEEDED(gpD3DDevice->GetDeviceCaps(&caps)) && caps.GuardBandRight > caps.GuardBandLeft)
+	{
+		gGuardBandLeft = caps.GuardBandLeft;
+		gGuardBandTop = caps.GuardBandTop;
+		gGuardBandRight = caps.GuardBandRight;
+		gGuardBandBottom = caps.GuardBandBottom;
+	}
+
+	D3DDEVICE_CREATION_PARAMETERS creationParameters;
+	gpD3DDevice->GetCreationParameters(&creationParameters);
+
+	// 16 bit storage needs 16 bit UNORM render targets, and a 16 bit
+	// depth buffer to go with them
+	bool canRenderL16 = SUCCEEDED(gpD3D->CheckDeviceFormat(creationParameters.AdapterOrdinal, creationParameters.DeviceType,
+		D3DFMT_X8R8G8B8, D3DUSAGE_RENDERTARGET, D3DRTYPE_TEXTURE, D3DFMT_L16));
+	gIsShadowStorageSupported[SHADOW_STORAGE_32F] = true;
+	gIsShadowStorageSupported[SHADOW_STORAGE_16] = canRenderL16
+		&& SUCCEEDED(gpD3D->CheckDeviceFormat(creationParameters.AdapterOrdinal, creationParameters.DeviceType,
+			D3DFMT_X8R8G8B8, D3DUSAGE_DEPTHSTENCIL, D3DRTYPE_SURFACE, D3DFMT_D16));
+	gIsShadowStorageSupported[SHADOW_STORAGE_32F_CACHE_16] = canRenderL16;
+
+	// create the render targets of the color path
+	if (!CreateShadowStorage(SHADOW_STORAGE_32F))
+	{
+		return false;
+	}
+
+	const int shadowMapSize = SHADOW_MAP_SIZE;
+
+	// the depth-only path needs depth textures that can be read, and a
+	// color target that doesn't take memory
+	if (SUCCEEDED(gpD3D->CheckDeviceFormat(creationParameters.AdapterOrdinal, creationParameters.DeviceType,
+			D3DFMT_X8R8G8B8, D3DUSAGE_DEPTHSTENCIL, D3DRTYPE_TEXTURE, FOURCC_INTZ))
+		&& SUCCEEDED(gpD3D->CheckDeviceFormat(creationParameters.AdapterOrdinal, creationParameters.DeviceType,
+			D3DFMT_X8R8G8B8, D3DUSAGE_RENDERTARGET, D3DRTYPE_SURFACE, FOURCC_NULL))
+		&& SUCCEEDED(gpD3DDevice->CreateTexture(shadowMapSize, shadowMapSize,
+			1, D3DUSAGE_DEPTHSTENCIL, FOURCC_INTZ,
+			D3DPOOL_DEFAULT, &gpShadowDepthMap, NULL))
+		&& SUCCEEDED(gpD3DDevice->CreateRenderTarget(shadowMapSize, shadowMapSize,
+			FOURCC_NULL, D3DMULTISAMPLE_NONE, 0, FALSE,
+			&gpNullRenderTarget, NULL)))
+	{
+		gUseDepthOnlyShadows = true;
+
+		// its static cache doesn't need StretchRect
+		if (FAILED(gpD3DDevice->CreateTexture(shadowMapSize, shadowMapSize,
+			1, D3DUSAGE_DEPTHSTENCIL, FOURCC_INTZ,
+			D3DPOOL_DEFAULT, &gpStaticShadowDepthCache, NULL)))
+		{
+			gpStaticShadowDepthCache = NULL;
+		}
+	}
+	else
+	{
+		if (gpShadowDepthMap)
+		{
+			gpShadowDepthMap->Release();
+			gpShadowDepthMap = NULL;
+		}
+		gpNullRenderTarget = NULL;
+	}
+
+	InitGPUTimers();
+
+	// cube shadow map for the point light. without it, there are only
+	// the cascades
+	if (FAILED(gpD3DDevice->CreateCubeTexture(CUBE_SHADOW_SIZE, 1, D3DUSAGE_RENDERTARGET, D3DFMT_R32F,
+			D3DPOOL_DEFAULT, &gpCubeShadowMap, NULL))
+		|| FAILED(gpD3DDevice->CreateDepthStencilSurface(CUBE_SHADOW_SIZE, CUBE_SHADOW_SIZE,
+			D3DFMT_D24X8, D3DMULTISAMPLE_NONE, 0, TRUE,
+			&gpCubeShadowDepthStencil, NULL)))
+	{
+		if (gpCubeShadowMap)
+		{
+			gpCubeShadowMap->Release();
+			gpCubeShadowMap = NULL;
+		}
+		gpCubeShadowDepthStencil = NULL;
+	}
+
+	// and two for the moments of variance shadow mapping, which need to
+	// be filtered. 16 bit floats if 32 bit ones can't be
+
+	D3DFORMAT momentFormats[2] = { D3DFMT_G32R32F, D3DFMT_G16R16F };
+	for (int i = 0; i < 2 && !gpMomentRenderTarget; ++i)
+	{
+		if (FAILED(gpD3D->CheckDeviceFormat(creationParameters.AdapterOrdinal, creationParameters.DeviceType,
+			D3DFMT_X8R8G8B8, D3DUSAGE_RENDERTARGET | D3DUSAGE_QUERY_FILTER, D3DRTYPE_TEXTURE, momentFormats[i])))
+		{
+			continue;
+		}
+
+		if (FAILED(gpD3DDevice->CreateTexture(shadowMapSize, shadowMapSize,
+			1, D3DUSAGE_RENDERTARGET, momentFormats[i],
+			D3DPOOL_DEFAULT, &gpMomentBlurTarget, NULL)))
+		{
+			continue;
+		}
+
+		if (FAILED(gpD3DDevice->CreateTexture(shadowMapSize, shadowMapSize,
+			1, D3DUSAGE_RENDERTARGET, momentFormats[i],
+			D3DPOOL_DEFAULT, &gpMomentRenderTarget, NULL)))
+		{
+			gpMomentBlurTarget->Release();
+			gpMomentBlurTarget = NULL;
+		}
+	}
+
+	// the scene's view depth and the contact shadow mask, the size of the
+	// screen
+	if (FAILED(gpD3DDevice->CreateTexture(WIN_WIDTH, WIN_HEIGHT,
+			1, D3DUSAGE_RENDERTARGET, D3DFMT_R32F,
+			D3DPOOL_DEFAULT, &gpSceneDepthTarget, NULL))
+		|| FAILED(gpD3DDevice->CreateTexture(WIN_WIDTH, WIN_HEIGHT,
+			1, D3DUSAGE_RENDERTARGET, D3DFMT_A8R8G8B8,
+			D3DPOOL_DEFAULT, &gpContactShadowTarget, NULL)))
+	{
+		if (gpSceneDepthTarget)
+		{
+			gpSceneDepthTarget->Release();
+			gpSceneDepthTarget = NULL;
+		}
+		gpContactShadowTarget = NULL;
+	}
+
+	// loading models, shaders and textures
+	if (!LoadAssets())
+	{
+		return false;
+	}
+
+	// load fonts
+	if (FAILED(D3DXCreateFont(gpD3DDevice, 20, 10, FW_BOLD, 1, FALSE, DEFAULT_CHARSET,
+		OUT_DEFAULT_PRECIS, DEFAULT_QUALITY, (DEFAULT_PITCH | FF_DONTCARE),
+		"Arial", &gpFont)))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+// create the color path's shadow map, its depth buffer and the static
+// cache in a storage. without a cache, the static casters can't be cached
+bool CreateShadowStorage(int storage)
+{
+	D3DFORMAT mapFormat = (storage == SHADOW_STORAGE_16) ? D3DFMT_L16 : D3DFMT_R32F;
+	D3DFORMAT depthFormat = (storage == SHADOW_STORAGE_16) ? D3DFMT_D16 : D3DFMT_D24X8;
+	D3DFORMAT cacheFormat = (storage == SHADOW_STORAGE_32F) ? D3DFMT_R32F : D3DFMT_L16;
+
+	const int shadowMapSize = SHADOW_MAP_SIZE;
+	if (FAILED(gpD3DDevice->CreateTexture(shadowMapSize, shadowMapSize,
+		1, D3DUSAGE_RENDERTARGET, mapFormat,
+		D3DPOOL_DEFAULT, &gpShadowRenderTarget, NULL)))
+	{
+		gpShadowRenderTarget = NULL;
+		return false;
+	}
+
+	// also need to make a depthbuffer which has same size as shadow map
+	if (FAILED(gpD3DDevice->CreateDepthStencilSurface(shadowMapSize, shadowMapSize,
+		depthFormat, D3DMULTISAMPLE_NONE, 0, TRUE,
+		&gpShadowDepthStencil, NULL)))
+	{
+		gpShadowDepthStencil = NULL;
+		return false;
+	}
+
+	// a cache in the shadow map's format is copied back with StretchRect,
+	// which has to be able to read textures. other ones are drawn back
+	D3DCAPS9 caps;
+	if (cacheFormat != mapFormat
+		|| (SUCCEEDED(gpD3DDevice->GetDeviceCaps(&caps)) && (caps.DevCaps2 & D3DDEVCAPS2_CAN_STRETCHRECT_FROM_TEXTURES)))
+	{
+		if (FAILED(gpD3DDevice->CreateTexture(shadowMapSize, shadowMapSize,
+			1, D3DUSAGE_RENDERTARGET, cacheFormat,
+			D3DPOOL_DEFAULT, &gpStaticShadowCache, NULL)))
+		{
+			gpStaticShadowCache = NULL;
+		}
+	}
+
+	gShadowStorage = storage;
+	return true;
+}
+
+// init D3D object and device
+bool InitD3D(HWND hWnd)
+{
+	// D3D object
+	gpD3D = Direct3DCreate9(D3D_SDK_VERSION);
+	if (!gpD3D)
+	{
+		return false;
+	}
+
+	// fill in the structure needed to create a D3D device
+	D3DPRESENT_PARAMETERS d3dpp;
+	ZeroMemory(&d3dpp, sizeof(d3dpp));
+
+	d3dpp.BackBufferWidth = WIN_WIDTH;
+	d3dpp.BackBufferHeight = WIN_HEIGHT;
+	d3dpp.BackBufferFormat = D3DFMT_X8R8G8B8;
+	d3dpp.BackBufferCount = 1;
+	d3dpp.MultiSampleType = D3DMULTISAMPLE_NONE;
+	d3dpp.MultiSampleQuality = 0;
+	d3dpp.SwapEffect = D3DSWAPEFFECT_DISCARD;
+	d3dpp.hDeviceWindow = hWnd;
+	d3dpp.Windowed = TRUE;
+	d3dpp.EnableAutoDepthStencil = TRUE;
+	d3dpp.AutoDepthStencilFormat = D3DFMT_D24X8;
+	d3dpp.Flags = D3DPRESENTFLAG_DISCARD_DEPTHSTENCIL;
+	d3dpp.FullScreen_RefreshRateInHz = 0;
+	d3dpp.PresentationInterval = D3DPRESENT_INTERVAL_ONE;
+
+	// decide where the vs_2_0/ps_2_0 shaders get executed. without
+	// vertex shader 2.0 hardware, the runtime's software vertex processing
+	// runs them on the CPU. without ps_2_0 this falls back to the
+	// reference rasterizer, which is only installed with the DirectX SDK
+	// and takes seconds per frame. either way the choice is reported
+	// (the shader model 3 features are checked on their own, and are
+	// turned off without it)
+	D3DDEVTYPE deviceType = D3DDEVTYPE_HAL;
+	DWORD vertexProcessing = D3DCREATE_HARDWARE_VERTEXPROCESSING;
+
+	D3DCAPS9 caps;
+	if (FAILED(gpD3D->GetDeviceCaps(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, &caps))
+		|| caps.PixelShaderVersion < D3DPS_VERSION(2, 0))
+	{
+		deviceType = D3DDEVTYPE_REF;
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+	}
+	else if (!(caps.DevCaps & D3DDEVCAPS_HWTRANSFORMANDLIGHT)
+		|| caps.VertexShaderVersion < D3DVS_VERSION(2, 0))
+	{
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+	}
+
+	// create a D3D device
+	if (FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, deviceType, hWnd,
+		vertexProcessing,
+		&d3dpp, &gpD3DDevice)))
+	{
+		// hardware vertex processing can still be refused (e.g. out of
+		// video memory), so try once more with software vertex processing
+		if (vertexProcessing == D3DCREATE_SOFTWARE_VERTEXPROCESSING
+			|| FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, deviceType, hWnd,
+			D3DCREATE_SOFTWARE_VERTEXPROCESSING,
+			&d3dpp, &gpD3DDevice)))
+		{
+			return false;
+		}
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+	}
+
+	sprintf(gDeviceDescription, "Device: %s, %s VP",
+		(deviceType == D3DDEVTYPE_REF) ? "REF" : "HAL",
+		(vertexProcessing == D3DCREATE_SOFTWARE_VERTEXPROCESSING) ? "SW" : "HW");
+	OutputDebugString(gDeviceDescription);
+	OutputDebugString("\n");
+
+	return true;
+}
+
+bool LoadAssets()
+{
+	// loading textures
+
+	// loading shaders
+	gpApplyShadowShader = LoadShader("ApplyShadow.fx");
+	if (!gpApplyShadowShader)
+	{
+		return false;
+	}
+
+	gpCreateShadowShader = LoadShader("CreateShadow.fx");
+	if (!gpCreateShadowShader)
+	{
+		return false;
+	}
+
+	gpShadowMomentsShader = LoadShader("ShadowMoments.fx");
+	if (!gpShadowMomentsShader)
+	{
+		return false;
+	}
+
+	gpContactShadowShader = LoadShader("ContactShadow.fx");
+	if (!gpContactShadowShader)
+	{
+		return false;
+	}
+
+	// the Poisson filter needs shader model 3, VSM the moment targets
+	for (int i = 0; i < NUM_SHADOW_FILTERS; ++i)
+	{
+		D3DXHANDLE technique = gpApplyShadowShader->GetTechniqueByName(gShadowFilterTechniques[i]);
+		gIsShadowFilterSupported[i] = technique && SUCCEEDED(gpApplyShadowShader->ValidateTechnique(technique));
+	}
+	gIsShadowFilterSupported[SHADOW_FILTER_HARD] = true;
+	gIsShadowFilterSupported[SHADOW_FILTER_VSM] = gIsShadowFilterSupported[SHADOW_FILTER_VSM] && gpMomentRenderTarget;
+
+	if (!gIsShadowFilterSupported[gShadowFilter])
+	{
+		gShadowFilter = SHADOW_FILTER_HARD;
+	}
+
+	for (int i = 0; i < NUM_SHADOW_FILTERS; ++i)
+	{
+		D3DXHANDLE technique = gpApplyShadowShader->GetTechniqueByName(gShadowFilterBatchedTechniques[i]);
+		gIsBatchedFilterSupported[i] = gIsShadowFilterSupported[i] && technique
+			&& SUCCEEDED(gpApplyShadowShader->ValidateTechnique(technique));
+	}
+
+	D3DXHANDLE atlasTechnique = gpApplyShadowShader->GetTechniqueByName("ApplyShadowAtlas");
+	gIsShadowAtlasSupported = atlasTechnique && SUCCEEDED(gpApplyShadowShader->ValidateTechnique(atlasTechnique))
+		&& SUCCEEDED(gpD3DDevice->CreateTexture(SPOT_LIGHT_TEXELS, MAX_SPOT_LIGHTS, 1, 0, D3DFMT_A32B32G32R32F,
+			D3DPOOL_MANAGED, &gpSpotLightData, NULL));
+
+	D3DXHANDLE contactTechnique = gpContactShadowShader->GetTechniqueByName("ContactShadow");
+	gIsContactShadowSupported = gpContactShadowTarget && contactTechnique
+		&& SUCCEEDED(gpContactShadowShader->ValidateTechnique(contactTechnique));
+
+
+	// loading models
+	gpTorus = LoadModel("torus.x");
+	if (!gpTorus)
+	{
+		return false;
+	}
+
+	gpDisc = LoadModel("disc.x");
+	if (!gpDisc)
+	{
+		return false;
+	}
+
+	// position-only copies for the depth-only shadow pass
+	if (FAILED(gpTorus->CloneMeshFVF(D3DXMESH_MANAGED, D3DFVF_XYZ, gpD3DDevice, &gpTorusPositions))
+		|| FAILED(gpDisc->CloneMeshFVF(D3DXMESH_MANAGED, D3DFVF_XYZ, gpD3DDevice, &gpDiscPositions)))
+	{
+		return false;
+	}
+
+	// bounding spheres for culling the casters per cascade, and boxes
+	// for fitting the cascades
+	ComputeMeshBoundingSphere(gpTorus, &gTorusBoundingCenter, &gTorusBoundingRadius);
+	ComputeMeshBoundingBox(gpTorus, &gTorusBoundingMin, &gTorusBoundingMax);
+	ComputeMeshBoundingSphere(gpDisc, &gDiscBoundingCenter, &gDiscBoundingRadius);
+	ComputeMeshBoundingBox(gpDisc, &gDiscBoundingMin, &gDiscBoundingMax);
+
+	// room for the clip space positions of the largest mesh
+	gNumClipPositions = max(gpTorus->GetNumVertices(), gpDisc->GetNumVertices());
+	gpClipPositions = new D3DXVECTOR4[gNumClipPositions];
+
+	// the draw queue and the crowd
+	gpDrawItems = new DrawItem[MAX_DRAW_ITEMS];
+	gpCrowdWorlds = new D3DXMATRIX[MAX_CROWD_OBJECTS];
+	gpCrowdColors = new D3DXVECTOR4[MAX_CROWD_OBJECTS];
+	BuildCrowd(gCrowdSizes[gCrowdSize]);
+
+	// hardware instancing comes with shader model 3. the torus' vertices
+	// go first, then the instance index as TEXCOORD7
+	D3DCAPS9 caps;
+	if (SUCCEEDED(gpD3DDevice->GetDeviceCaps(&caps)) && caps.VertexShaderVersion >= D3DVS_VERSION(3, 0))
+	{
+		D3DVERTEXELEMENT9 elements[MAX_FVF_DECL_SIZE + 1];
+		gpTorus->GetDeclaration(elements);
+		UINT numElements = D3DXGetDeclLength(elements);
+		D3DVERTEXELEMENT9 instanceElement = { 1, 0, D3DDECLTYPE_FLOAT1, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 7 };
+		D3DVERTEXELEMENT9 endElement = D3DDECL_END();
+		elements[numElements] = instanceElement;
+		elements[numElements + 1] = endElement;
+
+		float * pIndices = NULL;
+		if (SUCCEEDED(gpD3DDevice->CreateVertexDeclaration(elements, &gpInstanceDeclaration))
+			&& SUCCEEDED(gpD3DDevice->CreateVertexBuffer(DRAW_BATCH_SIZE * sizeof(float), D3DUSAGE_WRITEONLY, 0,
+				D3DPOOL_MANAGED, &gpInstanceIndexBuffer, NULL))
+			&& SUCCEEDED(gpInstanceIndexBuffer->Lock(0, 0, (void**)&pIndices, 0)))
+		{
+			for (int i = 0; i < DRAW_BATCH_SIZE; ++i)
+			{
+				pIndices[i] = (float)i;
+			}
+			gpInstanceIndexBuffer->Unlock();
+			gInstanceFVF = gpTorus->GetFVF();
+		}
+		else
+		{
+			if (gpInstanceDeclaration)
+			{
+				gpInstanceDeclaration->Release();
+				gpInstanceDeclaration = NULL;
+			}
+
+			if (gpInstanceIndexBuffer)
+			{
+				gpInstanceIndexBuffer->Release();
+				gpInstanceIndexBuffer = NULL;
+			}
+		}
+	}
+
+	return true;
+}
+
+// loading shaders
+LPD3DXEFFECT LoadShader(const char * filename)
+{
+	LPD3DXEFFECT ret = NULL;
+
+	LPD3DXBUFFER pError = NULL;
+	DWORD dwShaderFlags = 0;
+
+#if _DEBUG
+	dwShaderFlags |= D3DXSHADER_DEBUG;
+#else
+	// release builds use the effect precompiled by fxc at build time
+	// (custom build step in the project), so HLSL isn't parsed and
+	// compiled on every launch. fall back to the source if it's missing
+	char compiledFilename[MAX_PATH];
+	_snprintf(compiledFilename, MAX_PATH, "%so", filename);
+	compiledFilename[MAX_PATH - 1] = '\0';
+	if (GetFileAttributes(compiledFilename) != INVALID_FILE_ATTRIBUTES)
+	{
+		filename = compiledFilename;
+	}
+#endif
+
+	D3DXCreateEffectFromFile(gpD3DDevice, filename,
+		NULL, NULL, dwShaderFlags, NULL, &ret, &pError);
+
+	// if failed at loading shaders, display compile error
+	// to output window
+	if (!ret && pError)
+	{
+		int size = pError->GetBufferSize();
+		void *ack = pError->GetBufferPointer();
 
 		if (ack)
 		{
@@ -523,6 +3258,36 @@ LPD3DXMESH LoadModel(const char * filename)
 	return ret;
 }
 
+// bounding sphere of a mesh's vertices in object space
+void ComputeMeshBoundingSphere(LPD3DXMESH pMesh, D3DXVECTOR3 * pCenter, float * pRadius)
+{
+	*pCenter = D3DXVECTOR3(0, 0, 0);
+	*pRadius = 0.0f;
+
+	void * vertexData = NULL;
+	if (SUCCEEDED(pMesh->LockVertexBuffer(D3DLOCK_READONLY, &vertexData)))
+	{
+		D3DXComputeBoundingSphere((const D3DXVECTOR3*)vertexData, pMesh->GetNumVertices(),
+			pMesh->GetNumBytesPerVertex(), pCenter, pRadius);
+		pMesh->UnlockVertexBuffer();
+	}
+}
+
+// bounding box of a mesh's vertices in object space
+void ComputeMeshBoundingBox(LPD3DXMESH pMesh, D3DXVECTOR3 * pMin, D3DXVECTOR3 * pMax)
+{
+	*pMin = D3DXVECTOR3(0, 0, 0);
+	*pMax = D3DXVECTOR3(0, 0, 0);
+
+	void * vertexData = NULL;
+	if (SUCCEEDED(pMesh->LockVertexBuffer(D3DLOCK_READONLY, &vertexData)))
+	{
+		D3DXComputeBoundingBox((const D3DXVECTOR3*)vertexData, pMesh->GetNumVertices(),
+			pMesh->GetNumBytesPerVertex(), pMin, pMax);
+		pMesh->UnlockVertexBuffer();
+	}
+}
+
 // loading textures
 LPDIRECT3DTEXTURE9 LoadTexture(const char * filename)
 {
@@ -540,8 +3305,59 @@ LPDIRECT3DTEXTURE9 LoadTexture(const char * filename)
 // cleanup code
 //------------------------------------------------------------
 
+// release the color path's shadow map, depth buffer and static cache
+void ReleaseShadowStorage()
+{
+	if (gpShadowRenderTarget)
+	{
+		gpShadowRenderTarget->Release();
+		gpShadowRenderTarget = NULL;
+	}
+
+	if (gpShadowDepthStencil)
+	{
+		gpShadowDepthStencil->Release();
+		gpShadowDepthStencil = NULL;
+	}
+
+	if (gpStaticShadowCache)
+	{
+		gpStaticShadowCache->Release();
+		gpStaticShadowCache = NULL;
+	}
+}
+
 void Cleanup()
 {
+	// release the draw queue and the crowd
+	delete[] gpDrawItems;
+	gpDrawItems = NULL;
+	delete[] gpCrowdWorlds;
+	gpCrowdWorlds = NULL;
+	delete[] gpCrowdColors;
+	gpCrowdColors = NULL;
+	delete[] gpClipPositions;
+	gpClipPositions = NULL;
+	gNumClipPositions = 0;
+
+	if (gpInstanceDeclaration)
+	{
+		gpInstanceDeclaration->Release();
+		gpInstanceDeclaration = NULL;
+	}
+
+	if (gpInstanceIndexBuffer)
+	{
+		gpInstanceIndexBuffer->Release();
+		gpInstanceIndexBuffer = NULL;
+	}
+
+	if (gpSpotLightData)
+	{
+		gpSpotLightData->Release();
+		gpSpotLightData = NULL;
+	}
+
 	// release fonts
 	if (gpFont)
 	{
@@ -562,6 +3378,18 @@ void Cleanup()
 		gpDisc = NULL;
 	}
 
+	if (gpTorusPositions)
+	{
+		gpTorusPositions->Release();
+		gpTorusPositions = NULL;
+	}
+
+	if (gpDiscPositions)
+	{
+		gpDiscPositions->Release();
+		gpDiscPositions = NULL;
+	}
+
 	// release shaders
 	if (gpApplyShadowShader)
 	{
@@ -575,17 +3403,75 @@ void Cleanup()
 		gpCreateShadowShader = NULL;
 	}
 
+	if (gpShadowMomentsShader)
+	{
+		gpShadowMomentsShader->Release();
+		gpShadowMomentsShader = NULL;
+	}
+
+	if (gpContactShadowShader)
+	{
+		gpContactShadowShader->Release();
+		gpContactShadowShader = NULL;
+	}
+
 	// release textures
-	if (gpShadowRenderTarget)
+	ReleaseShadowStorage();
+
+	if (gpShadowDepthMap)
 	{
-		gpShadowRenderTarget->Release();
-		gpShadowRenderTarget = NULL;
+		gpShadowDepthMap->Release();
+		gpShadowDepthMap = NULL;
 	}
 
-	if (gpShadowDepthStencil)
+	if (gpStaticShadowDepthCache)
 	{
-		gpShadowDepthStencil->Release();
-		gpShadowDepthStencil = NULL;
+		gpStaticShadowDepthCache->Release();
+		gpStaticShadowDepthCache = NULL;
+	}
+
+	if (gpNullRenderTarget)
+	{
+		gpNullRenderTarget->Release();
+		gpNullRenderTarget = NULL;
+	}
+
+	ReleaseGPUTimers();
+
+	if (gpCubeShadowMap)
+	{
+		gpCubeShadowMap->Release();
+		gpCubeShadowMap = NULL;
+	}
+
+	if (gpCubeShadowDepthStencil)
+	{
+		gpCubeShadowDepthStencil->Release();
+		gpCubeShadowDepthStencil = NULL;
+	}
+
+	if (gpMomentRenderTarget)
+	{
+		gpMomentRenderTarget->Release();
+		gpMomentRenderTarget = NULL;
+	}
+
+	if (gpMomentBlurTarget)
+	{
+		gpMomentBlurTarget->Release();
+		gpMomentBlurTarget = NULL;
+	}
+
+	if (gpSceneDepthTarget)
+	{
+		gpSceneDepthTarget->Release();
+		gpSceneDepthTarget = NULL;
+	}
+
+	if (gpContactShadowTarget)
+	{
+		gpContactShadowTarget->Release();
+		gpContactShadowTarget = NULL;
 	}
 
 	// release D3D
@@ -20,6 +20,199 @@
 #define WIN_WIDTH		800
 #define WIN_HEIGHT		600
 
+// the shadow map is an atlas with one cascade per quarter
+#define SHADOW_MAP_SIZE			2048
+#define NUM_CASCADES			4
+#define CASCADE_SIZE			(SHADOW_MAP_SIZE / 2)
+
+// view distance covered by the cascades
+#define SHADOW_DISTANCE			500.0f
+
+// blend between logarithmic (1) and uniform (0) cascade splits
+#define CASCADE_SPLIT_LAMBDA	0.75f
+
+// distance of the shadow camera from the origin, towards the light
+#define LIGHT_DISTANCE			2000.0f
+
+// depth bias in shadow texels
+#define SHADOW_BIAS_TEXELS		2.0f
+
+// shadow map filters, cheapest first
+#define SHADOW_FILTER_HARD		0
+#define SHADOW_FILTER_PCF		1
+#define SHADOW_FILTER_POISSON	2
+#define SHADOW_FILTER_VSM		3
+#define NUM_SHADOW_FILTERS		4
+
+// storage of the color path's shadow map, depth buffer and static cache:
+// all 32 bit, all 16 bit, or 32 bit with a 16 bit static cache
+#define SHADOW_STORAGE_32F			0
+#define SHADOW_STORAGE_16			1
+#define SHADOW_STORAGE_32F_CACHE_16	2
+#define NUM_SHADOW_STORAGES			3
+
+// steps a 16 bit UNORM and a 24 bit depth hold between 0 and 1
+#define DEPTH_STEPS_16			65535.0f
+#define DEPTH_STEPS_24			16777215.0f
+
+// depth formats the GPU can render to and read back as textures, and a
+// render target format that takes no memory
+#define FOURCC_INTZ				((D3DFORMAT)MAKEFOURCC('I', 'N', 'T', 'Z'))
+#define FOURCC_NULL				((D3DFORMAT)MAKEFOURCC('N', 'U', 'L', 'L'))
+
+// cube shadow map of the point light: size of a face, distance covered
+// and depth bias in world units
+#define CUBE_SHADOW_SIZE		1024
+#define POINT_LIGHT_RANGE		3000.0f
+#define CUBE_SHADOW_BIAS		1.0f
+
+// lights the scene can be lit by: the directional light with cascades,
+// the point light with a cube map, or spot lights sharing a shadow atlas
+#define LIGHT_MODE_DIRECTIONAL	0
+#define LIGHT_MODE_POINT		1
+#define LIGHT_MODE_SPOTS		2
+
+// spot lights circling the scene: most lights one pass can shade, their
+// cone angle, range and depth bias in world units, and the ring they're on
+#define MAX_SPOT_LIGHTS			24
+#define SPOT_LIGHT_TEXELS		7			// per light in gpSpotLightData, like ApplyShadow.fx
+#define SPOT_LIGHT_FOV			(D3DX_PI / 3.0f)
+#define SPOT_LIGHT_RANGE		400.0f
+#define SPOT_SHADOW_BIAS		1.0f
+#define SPOT_RING_RADIUS		120.0f
+#define SPOT_RING_HEIGHT		100.0f
+
+// the shadow atlas is the color path's shadow map, split by a quadtree
+// into square regions from ATLAS_MAX_REGION down to ATLAS_MIN_REGION
+#define ATLAS_SIZE				SHADOW_MAP_SIZE
+#define ATLAS_MAX_REGION		1024
+#define ATLAS_MIN_REGION		128
+#define ATLAS_LEVELS			5			// 2048 to 128
+#define ATLAS_NODES				341			// 1 + 4 + 16 + 64 + 256
+
+// quadtree node states
+#define ATLAS_NODE_FREE			0
+#define ATLAS_NODE_SPLIT		1			// some children are used
+#define ATLAS_NODE_USED			2
+
+// lighting pass draws: objects per instanced draw (as many as fit the
+// vertex shader's constants), and the crowd of small toruses measuring
+// how fast objects can be submitted
+#define DRAW_BATCH_SIZE			48
+#define NUM_CROWD_SIZES			4
+#define MAX_CROWD_OBJECTS		99998
+#define MAX_DRAW_ITEMS			(MAX_CROWD_OBJECTS + 2)
+#define CROWD_AREA				300.0f
+
+// screen space contact shadows: most steps marched towards the light,
+// how far in world units, how far behind the scene a step has to be to
+// be occluded, and up to how far
+#define MAX_CONTACT_STEPS			32
+#define CONTACT_SHADOW_DISTANCE		10.0f
+#define CONTACT_SHADOW_BIAS			0.5f
+#define CONTACT_SHADOW_THICKNESS	5.0f
+
+// measuring them: step counts compared (0 is the shadow map alone),
+// resolution of the reference shadow map in times the cascade's, and the
+// fraction of pixels shadowed differently that's close enough
+#define NUM_CONTACT_MEASUREMENTS	7
+#define CONTACT_REFERENCE_SCALE		4
+#define CONTACT_ERROR_TARGET		0.01f
+
+// shadow passes timed on the GPU
+#define SHADOW_PASS_COLOR		0
+#define SHADOW_PASS_DEPTH_ONLY	1
+#define SHADOW_PASS_CUBE		2
+#define SHADOW_PASS_ATLAS		3
+
+// GPU timers in flight, and timestamps in one. (one before and after
+// every cube face)
+#define NUM_GPU_TIMERS			3
+#define MAX_GPU_TIMESTAMPS		7
+
+// ---------- types ----------------------------------------
+
+// how triangle setup treats the triangles submitted in a frame
+struct TriangleStats
+{
+	DWORD	mSubmitted;			// all triangles drawn
+	DWORD	mOffScreen;			// entirely outside one frustum plane
+	DWORD	mBackFacing;		// removed by D3DCULL_CCW
+	DWORD	mZeroArea;			// degenerate in screen space
+	DWORD	mNoSample;			// too small to cover any pixel center
+	DWORD	mGuardBandClipped;	// need real clipping (near plane or guard band)
+};
+
+// a slice of the view frustum with its own tile in the shadow map
+struct ShadowCascade
+{
+	float			mNear;					// view distances covered
+	float			mFar;
+	D3DXVECTOR3		mLightMin;				// light view space box covered
+	D3DXVECTOR3		mLightMax;
+	D3DXMATRIXA16	mLightProjection;		// orthographic
+	D3DXMATRIXA16	mShadowMatrix;			// world to atlas UV and depth
+	float			mTexelWorldSize;		// world size of one shadow texel
+	float			mDepthBias;
+
+	// static caster cache
+	D3DXMATRIXA16	mCachedProjection;		// mLightProjection the cache was drawn with
+	bool			mIsStaticCached;
+	RECT			mDynamicRect;			// atlas texels of the dynamic casters last frame
+
+	// drawn this frame
+	DWORD			mStaticTriangles;
+	DWORD			mDynamicTriangles;
+	DWORD			mRedrawnTexels;
+};
+
+// a spot light with its region of the shadow atlas
+struct SpotLight
+{
+	D3DXVECTOR3		mPosition;
+	D3DXVECTOR4		mColor;
+	D3DXMATRIXA16	mView;
+	D3DXMATRIXA16	mProjection;
+	D3DXMATRIXA16	mShadowMatrix;			// world to atlas UV, before dividing by w
+	int				mRegionSize;			// wanted from its size on screen. 0 when off screen
+	RECT			mAtlasRect;				// region it got. empty without one
+	DWORD			mTriangles;				// drawn into its region this frame
+};
+
+// an object queued for drawing. FlushDraws() sorts them by effect,
+// technique and mesh
+struct DrawItem
+{
+	LPD3DXEFFECT	mEffect;
+	D3DXHANDLE		mTechnique;
+	D3DXHANDLE		mBatchedTechnique;		// same, with instance constants. NULL if there's none
+	LPD3DXMESH		mMesh;
+	D3DXMATRIX		mWorld;
+	D3DXVECTOR4		mColor;
+};
+
+// handles of the per-object parameters of an effect, looked up once per
+// flush. NULL for the ones the effect doesn't have (the scene depth has
+// no colors)
+struct DrawParameters
+{
+	D3DXHANDLE		mWorld;
+	D3DXHANDLE		mColor;
+	D3DXHANDLE		mInstanceWorlds;
+	D3DXHANDLE		mInstanceColors;
+};
+
+// GPU timestamps in the shadow pass of one frame
+struct GPUTimer
+{
+	LPDIRECT3DQUERY9	mDisjoint;
+	LPDIRECT3DQUERY9	mFrequency;
+	LPDIRECT3DQUERY9	mTimestamps[MAX_GPU_TIMESTAMPS];
+	int					mNumTimestamps;		// issued this frame
+	int					mShadowPass;		// SHADOW_PASS_ that was timed
+	bool				mIssued;
+};
+
 // ---------------- function prototype  ------------------------
 
 // Message procedure related
@@ -32,6 +225,7 @@ bool InitD3D(HWND hWnd);
 bool LoadAssets();
 LPD3DXEFFECT LoadShader(const char * filename);
 LPDIRECT3DTEXTURE9 LoadTexture(const char * filename);
+bool CreateShadowStorage(int storage);
 LPD3DXMESH LoadModel(const char * filename);
 
 // game loop related
@@ -42,6 +236,67 @@ void Update();
 void RenderFrame();
 void RenderScene();
 void RenderInfo();
+void FormatMilliseconds(float milliseconds, char * text);
+LPDIRECT3DTEXTURE9 RenderCascadeShadowMaps(const D3DXMATRIX * pLightView, const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld,
+	const D3DXVECTOR3 * pTorusMin, const D3DXVECTOR3 * pTorusMax);
+void RenderCubeShadowMap(const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld);
+void UpdateSpotLights(const D3DXMATRIX * pView, const D3DXMATRIX * pViewProjection);
+void AllocateShadowAtlas();
+bool AllocateAtlasNode(int node, int level, int x, int y, int wantedLevel, RECT * pRect);
+void RenderShadowAtlas(const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld);
+void GetSpotShadowMatrix(const SpotLight * pLight, const RECT * pRect, D3DXMATRIX * pOut);
+void SetShadowAtlasConstants();
+void SetLightMode(int lightMode);
+void InvalidateStaticShadowCache();
+
+// draw batching related
+void QueueDraw(LPD3DXEFFECT pEffect, D3DXHANDLE technique, D3DXHANDLE batchedTechnique,
+	LPD3DXMESH pMesh, const D3DXMATRIX * pWorld, const D3DXVECTOR4 * pColor);
+void FlushDraws();
+int CompareDrawItems(const void * pLeft, const void * pRight);
+void DrawEach(const DrawItem * pItems, int numItems, const DrawParameters * pParameters);
+void DrawBatched(const DrawItem * pItems, int numItems, const DrawParameters * pParameters);
+void DrawInstances(LPD3DXMESH pMesh, int numInstances);
+void BuildCrowd(int numObjects);
+void QueueScene(LPD3DXEFFECT pEffect, D3DXHANDLE technique, D3DXHANDLE batchedTechnique,
+	const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld);
+bool IsSphereInFrustum(const D3DXMATRIX * pViewProjection, const D3DXVECTOR3 * pCenter, float radius);
+void ComputeShadowCascades(const D3DXMATRIX * pView, const D3DXMATRIX * pLightView,
+	const D3DXVECTOR3 * pCasterMin, const D3DXVECTOR3 * pCasterMax,
+	const D3DXVECTOR3 * pReceiverMin, const D3DXVECTOR3 * pReceiverMax);
+void GetShadowMapRect(const ShadowCascade * pCascade, int cascade, const D3DXVECTOR3 * pMin, const D3DXVECTOR3 * pMax, RECT * pRect);
+void SetShadowRenderTarget(LPDIRECT3DSURFACE9 pSurface, bool isDepthOnly);
+void RestoreStaticShadow(LPDIRECT3DTEXTURE9 pStaticCache, const RECT * pRect, bool isDepthOnly);
+float GetShadowDepthSteps();
+void DrawShadowCaster(LPD3DXMESH pMesh);
+void RenderShadowMoments(LPDIRECT3DTEXTURE9 pShadowMap);
+bool IsSphereInCascade(const ShadowCascade * pCascade, const D3DXMATRIX * pLightView, const D3DXVECTOR3 * pCenter, float radius);
+void TransformBoundingBox(const D3DXMATRIX * pMatrix, const D3DXVECTOR3 * pMin, const D3DXVECTOR3 * pMax, D3DXVECTOR3 * pOutMin, D3DXVECTOR3 * pOutMax);
+void GetWorldBoundingSphere(const D3DXMATRIX * pWorld, const D3DXVECTOR3 * pLocalCenter, float localRadius, D3DXVECTOR3 * pCenter, float * pRadius);
+void ComputeMeshBoundingSphere(LPD3DXMESH pMesh, D3DXVECTOR3 * pCenter, float * pRadius);
+void ComputeMeshBoundingBox(LPD3DXMESH pMesh, D3DXVECTOR3 * pMin, D3DXVECTOR3 * pMax);
+void CountTriangles(LPD3DXMESH pMesh, const D3DXMATRIX * pWorldViewProjection, TriangleStats * pStats);
+
+// contact shadow related
+void RenderSceneDepth(const D3DXMATRIX * pViewProjection, const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld);
+void RenderContactShadows(const D3DXMATRIX * pProjection, const D3DXVECTOR3 * pViewLightDirection);
+void MeasureContactShadows(const D3DXMATRIX * pView, const D3DXMATRIX * pProjection, const D3DXMATRIX * pLightView,
+	const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld, const D3DXVECTOR3 * pViewLightDirection);
+void MarchContactShadow4(const float * pSceneDepth, const float * pX, const float * pY, const float * pZ,
+	const D3DXVECTOR3 * pViewLightDirection, int steps, const D3DXMATRIX * pProjection, float * pOccluded);
+float * RenderMeasuredShadowMap(int size, const ShadowCascade * pCascade, const D3DXMATRIX * pLightView,
+	const D3DXMATRIX * pTorusWorld, const D3DXMATRIX * pDiscWorld);
+bool IsInMeasuredShadow(const float * pShadowMap, int size, const D3DXVECTOR3 * pShadowPosition, float bias);
+float * ReadRenderTarget(LPDIRECT3DSURFACE9 pSurface, int width, int height);
+
+// GPU timer related
+void InitGPUTimers();
+void ReleaseGPUTimers();
+void BeginGPUTimer(int shadowPass);
+void MarkGPUTimer();
+void EndGPUTimer();
+void ReadGPUTimer(GPUTimer * pTimer);
 
 // cleanup related
+void ReleaseShadowStorage();
 void Cleanup();
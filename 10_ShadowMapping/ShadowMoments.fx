@@ -0,0 +1,118 @@
+//**************************************************************//
+//  Effect File exported by RenderMonkey 1.6
+//
+//  - Although many improvements were made to RenderMonkey FX  
+//    file export, there are still situations that may cause   
+//    compilation problems once the file is exported, such as  
+//    occasional naming conflicts for methods, since FX format 
+//    does not support any notions of name spaces. You need to 
+//    try to create workspaces in such a way as to minimize    
+//    potential naming conflicts on export.                    
+//    
+//  - Note that to minimize resulting name collisions in the FX 
+//    file, RenderMonkey will mangle names for passes, shaders  
+//    and function names as necessary to reduce name conflicts. 
+//**************************************************************//
+
+//--------------------------------------------------------------//
+// ShadowMoments
+//--------------------------------------------------------------//
+// turns the shadow map into blurred depth moments for variance shadow
+// mapping: mean depth and mean squared depth, each over a separable
+// 5x5 binomial kernel. drawn as a pre-transformed quad over the whole
+// atlas, so there is no vertex shader. every pixel stays within its
+// cascade's tile
+//--------------------------------------------------------------//
+
+texture ShadowMap_Tex;
+sampler2D ShadowSampler = sampler_state
+{
+	Texture = (ShadowMap_Tex);
+	MinFilter = Point;
+	MagFilter = Point;
+	MipFilter = None;
+	AddressU = Clamp;
+	AddressV = Clamp;
+};
+
+texture MomentBlur_Tex;
+sampler2D MomentBlurSampler = sampler_state
+{
+	Texture = (MomentBlur_Tex);
+	MinFilter = Point;
+	MagFilter = Point;
+	MipFilter = None;
+	AddressU = Clamp;
+	AddressV = Clamp;
+};
+
+// shadow map size in texels, and its inverse
+float2 gShadowMapSize = float2(2048, 1.0 / 2048);
+
+struct PS_INPUT
+{
+	float2 mUV : TEXCOORD0;
+};
+
+// the first and last texel centers of the tile the pixel is in
+void GetTileBounds(float2 uv, out float2 tileMin, out float2 tileMax)
+{
+	tileMin = floor(uv * 2) * 0.5f + 0.5f * gShadowMapSize.y;
+	tileMax = tileMin + 0.5f - gShadowMapSize.y;
+}
+
+float4 ShadowMoments_Horizontal_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	float2 tileMin, tileMax;
+	GetTileBounds(Input.mUV, tileMin, tileMax);
+
+	const float weights[5] = { 1.0 / 16, 4.0 / 16, 6.0 / 16, 4.0 / 16, 1.0 / 16 };
+
+	float2 moments = 0;
+	for (int i = 0; i < 5; ++i)
+	{
+		float2 uv = Input.mUV + float2((i - 2) * gShadowMapSize.y, 0);
+		float depth = tex2D(ShadowSampler, clamp(uv, tileMin, tileMax)).r;
+		moments += float2(depth, depth * depth) * weights[i];
+	}
+
+	return float4(moments, 0, 1);
+}
+
+float4 ShadowMoments_Vertical_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	float2 tileMin, tileMax;
+	GetTileBounds(Input.mUV, tileMin, tileMax);
+
+	const float weights[5] = { 1.0 / 16, 4.0 / 16, 6.0 / 16, 4.0 / 16, 1.0 / 16 };
+
+	float2 moments = 0;
+	for (int i = 0; i < 5; ++i)
+	{
+		float2 uv = Input.mUV + float2(0, (i - 2) * gShadowMapSize.y);
+		moments += tex2D(MomentBlurSampler, clamp(uv, tileMin, tileMax)).rg * weights[i];
+	}
+
+	return float4(moments, 0, 1);
+}
+
+//--------------------------------------------------------------//
+// Technique Section for ShadowMoments
+//--------------------------------------------------------------//
+technique ShadowMoments
+{
+	pass Horizontal
+	{
+		ZEnable = false;
+		VertexShader = NULL;
+		PixelShader = compile ps_2_0 ShadowMoments_Horizontal_Pixel_Shader_ps_main();
+	}
+
+	pass Vertical
+	{
+		ZEnable = false;
+		VertexShader = NULL;
+		PixelShader = compile ps_2_0 ShadowMoments_Vertical_Pixel_Shader_ps_main();
+	}
+}
+
@@ -61,12 +61,24 @@ sampler2D SceneSampler = sampler_state
 	Texture = (SceneTexture_Tex);
 };
 
-float4 ColorConversion_Grayscale_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+// the scene target only holds 8 bits per channel, so half precision
+// should stay within 1 LSB of float here and runs at partial precision
+// (_pp). P switches to the float version, M measures how far apart they are
+half4 ColorConversion_Grayscale_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
 {
-	float4 tex = tex2D(SceneSampler, Input.mUV);
+	half4 tex = tex2D(SceneSampler, Input.mUV);
 
 	//tex.rgb = (tex.r + tex.g + tex.b ) / 3;
 	//tex.rgb = tex.r * 0.3 + tex.g * 0.59 + tex.b * 0.11;
+	tex.rgb = dot(tex.rgb, half3(0.3, 0.59, 0.11));
+
+	return tex;
+}
+
+float4 ColorConversion_GrayscaleFloat_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	float4 tex = tex2D(SceneSampler, Input.mUV);
+
 	tex.rgb = dot(tex.rgb, float3(0.3, 0.59, 0.11));
 
 	return tex;
@@ -85,3 +97,14 @@ technique ColorConversion
 	}
 }
 
+technique ColorConversionFloat
+{
+	pass Grayscale
+	{
+		CULLMODE = NONE;
+
+		VertexShader = compile vs_2_0 ColorConversion_Grayscale_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 ColorConversion_GrayscaleFloat_Pixel_Shader_ps_main();
+	}
+}
+
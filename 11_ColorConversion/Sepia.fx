@@ -61,16 +61,33 @@ sampler2D SceneSampler = sampler_state
 	Texture = (SceneTexture_Tex);
 };
 
-float4 ColorConversion_Sepia_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+// computed in half precision: sepia of an 8-bit color should be off by
+// less than 1 LSB compared to float, and partial precision math is
+// cheaper. P switches to the float version, M measures how far apart
+// they are
+half4 ColorConversion_Sepia_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
 {
-	float4 tex = tex2D(SceneSampler, Input.mUV);
+	half4 tex = tex2D(SceneSampler, Input.mUV);
 
-	float4 sepia;
+	half4 sepia;
 	sepia.a = tex.a;
 	//sepia.r = tex.r * 0.393f + tex.g * 0.769f + tex.b * 0.189f;
 	//sepia.g = tex.g * 0.349f + tex.g * 0.686f + tex.b * 0.168f;
 	//sepia.b = tex.b * 0.272f + tex.g * 0.534f + tex.b * 0.131f;
 
+	sepia.r = dot(tex.rgb, half3(0.393f, 0.769f, 0.189f));
+	sepia.g = dot(tex.rgb, half3(0.349f, 0.686f, 0.168f));
+	sepia.b = dot(tex.rgb, half3(0.272f, 0.534f, 0.131f));
+
+	return sepia;
+}
+
+float4 ColorConversion_SepiaFloat_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	float4 tex = tex2D(SceneSampler, Input.mUV);
+
+	float4 sepia;
+	sepia.a = tex.a;
 	sepia.r = dot(tex.rgb, float3(0.393f, 0.769f, 0.189f));
 	sepia.g = dot(tex.rgb, float3(0.349f, 0.686f, 0.168f));
 	sepia.b = dot(tex.rgb, float3(0.272f, 0.534f, 0.131f));
@@ -91,3 +108,14 @@ technique ColorConversion
 	}
 }
 
+technique ColorConversionFloat
+{
+	pass Sepia
+	{
+		CULLMODE = NONE;
+
+		VertexShader = compile vs_2_0 ColorConversion_Sepia_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 ColorConversion_SepiaFloat_Pixel_Shader_ps_main();
+	}
+}
+
@@ -28,6 +28,11 @@
 LPDIRECT3D9             gpD3D = NULL;					// D3D
 LPDIRECT3DDEVICE9       gpD3DDevice = NULL;				// D3D device
 
+// the device type and vertex processing the device was made with. shown
+// on screen, so a run on the reference rasterizer or with software vertex
+// processing isn't taken for a hardware one
+char					gDeviceDescription[64] = "";
+
 // Fonts
 ID3DXFont*              gpFont = NULL;
 
@@ -72,6 +77,19 @@ LPDIRECT3DTEXTURE9		gpSceneRenderTarget = NULL;
 // index of postprocess shader to use
 int gPostProcessIndex = 0;
 
+// grayscale and sepia run in half precision unless switched to float
+bool gUseHalfPrecision = true;
+
+// half and float outputs of the current effect, and system memory copies
+// to compare them on the CPU. only done when asked, since it stalls
+LPDIRECT3DTEXTURE9		gpPrecisionTargets[2] = { NULL, NULL };
+LPDIRECT3DSURFACE9		gpPrecisionReadbacks[2] = { NULL, NULL };
+bool					gMeasurePrecision = false;
+
+// largest difference between half and float in 8-bit steps, for every
+// effect. negative while not measured
+int						gPrecisionError[3] = { -1, -1, -1 };
+
 //-----------------------------------------------------------------------
 // Program entry point/message loop
 //-----------------------------------------------------------------------
@@ -160,6 +178,12 @@ void ProcessInput(HWND hWnd, WPARAM keyPress)
 	case '3':
 		gPostProcessIndex = keyPress - '0' - 1;
 		break;
+	case 'P':
+		gUseHalfPrecision = !gUseHalfPrecision;
+		break;
+	case 'M':
+		gMeasurePrecision = true;
+		break;
 	}
 }
 
@@ -281,11 +305,6 @@ void RenderScene()
 	/////////////////////////
 	// 2. apply post-processing
 	/////////////////////////
-	// use hardware backbuffer
-	gpD3DDevice->SetRenderTarget(0, pHWBackBuffer);
-	pHWBackBuffer->Release();
-	pHWBackBuffer = NULL;
-
 	// post process effect to use
 	LPD3DXEFFECT effectToUse = gpNoEffect;
 	if (gPostProcessIndex == 1)
@@ -298,11 +317,38 @@ void RenderScene()
 	}
 
 	effectToUse->SetTexture("SceneTexture_Tex", gpSceneRenderTarget);
-	effectToUse->Begin(&numPasses, NULL);
+
+	if (gMeasurePrecision)
+	{
+		if (effectToUse != gpNoEffect)
+		{
+			MeasurePrecisionError(effectToUse, gPostProcessIndex);
+		}
+		gMeasurePrecision = false;
+	}
+
+	if (effectToUse != gpNoEffect)
+	{
+		effectToUse->SetTechnique(gUseHalfPrecision ? "ColorConversion" : "ColorConversionFloat");
+	}
+
+	// use hardware backbuffer
+	gpD3DDevice->SetRenderTarget(0, pHWBackBuffer);
+	pHWBackBuffer->Release();
+	pHWBackBuffer = NULL;
+
+	DrawFullScreenQuad(effectToUse);
+}
+
+// draw a fullscreen quad with every pass of an effect
+void DrawFullScreenQuad(LPD3DXEFFECT effect)
+{
+	UINT numPasses = 0;
+	effect->Begin(&numPasses, NULL);
 	{
 		for (UINT i = 0; i < numPasses; ++i)
 		{
-			effectToUse->BeginPass(i);
+			effect->BeginPass(i);
 			{
 				// draw a fullscreen quad
 				gpD3DDevice->SetStreamSource(0, gpFullscreenQuadVB, 0, sizeof(float)* 5);
@@ -310,11 +356,68 @@ void RenderScene()
 				gpD3DDevice->SetVertexDeclaration(gpFullscreenQuadDecl);
 				gpD3DDevice->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 6, 0, 2);
 			}
-			effectToUse->EndPass();
+			effect->EndPass();
+		}
+	}
+	effect->End();
+}
+
+// draw the scene through the half and the float technique of an effect,
+// read both back and keep the largest difference in 8-bit steps
+void MeasurePrecisionError(LPD3DXEFFECT effect, int effectIndex)
+{
+	const char * techniques[2] = { "ColorConversion", "ColorConversionFloat" };
+	for (int i = 0; i < 2; ++i)
+	{
+		LPDIRECT3DSURFACE9 pSurface = NULL;
+		if (FAILED(gpPrecisionTargets[i]->GetSurfaceLevel(0, &pSurface)))
+		{
+			return;
+		}
+
+		gpD3DDevice->SetRenderTarget(0, pSurface);
+		effect->SetTechnique(techniques[i]);
+		DrawFullScreenQuad(effect);
+
+		HRESULT hr = gpD3DDevice->GetRenderTargetData(pSurface, gpPrecisionReadbacks[i]);
+		pSurface->Release();
+		if (FAILED(hr))
+		{
+			return;
+		}
+	}
+
+	D3DLOCKED_RECT half;
+	D3DLOCKED_RECT full;
+	if (FAILED(gpPrecisionReadbacks[0]->LockRect(&half, NULL, D3DLOCK_READONLY)))
+	{
+		return;
+	}
+	if (FAILED(gpPrecisionReadbacks[1]->LockRect(&full, NULL, D3DLOCK_READONLY)))
+	{
+		gpPrecisionReadbacks[0]->UnlockRect();
+		return;
+	}
+
+	int maxError = 0;
+	for (int y = 0; y < WIN_HEIGHT; ++y)
+	{
+		DWORD * halfRow = (DWORD*)((BYTE*)half.pBits + y * half.Pitch);
+		DWORD * fullRow = (DWORD*)((BYTE*)full.pBits + y * full.Pitch);
+		for (int x = 0; x < WIN_WIDTH; ++x)
+		{
+			for (int shift = 0; shift < 24; shift += 8)
+			{
+				int difference = (int)((halfRow[x] >> shift) & 0xFF) - (int)((fullRow[x] >> shift) & 0xFF);
+				maxError = max(maxError, max(difference, -difference));
+			}
 		}
 	}
-	effectToUse->End();
 
+	gpPrecisionReadbacks[1]->UnlockRect();
+	gpPrecisionReadbacks[0]->UnlockRect();
+
+	gPrecisionError[effectIndex] = maxError;
 }
 
 // display debug info
@@ -328,10 +431,34 @@ void RenderInfo()
 	rct.left = 5;
 	rct.right = WIN_WIDTH / 3;
 	rct.top = 5;
-	rct.bottom = WIN_HEIGHT / 3;
+	rct.bottom = WIN_HEIGHT / 2;
 
 	// display debug key info
-	gpFont->DrawText(NULL, "Demo Framework\n\nESC: Exit\n1: Color\n2: Black and White\n3: Sepia", -1, &rct, 0, fontColor);
+	gpFont->DrawText(NULL, "Demo Framework\n\nESC: Exit\n1: Color\n2: Black and White\n3: Sepia\nP: Precision\nM: Measure Error", -1, &rct, 0, fontColor);
+
+	// precision in use, and how far half is from float for every effect
+	// measured so far
+	const char * effectNames[3] = { "Color", "Black and White", "Sepia" };
+	char text[256];
+	int length = sprintf(text, "Precision: %s", gUseHalfPrecision ? "half" : "float");
+	for (int i = 1; i < 3; ++i)
+	{
+		if (gPrecisionError[i] >= 0)
+		{
+			length += sprintf(text + length, "\n%s: half is %d steps off", effectNames[i], gPrecisionError[i]);
+		}
+	}
+
+	rct.left = WIN_WIDTH * 2 / 3;
+	rct.right = WIN_WIDTH - 5;
+	gpFont->DrawText(NULL, text, -1, &rct, 0, fontColor);
+
+	// the device in use, at the bottom
+	rct.left = WIN_WIDTH / 3;
+	rct.right = WIN_WIDTH * 2 / 3;
+	rct.top = WIN_HEIGHT - 30;
+	rct.bottom = WIN_HEIGHT - 5;
+	gpFont->DrawText(NULL, gDeviceDescription, -1, &rct, 0, fontColor);
 }
 
 //------------------------------------------------------------
@@ -356,6 +483,19 @@ bool InitEverything(HWND hWnd)
 		return false;
 	}
 
+	// targets for comparing half and float precision
+	for (int i = 0; i < 2; ++i)
+	{
+		if (FAILED(gpD3DDevice->CreateTexture(WIN_WIDTH, WIN_HEIGHT,
+			1, D3DUSAGE_RENDERTARGET, D3DFMT_X8R8G8B8,
+			D3DPOOL_DEFAULT, &gpPrecisionTargets[i], NULL))
+			|| FAILED(gpD3DDevice->CreateOffscreenPlainSurface(WIN_WIDTH, WIN_HEIGHT,
+			D3DFMT_X8R8G8B8, D3DPOOL_SYSTEMMEM, &gpPrecisionReadbacks[i], NULL)))
+		{
+			return false;
+		}
+	}
+
 	// loading models, shaders and textures
 	if (!LoadAssets())
 	{
@@ -402,14 +542,50 @@ bool InitD3D(HWND hWnd)
 	d3dpp.FullScreen_RefreshRateInHz = 0;
 	d3dpp.PresentationInterval = D3DPRESENT_INTERVAL_ONE;
 
+	// decide where the vs_2_0/ps_2_0 shaders get executed. without
+	// vertex shader 2.0 hardware, the runtime's software vertex processing
+	// runs them on the CPU. without ps_2_0 this falls back to the
+	// reference rasterizer, which is only installed with the DirectX SDK
+	// and takes seconds per frame. either way the choice is reported
+	D3DDEVTYPE deviceType = D3DDEVTYPE_HAL;
+	DWORD vertexProcessing = D3DCREATE_HARDWARE_VERTEXPROCESSING;
+
+	D3DCAPS9 caps;
+	if (FAILED(gpD3D->GetDeviceCaps(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, &caps))
+		|| caps.PixelShaderVersion < D3DPS_VERSION(2, 0))
+	{
+		deviceType = D3DDEVTYPE_REF;
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+	}
+	else if (!(caps.DevCaps & D3DDEVCAPS_HWTRANSFORMANDLIGHT)
+		|| caps.VertexShaderVersion < D3DVS_VERSION(2, 0))
+	{
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+	}
+
 	// create a D3D device
-	if (FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, hWnd,
-		D3DCREATE_HARDWARE_VERTEXPROCESSING,
+	if (FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, deviceType, hWnd,
+		vertexProcessing,
 		&d3dpp, &gpD3DDevice)))
 	{
-		return false;
+		// hardware vertex processing can still be refused (e.g. out of
+		// video memory), so try once more with software vertex processing
+		if (vertexProcessing == D3DCREATE_SOFTWARE_VERTEXPROCESSING
+			|| FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, deviceType, hWnd,
+			D3DCREATE_SOFTWARE_VERTEXPROCESSING,
+			&d3dpp, &gpD3DDevice)))
+		{
+			return false;
+		}
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
 	}
 
+	sprintf(gDeviceDescription, "Device: %s, %s VP",
+		(deviceType == D3DDEVTYPE_REF) ? "REF" : "HAL",
+		(vertexProcessing == D3DCREATE_SOFTWARE_VERTEXPROCESSING) ? "SW" : "HW");
+	OutputDebugString(gDeviceDescription);
+	OutputDebugString("\n");
+
 	return true;
 }
 
@@ -485,6 +661,17 @@ LPD3DXEFFECT LoadShader(const char * filename)
 
 #if _DEBUG
 	dwShaderFlags |= D3DXSHADER_DEBUG;
+#else
+	// release builds use the effect precompiled by fxc at build time
+	// (custom build step in the project), so HLSL isn't parsed and
+	// compiled on every launch. fall back to the source if it's missing
+	char compiledFilename[MAX_PATH];
+	_snprintf(compiledFilename, MAX_PATH, "%so", filename);
+	compiledFilename[MAX_PATH - 1] = '\0';
+	if (GetFileAttributes(compiledFilename) != INVALID_FILE_ATTRIBUTES)
+	{
+		filename = compiledFilename;
+	}
 #endif
 
 	D3DXCreateEffectFromFile(gpD3DDevice, filename,
@@ -632,6 +819,21 @@ void Cleanup()
 		gpSceneRenderTarget = NULL;
 	}
 
+	for (int i = 0; i < 2; ++i)
+	{
+		if (gpPrecisionTargets[i])
+		{
+			gpPrecisionTargets[i]->Release();
+			gpPrecisionTargets[i] = NULL;
+		}
+
+		if (gpPrecisionReadbacks[i])
+		{
+			gpPrecisionReadbacks[i]->Release();
+			gpPrecisionReadbacks[i] = NULL;
+		}
+	}
+
 	// release D3D
 	if (gpD3DDevice)
 	{
@@ -685,22 +887,29 @@ void InitFullScreenQuad()
 
 	gpD3DDevice->CreateVertexDeclaration(vtxDesc, &gpFullscreenQuadDecl);
 
+	// D3D9 puts pixel centers on integer coordinates, so the quad is moved
+	// by half a pixel (1/size in clip space) to line texels up with pixels.
+	// otherwise every tap lands on a texel corner and gets rounded to
+	// either neighbor, which shifts the image and the 3x3 filters
+	float halfPixelX = 1.0f / WIN_WIDTH;
+	float halfPixelY = 1.0f / WIN_HEIGHT;
+
 	// create a vertex buffer
 	gpD3DDevice->CreateVertexBuffer(offset * 4, 0, 0, D3DPOOL_MANAGED, &gpFullscreenQuadVB, NULL);
 	void * vertexData = NULL;
 	gpFullscreenQuadVB->Lock(0, 0, &vertexData, 0);
 	{
 		float * data = (float*)vertexData;
-		*data++ = -1.0f;	*data++ = 1.0f;		*data++ = 0.0f;
+		*data++ = -1.0f - halfPixelX;	*data++ = 1.0f + halfPixelY;	*data++ = 0.0f;
 		*data++ = 0.0f;		*data++ = 0.0f;
 
-		*data++ = 1.0f;		*data++ = 1.0f;		*data++ = 0.0f;
+		*data++ = 1.0f - halfPixelX;	*data++ = 1.0f + halfPixelY;	*data++ = 0.0f;
 		*data++ = 1.0f;		*data++ = 0;
 
-		*data++ = 1.0f;		*data++ = -1.0f;	*data++ = 0.0f;
+		*data++ = 1.0f - halfPixelX;	*data++ = -1.0f + halfPixelY;	*data++ = 0.0f;
 		*data++ = 1.0f;		*data++ = 1.0f;
 
-		*data++ = -1.0f;	*data++ = -1.0f;	*data++ = 0.0f;
+		*data++ = -1.0f - halfPixelX;	*data++ = -1.0f + halfPixelY;	*data++ = 0.0f;
 		*data++ = 0.0f;		*data++ = 1.0f;
 	}
 	gpFullscreenQuadVB->Unlock();
@@ -42,6 +42,8 @@ void Update();
 void RenderFrame();
 void RenderScene();
 void RenderInfo();
+void DrawFullScreenQuad(LPD3DXEFFECT effect);
+void MeasurePrecisionError(LPD3DXEFFECT effect, int effectIndex);
 
 // cleanup related
 void Cleanup();
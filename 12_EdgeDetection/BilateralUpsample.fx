@@ -0,0 +1,140 @@
+//**************************************************************//
+//  Effect File exported by RenderMonkey 1.6
+//
+//  - Although many improvements were made to RenderMonkey FX  
+//    file export, there are still situations that may cause   
+//    compilation problems once the file is exported, such as  
+//    occasional naming conflicts for methods, since FX format 
+//    does not support any notions of name spaces. You need to 
+//    try to create workspaces in such a way as to minimize    
+//    potential naming conflicts on export.                    
+//    
+//  - Note that to minimize resulting name collisions in the FX 
+//    file, RenderMonkey will mangle names for passes, shaders  
+//    and function names as necessary to reduce name conflicts. 
+//**************************************************************//
+
+//--------------------------------------------------------------//
+// EdgeDetection
+//--------------------------------------------------------------//
+//--------------------------------------------------------------//
+// BilateralUpsample
+//--------------------------------------------------------------//
+string EdgeDetection_BilateralUpsample_ScreenAlignedQuad : ModelData = "..\\..\\..\\..\\..\\..\\..\\..\\Program Files (x86)\\AMD\\RenderMonkey 1.82\\Examples\\Media\\Models\\ScreenAlignedQuad.3ds";
+
+struct VS_INPUT
+{
+	float4 mPosition: POSITION;
+	float2 mUV : TEXCOORD0;
+};
+
+
+struct VS_OUTPUT
+{
+	float4 mPosition: POSITION;
+	float2 mUV : TEXCOORD0;
+};
+
+
+VS_OUTPUT EdgeDetection_BilateralUpsample_Vertex_Shader_vs_main(VS_INPUT Input)
+{
+	VS_OUTPUT Output;
+
+	Output.mPosition = Input.mPosition;
+	Output.mUV = Input.mUV;
+
+	return Output;
+}
+
+
+struct PS_INPUT
+{
+	float2 mUV : TEXCOORD0;
+};
+
+// full resolution input of the filter
+texture SceneTexture_Tex
+<
+	string ResourceName = ".\\";
+>;
+sampler2D SceneSampler = sampler_state
+{
+	Texture = (SceneTexture_Tex);
+	MAGFILTER = POINT;
+	MINFILTER = POINT;
+	ADDRESSU = CLAMP;
+	ADDRESSV = CLAMP;
+};
+
+// the filter evaluated at half resolution. texel k holds the result at
+// full resolution texel 2k
+texture LowResTexture_Tex
+<
+	string ResourceName = ".\\";
+>;
+sampler2D LowResSampler = sampler_state
+{
+	Texture = (LowResTexture_Tex);
+	MAGFILTER = POINT;
+	MINFILTER = POINT;
+	ADDRESSU = CLAMP;
+	ADDRESSV = CLAMP;
+};
+
+// 1 / full resolution
+float2 gPixelOffset : ViewportDimensionsInverse;
+
+// same weights the filter used
+float3 gLuminanceWeights = float3(0.3, 0.59, 0.11);
+
+// 1 / (2 * sigma^2) of the luminance difference falloff
+float gLuminanceSharpness = 50;
+
+float Luminance(float2 uv)
+{
+	return dot(tex2D(SceneSampler, uv).rgb, gLuminanceWeights);
+}
+
+// bilinear upsample where each of the four low resolution samples is also
+// weighted by how close its luminance is to this pixel's. samples across
+// an edge in the scene barely contribute, so edges stay sharp
+float4 EdgeDetection_BilateralUpsample_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	float2 lowPosition = (Input.mUV / gPixelOffset - 0.5) * 0.5;
+	float2 base = floor(lowPosition);
+	float2 f = lowPosition - base;
+
+	float2 lowUV = (base + 0.5) * 2 * gPixelOffset;
+	float2 sceneUV = (base * 2 + 0.5) * gPixelOffset;
+	float2 step = 2 * gPixelOffset;
+
+	float4 keys = float4(Luminance(sceneUV),
+		Luminance(sceneUV + float2(step.x, 0)),
+		Luminance(sceneUV + float2(0, step.y)),
+		Luminance(sceneUV + step));
+	float4 difference = keys - Luminance(Input.mUV);
+
+	float4 weights = float4((1 - f.x) * (1 - f.y), f.x * (1 - f.y), (1 - f.x) * f.y, f.x * f.y);
+	weights *= exp(-difference * difference * gLuminanceSharpness) + 0.001;
+
+	float3 color = tex2D(LowResSampler, lowUV).rgb * weights.x
+		+ tex2D(LowResSampler, lowUV + float2(step.x, 0)).rgb * weights.y
+		+ tex2D(LowResSampler, lowUV + float2(0, step.y)).rgb * weights.z
+		+ tex2D(LowResSampler, lowUV + step).rgb * weights.w;
+
+	return float4(color / dot(weights, 1), 1);
+}
+//--------------------------------------------------------------//
+// Technique Section for EdgeDetection
+//--------------------------------------------------------------//
+technique EdgeDetection
+{
+	pass BilateralUpsample
+	{
+		CULLMODE = NONE;
+
+		VertexShader = compile vs_2_0 EdgeDetection_BilateralUpsample_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 EdgeDetection_BilateralUpsample_Pixel_Shader_ps_main();
+	}
+}
+
@@ -0,0 +1,221 @@
+//**************************************************************//
+//  Effect File exported by RenderMonkey 1.6
+//
+//  - Although many improvements were made to RenderMonkey FX  
+//    file export, there are still situations that may cause   
+//    compilation problems once the file is exported, such as  
+//    occasional naming conflicts for methods, since FX format 
+//    does not support any notions of name spaces. You need to 
+//    try to create workspaces in such a way as to minimize    
+//    potential naming conflicts on export.                    
+//    
+//  - Note that to minimize resulting name collisions in the FX 
+//    file, RenderMonkey will mangle names for passes, shaders  
+//    and function names as necessary to reduce name conflicts. 
+//**************************************************************//
+
+//--------------------------------------------------------------//
+// EdgeDetection
+//--------------------------------------------------------------//
+//--------------------------------------------------------------//
+// Bloom
+//--------------------------------------------------------------//
+string EdgeDetection_Bloom_ScreenAlignedQuad : ModelData = "..\\..\\..\\..\\..\\..\\..\\..\\Program Files (x86)\\AMD\\RenderMonkey 1.82\\Examples\\Media\\Models\\ScreenAlignedQuad.3ds";
+
+struct VS_INPUT
+{
+	float4 mPosition: POSITION;
+	float2 mUV : TEXCOORD0;
+};
+
+
+struct VS_OUTPUT
+{
+	float4 mPosition: POSITION;
+	float2 mUV : TEXCOORD0;
+};
+
+
+VS_OUTPUT EdgeDetection_Bloom_Vertex_Shader_vs_main(VS_INPUT Input)
+{
+	VS_OUTPUT Output;
+
+	Output.mPosition = Input.mPosition;
+	Output.mUV = Input.mUV;
+
+	return Output;
+}
+
+
+struct PS_INPUT
+{
+	float2 mUV : TEXCOORD0;
+};
+
+// full resolution input
+texture SceneTexture_Tex
+<
+	string ResourceName = ".\\";
+>;
+sampler2D SceneSampler = sampler_state
+{
+	Texture = (SceneTexture_Tex);
+	MAGFILTER = LINEAR;
+	MINFILTER = LINEAR;
+	ADDRESSU = CLAMP;
+	ADDRESSV = CLAMP;
+};
+
+// one level of the bloom chain. every tap is bilinear, so one fetch
+// averages up to four texels
+texture BloomTexture_Tex
+<
+	string ResourceName = ".\\";
+>;
+sampler2D BloomSampler = sampler_state
+{
+	Texture = (BloomTexture_Tex);
+	MAGFILTER = LINEAR;
+	MINFILTER = LINEAR;
+	ADDRESSU = CLAMP;
+	ADDRESSV = CLAMP;
+};
+
+// color conversions before bloom, and after it
+float3x3 gInputColorMatrix = { 1, 0, 0,
+							   0, 1, 0,
+							   0, 0, 1 };
+float3x3 gOutputColorMatrix = { 1, 0, 0,
+								0, 1, 0,
+								0, 0, 1 };
+
+float3 gLuminanceWeights = float3(0.3, 0.59, 0.11);
+
+// only luminance above this blooms
+float gBloomThreshold = 0.7;
+float gBloomIntensity = 1.0;
+
+// 1 / size of the texture being read
+float2 gTexelSize;
+
+// 1 / size along the blur direction, 0 along the other
+float2 gBlurDirection;
+
+// 9-tap Gaussian folded into 5 bilinear taps: the center, then two
+// neighboring texels per tap, placed between them by their weights
+float gBlurWeights[3];
+float gBlurOffsets[3];
+
+// downsample to half resolution (one bilinear tap averages the 2x2
+// block) and keep the part brighter than the threshold
+float4 EdgeDetection_BrightPass_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	float3 color = mul(tex2D(SceneSampler, Input.mUV).rgb, gInputColorMatrix);
+
+	float brightness = dot(color, gLuminanceWeights);
+	color *= saturate(brightness - gBloomThreshold) / max(brightness, 0.0001);
+
+	return float4(color, 1);
+}
+
+// 4x4 box from four bilinear taps, so small highlights don't flicker
+// as they move between texels
+float4 EdgeDetection_Downsample_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	float3 color = tex2D(BloomSampler, Input.mUV + float2(-gTexelSize.x, -gTexelSize.y)).rgb
+		+ tex2D(BloomSampler, Input.mUV + float2(gTexelSize.x, -gTexelSize.y)).rgb
+		+ tex2D(BloomSampler, Input.mUV + float2(-gTexelSize.x, gTexelSize.y)).rgb
+		+ tex2D(BloomSampler, Input.mUV + float2(gTexelSize.x, gTexelSize.y)).rgb;
+
+	return float4(color * 0.25, 1);
+}
+
+// one direction of the separable Gaussian
+float4 EdgeDetection_Blur_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	float3 color = tex2D(BloomSampler, Input.mUV).rgb * gBlurWeights[0];
+	for (int i = 1; i < 3; ++i)
+	{
+		float2 offset = gBlurDirection * gBlurOffsets[i];
+		color += (tex2D(BloomSampler, Input.mUV + offset).rgb
+			+ tex2D(BloomSampler, Input.mUV - offset).rgb) * gBlurWeights[i];
+	}
+
+	return float4(color, 1);
+}
+
+// bilinear upsample of the next smaller level. added to the target by
+// the blend state
+float4 EdgeDetection_Upsample_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	return float4(tex2D(BloomSampler, Input.mUV).rgb, 1);
+}
+
+float4 EdgeDetection_Composite_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	float3 color = mul(tex2D(SceneSampler, Input.mUV).rgb, gInputColorMatrix);
+	color += tex2D(BloomSampler, Input.mUV).rgb * gBloomIntensity;
+
+	return float4(mul(saturate(color), gOutputColorMatrix), 1);
+}
+//--------------------------------------------------------------//
+// Technique Section for Bloom
+//--------------------------------------------------------------//
+technique BrightPass
+{
+	pass BrightPass
+	{
+		CULLMODE = NONE;
+
+		VertexShader = compile vs_2_0 EdgeDetection_Bloom_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 EdgeDetection_BrightPass_Pixel_Shader_ps_main();
+	}
+}
+
+technique Downsample
+{
+	pass Downsample
+	{
+		CULLMODE = NONE;
+
+		VertexShader = compile vs_2_0 EdgeDetection_Bloom_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 EdgeDetection_Downsample_Pixel_Shader_ps_main();
+	}
+}
+
+technique Blur
+{
+	pass Blur
+	{
+		CULLMODE = NONE;
+
+		VertexShader = compile vs_2_0 EdgeDetection_Bloom_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 EdgeDetection_Blur_Pixel_Shader_ps_main();
+	}
+}
+
+technique Upsample
+{
+	pass Upsample
+	{
+		CULLMODE = NONE;
+		ALPHABLENDENABLE = TRUE;
+		SRCBLEND = ONE;
+		DESTBLEND = ONE;
+
+		VertexShader = compile vs_2_0 EdgeDetection_Bloom_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 EdgeDetection_Upsample_Pixel_Shader_ps_main();
+	}
+}
+
+technique Composite
+{
+	pass Composite
+	{
+		CULLMODE = NONE;
+
+		VertexShader = compile vs_2_0 EdgeDetection_Bloom_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 EdgeDetection_Composite_Pixel_Shader_ps_main();
+	}
+}
+
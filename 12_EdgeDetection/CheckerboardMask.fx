@@ -0,0 +1,87 @@
+//**************************************************************//
+//  Effect File exported by RenderMonkey 1.6
+//
+//  - Although many improvements were made to RenderMonkey FX  
+//    file export, there are still situations that may cause   
+//    compilation problems once the file is exported, such as  
+//    occasional naming conflicts for methods, since FX format 
+//    does not support any notions of name spaces. You need to 
+//    try to create workspaces in such a way as to minimize    
+//    potential naming conflicts on export.                    
+//    
+//  - Note that to minimize resulting name collisions in the FX 
+//    file, RenderMonkey will mangle names for passes, shaders  
+//    and function names as necessary to reduce name conflicts. 
+//**************************************************************//
+
+//--------------------------------------------------------------//
+// EdgeDetection
+//--------------------------------------------------------------//
+//--------------------------------------------------------------//
+// CheckerboardMask
+//--------------------------------------------------------------//
+string EdgeDetection_CheckerboardMask_ScreenAlignedQuad : ModelData = "..\\..\\..\\..\\..\\..\\..\\..\\Program Files (x86)\\AMD\\RenderMonkey 1.82\\Examples\\Media\\Models\\ScreenAlignedQuad.3ds";
+
+struct VS_INPUT
+{
+	float4 mPosition: POSITION;
+	float2 mUV : TEXCOORD0;
+};
+
+
+struct VS_OUTPUT
+{
+	float4 mPosition: POSITION;
+	float2 mUV : TEXCOORD0;
+};
+
+
+VS_OUTPUT EdgeDetection_CheckerboardMask_Vertex_Shader_vs_main(VS_INPUT Input)
+{
+	VS_OUTPUT Output;
+
+	Output.mPosition = Input.mPosition;
+	Output.mUV = Input.mUV;
+
+	return Output;
+}
+
+
+struct PS_INPUT
+{
+	float2 mUV : TEXCOORD0;
+};
+
+float2 gPixelOffset : ViewportDimensionsInverse;
+
+// 0 or 1, flipped every frame
+float gCheckerboardParity;
+
+// only writes depth, on every other pixel. the filter drawn after it
+// fails the depth test there, so early-Z skips those pixels and they
+// keep what the filter wrote in the previous frame
+float4 EdgeDetection_CheckerboardMask_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	float2 pixel = floor(Input.mUV / gPixelOffset);
+	clip(frac((pixel.x + pixel.y + gCheckerboardParity) * 0.5) - 0.25);
+
+	return 0;
+}
+//--------------------------------------------------------------//
+// Technique Section for EdgeDetection
+//--------------------------------------------------------------//
+technique EdgeDetection
+{
+	pass CheckerboardMask
+	{
+		CULLMODE = NONE;
+		ZENABLE = TRUE;
+		ZWRITEENABLE = TRUE;
+		ZFUNC = ALWAYS;
+		COLORWRITEENABLE = 0;
+
+		VertexShader = compile vs_2_0 EdgeDetection_CheckerboardMask_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 EdgeDetection_CheckerboardMask_Pixel_Shader_ps_main();
+	}
+}
+
@@ -0,0 +1,113 @@
+//**************************************************************//
+//  Effect File exported by RenderMonkey 1.6
+//
+//  - Although many improvements were made to RenderMonkey FX  
+//    file export, there are still situations that may cause   
+//    compilation problems once the file is exported, such as  
+//    occasional naming conflicts for methods, since FX format 
+//    does not support any notions of name spaces. You need to 
+//    try to create workspaces in such a way as to minimize    
+//    potential naming conflicts on export.                    
+//    
+//  - Note that to minimize resulting name collisions in the FX 
+//    file, RenderMonkey will mangle names for passes, shaders  
+//    and function names as necessary to reduce name conflicts. 
+//**************************************************************//
+
+//--------------------------------------------------------------//
+// EdgeDetection
+//--------------------------------------------------------------//
+//--------------------------------------------------------------//
+// CheckerboardResolve
+//--------------------------------------------------------------//
+string EdgeDetection_CheckerboardResolve_ScreenAlignedQuad : ModelData = "..\\..\\..\\..\\..\\..\\..\\..\\Program Files (x86)\\AMD\\RenderMonkey 1.82\\Examples\\Media\\Models\\ScreenAlignedQuad.3ds";
+
+struct VS_INPUT
+{
+	float4 mPosition: POSITION;
+	float2 mUV : TEXCOORD0;
+};
+
+
+struct VS_OUTPUT
+{
+	float4 mPosition: POSITION;
+	float2 mUV : TEXCOORD0;
+};
+
+
+VS_OUTPUT EdgeDetection_CheckerboardResolve_Vertex_Shader_vs_main(VS_INPUT Input)
+{
+	VS_OUTPUT Output;
+
+	Output.mPosition = Input.mPosition;
+	Output.mUV = Input.mUV;
+
+	return Output;
+}
+
+
+struct PS_INPUT
+{
+	float2 mUV : TEXCOORD0;
+};
+
+texture HistoryTexture_Tex
+<
+	string ResourceName = ".\\";
+>;
+sampler2D HistorySampler = sampler_state
+{
+	Texture = (HistoryTexture_Tex);
+	MAGFILTER = POINT;
+	MINFILTER = POINT;
+	ADDRESSU = CLAMP;
+	ADDRESSV = CLAMP;
+};
+
+float2 gPixelOffset : ViewportDimensionsInverse;
+
+// 0 or 1, same as CheckerboardMask.fx this frame
+float gCheckerboardParity;
+
+// 0 when the history's other half isn't last frame's result of the same
+// chain. every pixel was filtered this frame then
+float gIsHistoryValid = 1;
+
+// the pixels the filter skipped this frame hold last frame's result,
+// which doesn't know about anything that moved since. their four
+// neighbors are all fresh, so the old value is clamped to the range of
+// theirs. an old value inside it is kept, one that's left behind by a
+// moving edge snaps to its surroundings
+float4 EdgeDetection_CheckerboardResolve_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	float4 center = tex2D(HistorySampler, Input.mUV);
+
+	float2 pixel = floor(Input.mUV / gPixelOffset);
+	float isStale = (frac((pixel.x + pixel.y + gCheckerboardParity) * 0.5) < 0.25) * gIsHistoryValid;
+
+	float4 left = tex2D(HistorySampler, Input.mUV - float2(gPixelOffset.x, 0));
+	float4 right = tex2D(HistorySampler, Input.mUV + float2(gPixelOffset.x, 0));
+	float4 top = tex2D(HistorySampler, Input.mUV - float2(0, gPixelOffset.y));
+	float4 bottom = tex2D(HistorySampler, Input.mUV + float2(0, gPixelOffset.y));
+
+	float4 neighborMin = min(min(left, right), min(top, bottom));
+	float4 neighborMax = max(max(left, right), max(top, bottom));
+
+	return lerp(center, clamp(center, neighborMin, neighborMax), isStale);
+}
+//--------------------------------------------------------------//
+// Technique Section for EdgeDetection
+//--------------------------------------------------------------//
+technique EdgeDetection
+{
+	pass CheckerboardResolve
+	{
+		CULLMODE = NONE;
+		ZENABLE = FALSE;
+
+		VertexShader = compile vs_2_0 EdgeDetection_CheckerboardResolve_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 EdgeDetection_CheckerboardResolve_Pixel_Shader_ps_main();
+	}
+}
+
@@ -0,0 +1,107 @@
+//**************************************************************//
+//  Effect File exported by RenderMonkey 1.6
+//
+//  - Although many improvements were made to RenderMonkey FX  
+//    file export, there are still situations that may cause   
+//    compilation problems once the file is exported, such as  
+//    occasional naming conflicts for methods, since FX format 
+//    does not support any notions of name spaces. You need to 
+//    try to create workspaces in such a way as to minimize    
+//    potential naming conflicts on export.                    
+//    
+//  - Note that to minimize resulting name collisions in the FX 
+//    file, RenderMonkey will mangle names for passes, shaders  
+//    and function names as necessary to reduce name conflicts. 
+//**************************************************************//
+
+//--------------------------------------------------------------//
+// ColorConversion
+//--------------------------------------------------------------//
+//--------------------------------------------------------------//
+// ColorGrading
+//--------------------------------------------------------------//
+string ColorConversion_ColorGrading_ScreenAlignedQuad : ModelData = "..\\..\\..\\..\\..\\..\\..\\..\\Program Files (x86)\\AMD\\RenderMonkey 1.82\\Examples\\Media\\Models\\ScreenAlignedQuad.3ds";
+
+struct VS_INPUT
+{
+	float4 mPosition: POSITION;
+	float2 mUV : TEXCOORD0;
+};
+
+
+struct VS_OUTPUT
+{
+	float4 mPosition: POSITION;
+	float2 mUV : TEXCOORD0;
+};
+
+
+VS_OUTPUT ColorConversion_ColorGrading_Vertex_Shader_vs_main(VS_INPUT Input)
+{
+	VS_OUTPUT Output;
+
+	Output.mPosition = Input.mPosition;
+	Output.mUV = Input.mUV;
+
+	return Output;
+}
+
+
+struct PS_INPUT
+{
+	float2 mUV : TEXCOORD0;
+};
+
+texture SceneTexture_Tex
+<
+	string ResourceName = ".\\";
+>;
+sampler2D SceneSampler = sampler_state
+{
+	Texture = (SceneTexture_Tex);
+};
+
+// the whole chain of color conversions (grayscale, sepia...) baked into a
+// lookup table on the CPU, so grading costs one fetch however many
+// conversions are stacked
+texture ColorGradingLUT_Tex
+<
+	string ResourceName = ".\\";
+>;
+sampler3D ColorGradingSampler = sampler_state
+{
+	Texture = (ColorGradingLUT_Tex);
+	MAGFILTER = LINEAR;
+	MINFILTER = LINEAR;
+	MIPFILTER = NONE;
+	ADDRESSU = CLAMP;
+	ADDRESSV = CLAMP;
+	ADDRESSW = CLAMP;
+};
+
+// maps [0, 1] onto the centers of the first and last LUT texels
+float2 gLUTScaleOffset;
+
+half4 ColorConversion_ColorGrading_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+{
+	half4 tex = tex2D(SceneSampler, Input.mUV);
+
+	float3 lutUV = tex.rgb * gLUTScaleOffset.x + gLUTScaleOffset.y;
+	tex.rgb = tex3D(ColorGradingSampler, lutUV).rgb;
+
+	return tex;
+}
+//--------------------------------------------------------------//
+// Technique Section for ColorConversion
+//--------------------------------------------------------------//
+technique ColorConversion
+{
+	pass ColorGrading
+	{
+		CULLMODE = NONE;
+
+		VertexShader = compile vs_2_0 ColorConversion_ColorGrading_Vertex_Shader_vs_main();
+		PixelShader = compile ps_2_0 ColorConversion_ColorGrading_Pixel_Shader_ps_main();
+	}
+}
+
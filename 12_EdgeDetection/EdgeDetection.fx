@@ -28,25 +28,35 @@ struct VS_INPUT
 	float2 mUV : TEXCOORD0;
 };
 
+// UVs of the neighbors, two per interpolator. computing them per vertex
+// keeps the texture reads in the pixel shader non-dependent
 struct VS_OUTPUT
 {
 	float4 mPosition: POSITION;
-	float2 mUV : TEXCOORD0;
+	float4 mNeighborUV[4] : TEXCOORD0;
 };
 
+float2 gPixelOffset : ViewportDimensionsInverse;
+
 VS_OUTPUT EdgeDetection_EdgeDetection_Vertex_Shader_vs_main(VS_INPUT Input)
 {
 	VS_OUTPUT Output;
 
 	Output.mPosition = Input.mPosition;
-	Output.mUV = Input.mUV;
+
+	float2 dx = float2(gPixelOffset.x, 0);
+	float2 dy = float2(0, gPixelOffset.y);
+	Output.mNeighborUV[0] = float4(Input.mUV - dx - dy, Input.mUV - dy);
+	Output.mNeighborUV[1] = float4(Input.mUV + dx - dy, Input.mUV - dx);
+	Output.mNeighborUV[2] = float4(Input.mUV + dx, Input.mUV - dx + dy);
+	Output.mNeighborUV[3] = float4(Input.mUV + dy, Input.mUV + dx + dy);
 
 	return Output;
 }
 
 struct PS_INPUT
 {
-	float2 mUV : TEXCOORD0;
+	float4 mNeighborUV[4] : TEXCOORD0;
 };
 
 texture SceneTexture_Tex
@@ -56,38 +66,52 @@ texture SceneTexture_Tex
 sampler2D SceneSampler = sampler_state
 {
 	Texture = (SceneTexture_Tex);
+	MAGFILTER = POINT;
+	MINFILTER = POINT;
+	// the one-pixel halo around the screen repeats the border pixels.
+	// wrapping would pull in the opposite edge and draw a false edge
+	ADDRESSU = CLAMP;
+	ADDRESSV = CLAMP;
 };
 
-float3x3 Kx = { -1, 0, 1,
-				-2, 0, 2,
-				-1, 0, 1 };
+// color conversions before this filter only change how luminance is
+// computed, so they are folded into these weights instead of a pass
+float3 gLuminanceWeights = float3(0.3, 0.59, 0.11);
 
-float3x3 Ky = { 1, 2, 1,
-				0, 0, 0,
-				-1, -2, -1 };
+// color conversions after this filter
+float3x3 gOutputColorMatrix = { 1, 0, 0,
+								0, 1, 0,
+								0, 0, 1 };
 
-float2 gPixelOffset : ViewportDimensionsInverse;
+float Luminance(float2 uv)
+{
+	return dot(tex2D(SceneSampler, uv).rgb, gLuminanceWeights);
+}
 
+// Sobel kernels
+//   Kx = { -1, 0, 1,    Ky = {  1,  2,  1,
+//          -2, 0, 2,            0,  0,  0,
+//          -1, 0, 1 }          -1, -2, -1 }
+// are separable into a [1 2 1] smoothing and a [-1 0 1] difference. the
+// center is weighted by 0 in both, so only 8 neighbors are read
 float4 EdgeDetection_EdgeDetection_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
 {
-	float Lx = 0;
-	float Ly = 0;
-
-	for (int y = -1; y <= 1; ++y)
-	{
-		for (int x = -1; x <= 1; ++x)
-		{
-			float2 offset = float2(x, y) * gPixelOffset;
-			float3 tex = tex2D(SceneSampler, Input.mUV + offset).rgb;
-			float luminance = dot(tex, float3(0.3, 0.59, 0.11));
-
-			Lx += luminance * Kx[y + 1][x + 1];
-			Ly += luminance * Ky[y + 1][x + 1];
-		}
-	}
+	float topLeft = Luminance(Input.mNeighborUV[0].xy);
+	float top = Luminance(Input.mNeighborUV[0].zw);
+	float topRight = Luminance(Input.mNeighborUV[1].xy);
+	float left = Luminance(Input.mNeighborUV[1].zw);
+	float right = Luminance(Input.mNeighborUV[2].xy);
+	float bottomLeft = Luminance(Input.mNeighborUV[2].zw);
+	float bottom = Luminance(Input.mNeighborUV[3].xy);
+	float bottomRight = Luminance(Input.mNeighborUV[3].zw);
+
+	float Lx = (topRight + 2 * right + bottomRight) - (topLeft + 2 * left + bottomLeft);
+	float Ly = (topLeft + 2 * top + topRight) - (bottomLeft + 2 * bottom + bottomRight);
 
 	float L = sqrt((Lx*Lx) + (Ly*Ly));
-	return float4(L.xxx, 1);
+
+	// saturated like a pass of its own would write it, before converting
+	return float4(mul(saturate(L).xxx, gOutputColorMatrix), 1);
 }
 //--------------------------------------------------------------//
 // Technique Section for EdgeDetection
@@ -28,63 +28,85 @@ struct VS_INPUT
 	float2 mUV : TEXCOORD0;
 };
 
-
+// UVs of the neighbors, two per interpolator. computing them per vertex
+// keeps the texture reads in the pixel shader non-dependent
 struct VS_OUTPUT
 {
 	float4 mPosition: POSITION;
-	float2 mUV : TEXCOORD0;
+	float4 mNeighborUV[3] : TEXCOORD0;
 };
 
+float2 gPixelOffset : ViewportDimensionsInverse;
 
 VS_OUTPUT EdgeDetection_Emboss_Vertex_Shader_vs_main(VS_INPUT Input)
 {
 	VS_OUTPUT Output;
 
 	Output.mPosition = Input.mPosition;
-	Output.mUV = Input.mUV;
+
+	float2 dx = float2(gPixelOffset.x, 0);
+	float2 dy = float2(0, gPixelOffset.y);
+	Output.mNeighborUV[0] = float4(Input.mUV - dx - dy, Input.mUV - dy);
+	Output.mNeighborUV[1] = float4(Input.mUV - dx, Input.mUV + dx);
+	Output.mNeighborUV[2] = float4(Input.mUV + dy, Input.mUV + dx + dy);
 
 	return Output;
 }
 
-
 struct PS_INPUT
 {
-	float2 mUV : TEXCOORD0;
+	float4 mNeighborUV[3] : TEXCOORD0;
 };
 
 texture SceneTexture_Tex
 <
-string ResourceName = ".\\";
+	string ResourceName = ".\\";
 >;
 sampler2D SceneSampler = sampler_state
 {
 	Texture = (SceneTexture_Tex);
+	MAGFILTER = POINT;
+	MINFILTER = POINT;
+	// clamp the halo taps outside the screen to the border pixels, so
+	// the emboss doesn't pick up the opposite edge of the screen
+	ADDRESSU = CLAMP;
+	ADDRESSV = CLAMP;
 };
 
-float3x3 K = { -2, -1, 0,
-				-1, 0, 1,
-				0, 1, 2 };
+// color conversions before this filter only change how luminance is
+// computed, so they are folded into these weights instead of a pass
+float3 gLuminanceWeights = float3(0.3, 0.59, 0.11);
 
-float2 gPixelOffset : ViewportDimensionsInverse;
+// color conversions after this filter
+float3x3 gOutputColorMatrix = { 1, 0, 0,
+								0, 1, 0,
+								0, 0, 1 };
 
+float Luminance(float2 uv)
+{
+	return dot(tex2D(SceneSampler, uv).rgb, gLuminanceWeights);
+}
+
+// emboss kernel
+//   K = { -2, -1, 0,
+//         -1,  0, 1,
+//          0,  1, 2 }
+// has zeros at the center and at two corners, so only 6 neighbors are read
 float4 EdgeDetection_Emboss_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
 {
-	float res = 0;
-	for (int y = -1; y <= 1; ++y)
-	{
-		for (int x = -1; x <= 1; ++x)
-		{
-			float2 offset = float2(x, y) * gPixelOffset;
-			float3 tex = tex2D(SceneSampler, Input.mUV + offset).rgb;
-			float luminance = dot(tex, float3(0.3, 0.59, 0.11));
-
-			res += luminance * K[y + 1][x + 1];
-		}
-	}
+	float topLeft = Luminance(Input.mNeighborUV[0].xy);
+	float top = Luminance(Input.mNeighborUV[0].zw);
+	float left = Luminance(Input.mNeighborUV[1].xy);
+	float right = Luminance(Input.mNeighborUV[1].zw);
+	float bottom = Luminance(Input.mNeighborUV[2].xy);
+	float bottomRight = Luminance(Input.mNeighborUV[2].zw);
+
+	float res = 2 * (bottomRight - topLeft) + (right - left) + (bottom - top);
 
 	res += 0.5f;
 
-	return float4(res.xxx, 1);
+	// saturated like a pass of its own would write it, before converting
+	return float4(mul(saturate(res).xxx, gOutputColorMatrix), 1);
 }
 //--------------------------------------------------------------//
 // Technique Section for EdgeDetection
@@ -123,6 +123,12 @@ samplerCUBE EnvironmentSampler = sampler_state
 	Texture = (EnvironmentMap_Tex);
 	MINFILTER = LINEAR;
 	MAGFILTER = LINEAR;
+	MIPFILTER = LINEAR;
+	// clamp so bilinear taps at a face border stay on that face
+	// instead of wrapping around to its opposite edge
+	ADDRESSU = CLAMP;
+	ADDRESSV = CLAMP;
+	ADDRESSW = CLAMP;
 };
 
 float3 gLightColor
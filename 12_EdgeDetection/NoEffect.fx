@@ -61,11 +61,16 @@ sampler2D SceneSampler = sampler_state
 	Texture = (SceneTexture_Tex);
 };
 
+// color conversions that can't be folded into another pass
+float3x3 gOutputColorMatrix = { 1, 0, 0,
+								0, 1, 0,
+								0, 0, 1 };
+
 float4 ColorConversion_NoEffect_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
 {
 	float4 tex = tex2D(SceneSampler, Input.mUV);
 
-	return tex;
+	return float4(mul(tex.rgb, gOutputColorMatrix), tex.a);
 }
 //--------------------------------------------------------------//
 // Technique Section for ColorConversion
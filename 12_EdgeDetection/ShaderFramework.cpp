@@ -12,6 +12,7 @@
 
 #include "ShaderFramework.h"
 #include <stdio.h>
+#include <math.h>
 
 #define PI           3.14159265f
 #define FOV          (PI/4.0f)							// Field of View
@@ -28,6 +29,11 @@
 LPDIRECT3D9             gpD3D = NULL;					// D3D
 LPDIRECT3DDEVICE9       gpD3DDevice = NULL;				// D3D device
 
+// the device type and vertex processing the device was made with. shown
+// on screen, so a run on the reference rasterizer or with software vertex
+// processing isn't taken for a hardware one
+char					gDeviceDescription[64] = "";
+
 // Fonts
 ID3DXFont*              gpFont = NULL;
 
@@ -37,10 +43,13 @@ LPD3DXMESH				gpTeapot = NULL;
 // Shaders
 LPD3DXEFFECT			gpEnvironmentMappingShader = NULL;
 LPD3DXEFFECT			gpNoEffect = NULL;
-LPD3DXEFFECT			gpGrayScale = NULL;
-LPD3DXEFFECT			gpSepia = NULL;
 LPD3DXEFFECT			gpEdgeDetection = NULL;
 LPD3DXEFFECT			gpEmboss = NULL;
+LPD3DXEFFECT			gpColorGrading = NULL;
+LPD3DXEFFECT			gpBilateralUpsample = NULL;
+LPD3DXEFFECT			gpCheckerboardMask = NULL;
+LPD3DXEFFECT			gpCheckerboardResolve = NULL;
+LPD3DXEFFECT			gpBloom = NULL;
 
 // Textures
 LPDIRECT3DTEXTURE9		gpStoneDM = NULL;
@@ -67,12 +76,62 @@ D3DXVECTOR4				gWorldCameraPosition(0.0f, 0.0f, -200.0f, 1.0f);
 LPDIRECT3DVERTEXDECLARATION9	gpFullscreenQuadDecl = NULL;
 LPDIRECT3DVERTEXBUFFER9			gpFullscreenQuadVB = NULL;
 LPDIRECT3DINDEXBUFFER9			gpFullscreenQuadIB = NULL;
-
-// scene render target
-LPDIRECT3DTEXTURE9		gpSceneRenderTarget = NULL;
-
-// index of postprocess shader to use
-int gPostProcessIndex = 0;
+LPDIRECT3DVERTEXBUFFER9			gpHalfResQuadVB = NULL;		// for half resolution targets
+LPDIRECT3DVERTEXBUFFER9			gpBloomQuadVB[NUM_BLOOM_LEVELS] = { NULL, };
+
+// color grading lookup table baked from the post-process chain
+LPDIRECT3DVOLUMETEXTURE9	gpColorGradingLUT = NULL;
+float					gColorGradingLUTError = 0.0f;	// in 8-bit steps
+
+// render targets that only live within a frame (scene, post-process
+// intermediates...) come from this pool. targets whose lifetimes don't
+// overlap end up sharing the same texture
+RenderTargetPoolEntry	gRenderTargetPool[MAX_POOLED_RENDER_TARGETS];
+int						gNumPooledRenderTargets = 0;
+
+// transient render target memory of the current frame in bytes
+UINT					gTransientBytesLive = 0;
+UINT					gTransientBytesPeak = 0;		// with aliasing
+UINT					gTransientBytesUnaliased = 0;	// one target per use
+
+// post-process chain. stages are applied in this order
+int						gPostProcessChain[MAX_POSTPROCESS_STAGES];
+int						gNumPostProcessStages = 0;
+
+// names of the post-process stages for display
+const char*				gPostProcessNames[] = { "Color", "Black and White", "Sepia", "Edge Detection", "Emboss", "Bloom" };
+
+// weights and offsets of the bilinear taps of the bloom blur
+float					gBloomBlurWeights[3];
+float					gBloomBlurOffsets[3];
+
+// quality of the first neighborhood filter
+int						gPostProcessQuality = POSTPROCESS_QUALITY_FULL;
+const char*				gPostProcessQualityNames[] = { "Full", "Half", "Checker" };
+
+// the checkerboard filter only updates half of this every frame, so it
+// lives across frames instead of coming from the pool
+LPDIRECT3DTEXTURE9		gpCheckerboardHistory = NULL;
+UINT					gFrameIndex = 0;
+
+// the chain and the frame the history was drawn with. its old half is
+// only used if it's from the last frame of the same chain
+PostProcessPass			gCheckerboardPasses[MAX_POSTPROCESS_STAGES];
+int						gNumCheckerboardPasses = 0;
+UINT					gCheckerboardHistoryFrame = 0;
+
+// GPU time of the post-process per quality, in milliseconds. negative
+// until measured
+GPUTimer				gGPUTimers[NUM_GPU_TIMERS];
+int						gCurrentGPUTimer = 0;
+float					gPostProcessMilliseconds[NUM_POSTPROCESS_QUALITIES] = { -1.0f, -1.0f, -1.0f };
+
+// difference from full quality per quality, measured on request
+bool					gMeasureQualityError = false;
+bool					gQualityErrorMeasured[NUM_POSTPROCESS_QUALITIES] = { false, false, false };
+float					gQualityPSNR[NUM_POSTPROCESS_QUALITIES];		// in dB. negative if identical
+LPDIRECT3DSURFACE9		gpReferenceReadback = NULL;
+LPDIRECT3DSURFACE9		gpOutputReadback = NULL;
 
 //-----------------------------------------------------------------------
 // Program entry point/message loop
@@ -162,7 +221,36 @@ void ProcessInput(HWND hWnd, WPARAM keyPress)
 	case '3':
 	case '4':
 	case '5':
-		gPostProcessIndex = keyPress - '0' - 1;
+	case '6':
+		{
+			int stage = keyPress - '0' - 1;
+
+			// shift adds the effect to the chain. otherwise it replaces the chain
+			if (!(GetKeyState(VK_SHIFT) & 0x8000))
+			{
+				gNumPostProcessStages = 0;
+			}
+
+			if (stage != POSTPROCESS_NOEFFECT && gNumPostProcessStages < MAX_POSTPROCESS_STAGES)
+			{
+				gPostProcessChain[gNumPostProcessStages++] = stage;
+			}
+
+			BakeColorGradingLUT();
+
+			// timings and errors were of the old chain
+			for (int i = 0; i < NUM_POSTPROCESS_QUALITIES; ++i)
+			{
+				gPostProcessMilliseconds[i] = -1.0f;
+				gQualityErrorMeasured[i] = false;
+			}
+		}
+		break;
+	case 'Q':
+		gPostProcessQuality = (gPostProcessQuality + 1) % NUM_POSTPROCESS_QUALITIES;
+		break;
+	case 'M':
+		gMeasureQualityError = true;
 		break;
 	}
 }
@@ -212,15 +300,21 @@ void RenderScene()
 	LPDIRECT3DSURFACE9 pHWBackBuffer = NULL;
 	gpD3DDevice->GetRenderTarget(0, &pHWBackBuffer);
 
+	// a new frame starts with no transient render target in use
+	gTransientBytesLive = 0;
+	gTransientBytesPeak = 0;
+	gTransientBytesUnaliased = 0;
+
 	// draw onto the render target
-	LPDIRECT3DSURFACE9 pSceneSurface = NULL;
-	if (SUCCEEDED(gpSceneRenderTarget->GetSurfaceLevel(0, &pSceneSurface)))
+	LPDIRECT3DTEXTURE9 pSceneRenderTarget = AcquireRenderTarget(WIN_WIDTH, WIN_HEIGHT, D3DFMT_X8R8G8B8);
+	if (!pSceneRenderTarget)
 	{
-		gpD3DDevice->SetRenderTarget(0, pSceneSurface);
-		pSceneSurface->Release();
-		pSceneSurface = NULL;
+		pHWBackBuffer->Release();
+		return;
 	}
 
+	SetRenderTargetTexture(pSceneRenderTarget);
+
 	// clear what's drawn in the last frame
 	gpD3DDevice->Clear(0, NULL, D3DCLEAR_TARGET, 0xFF000000, 1.0f, 0);
 
@@ -285,54 +379,748 @@ void RenderScene()
 	/////////////////////////
 	// 2. apply post-processing
 	/////////////////////////
-	// use hardware backbuffer
-	gpD3DDevice->SetRenderTarget(0, pHWBackBuffer);
-	pHWBackBuffer->Release();
-	pHWBackBuffer = NULL;
+	++gFrameIndex;
 
-	// post process effect to use
-	LPD3DXEFFECT effectToUse = gpNoEffect;
-	if (gPostProcessIndex == 1)
+	if (gMeasureQualityError)
+	{
+		// render the full quality result off screen to compare against.
+		// this frame isn't timed since it does the work twice
+		LPDIRECT3DTEXTURE9 pReference = AcquireRenderTarget(WIN_WIDTH, WIN_HEIGHT, D3DFMT_X8R8G8B8);
+		LPDIRECT3DSURFACE9 pReferenceSurface = NULL;
+		if (pReference && SUCCEEDED(pReference->GetSurfaceLevel(0, &pReferenceSurface)))
+		{
+			RenderPostProcess(pSceneRenderTarget, pReferenceSurface, POSTPROCESS_QUALITY_FULL, false);
+			RenderPostProcess(pSceneRenderTarget, pHWBackBuffer, gPostProcessQuality, true);
+			MeasureQualityError(pReferenceSurface, pHWBackBuffer, gPostProcessQuality);
+			pReferenceSurface->Release();
+		}
+		else
+		{
+			RenderPostProcess(pSceneRenderTarget, pHWBackBuffer, gPostProcessQuality, true);
+		}
+
+		if (pReference)
+		{
+			ReleaseRenderTarget(pReference);
+		}
+		gMeasureQualityError = false;
+	}
+	else
 	{
-		effectToUse = gpGrayScale;
+		BeginGPUTimer(gPostProcessQuality);
+		RenderPostProcess(pSceneRenderTarget, pHWBackBuffer, gPostProcessQuality, true);
+		EndGPUTimer();
 	}
-	else if (gPostProcessIndex == 2)
+
+	pHWBackBuffer->Release();
+	pHWBackBuffer = NULL;
+}
+
+// run the post-process chain on the scene and draw the result onto
+// pOutput. the scene target goes back to the pool after its last use
+// unless releaseScene is false
+void RenderPostProcess(LPDIRECT3DTEXTURE9 pScene, LPDIRECT3DSURFACE9 pOutput, int quality, bool releaseScene)
+{
+	PostProcessPass passes[MAX_POSTPROCESS_STAGES];
+	int numPostProcessPasses = BuildPostProcessPasses(passes);
+
+	D3DXVECTOR4 pixelOffset(1 / (float)WIN_WIDTH, 1 / (float)WIN_HEIGHT, 0, 0);
+
+	// only the first neighborhood filter reads the scene, so that's the
+	// one scaled by quality. the ones after it run at full quality
+	bool qualityApplied = false;
+
+	// each pass' output lives until the next pass reads it. the last pass
+	// draws onto the output
+	LPDIRECT3DTEXTURE9 pSource = pScene;
+	for (int pass = 0; pass < numPostProcessPasses; ++pass)
 	{
-		effectToUse = gpSepia;
+		LPD3DXEFFECT effectToUse = passes[pass].mEffect;
+		bool neighborhoodFilter = (effectToUse == gpEdgeDetection || effectToUse == gpEmboss);
+
+		int passQuality = POSTPROCESS_QUALITY_FULL;
+		if (neighborhoodFilter && !qualityApplied)
+		{
+			passQuality = quality;
+			qualityApplied = true;
+		}
+
+		LPDIRECT3DTEXTURE9 pDestination = NULL;
+		if (pass != numPostProcessPasses - 1)
+		{
+			pDestination = AcquireRenderTarget(WIN_WIDTH, WIN_HEIGHT, D3DFMT_X8R8G8B8);
+			if (!pDestination)
+			{
+				break;
+			}
+		}
+
+		if (neighborhoodFilter)
+		{
+			// at half resolution too, texel k is the filter at full
+			// resolution texel 2k, so it taps the full resolution neighbors
+			effectToUse->SetVector("gPixelOffset", &pixelOffset);
+			effectToUse->SetVector("gLuminanceWeights", &passes[pass].mLuminanceWeights);
+			effectToUse->SetMatrix("gOutputColorMatrix", &passes[pass].mColorMatrix);
+		}
+		else if (effectToUse == gpBloom)
+		{
+			effectToUse->SetVector("gLuminanceWeights", &passes[pass].mLuminanceWeights);
+			effectToUse->SetMatrix("gInputColorMatrix", &passes[pass].mInputColorMatrix);
+			effectToUse->SetMatrix("gOutputColorMatrix", &passes[pass].mColorMatrix);
+		}
+		else if (effectToUse == gpNoEffect)
+		{
+			effectToUse->SetMatrix("gOutputColorMatrix", &passes[pass].mColorMatrix);
+		}
+		else if (effectToUse == gpColorGrading)
+		{
+			D3DXVECTOR4 lutScaleOffset((COLOR_GRADING_LUT_SIZE - 1) / (float)COLOR_GRADING_LUT_SIZE,
+				0.5f / COLOR_GRADING_LUT_SIZE, 0, 0);
+			effectToUse->SetVector("gLUTScaleOffset", &lutScaleOffset);
+			effectToUse->SetTexture("ColorGradingLUT_Tex", gpColorGradingLUT);
+		}
+
+		effectToUse->SetTexture("SceneTexture_Tex", pSource);
+
+		if (effectToUse == gpBloom)
+		{
+			// blur the bright parts at lower resolutions, then add them
+			// to the source
+			LPDIRECT3DTEXTURE9 pBloom = RenderBloom(pSource, &passes[pass]);
+
+			if (pDestination)
+			{
+				SetRenderTargetTexture(pDestination);
+			}
+			else
+			{
+				gpD3DDevice->SetRenderTarget(0, pOutput);
+			}
+
+			gpBloom->SetTechnique("Composite");
+			gpBloom->SetTexture("SceneTexture_Tex", pSource);
+			gpBloom->SetTexture("BloomTexture_Tex", pBloom);
+			DrawFullScreenQuad(gpBloom, gpFullscreenQuadVB);
+
+			if (pBloom)
+			{
+				ReleaseRenderTarget(pBloom);
+			}
+		}
+		else if (passQuality == POSTPROCESS_QUALITY_HALF)
+		{
+			// filter a quarter of the pixels, then upsample them guided by
+			// the full resolution scene
+			LPDIRECT3DTEXTURE9 pHalfRes = AcquireRenderTarget(WIN_WIDTH / 2, WIN_HEIGHT / 2, D3DFMT_X8R8G8B8);
+			if (pHalfRes)
+			{
+				SetRenderTargetTexture(pHalfRes);
+				DrawFullScreenQuad(effectToUse, gpHalfResQuadVB);
+
+				if (pDestination)
+				{
+					SetRenderTargetTexture(pDestination);
+				}
+				else
+				{
+					gpD3DDevice->SetRenderTarget(0, pOutput);
+				}
+
+				gpBilateralUpsample->SetVector("gPixelOffset", &pixelOffset);
+				gpBilateralUpsample->SetVector("gLuminanceWeights", &passes[pass].mLuminanceWeights);
+				gpBilateralUpsample->SetTexture("SceneTexture_Tex", pSource);
+				gpBilateralUpsample->SetTexture("LowResTexture_Tex", pHalfRes);
+				DrawFullScreenQuad(gpBilateralUpsample, gpFullscreenQuadVB);
+
+				ReleaseRenderTarget(pHalfRes);
+			}
+		}
+		else
+		{
+			if (passQuality == POSTPROCESS_QUALITY_CHECKERBOARD)
+			{
+				// the history keeps last frame's result underneath. mask out
+				// the pixels that keep it, then filter the rest. a history
+				// from another chain or an older frame is no use, so every
+				// pixel is filtered then
+				bool isHistoryValid = (gCheckerboardHistoryFrame + 1 == gFrameIndex)
+					&& IsSamePostProcessChain(passes, numPostProcessPasses, gCheckerboardPasses, gNumCheckerboardPasses);
+
+				SetRenderTargetTexture(gpCheckerboardHistory);
+				if (isHistoryValid)
+				{
+					gpD3DDevice->Clear(0, NULL, D3DCLEAR_ZBUFFER, 0, 1.0f, 0);
+					gpCheckerboardMask->SetVector("gPixelOffset", &pixelOffset);
+					gpCheckerboardMask->SetFloat("gCheckerboardParity", (float)(gFrameIndex & 1));
+					DrawFullScreenQuad(gpCheckerboardMask, gpFullscreenQuadVB);
+
+					gpD3DDevice->SetRenderState(D3DRS_ZFUNC, D3DCMP_LESS);
+					DrawFullScreenQuad(effectToUse, gpFullscreenQuadVB);
+					gpD3DDevice->SetRenderState(D3DRS_ZFUNC, D3DCMP_LESSEQUAL);
+				}
+				else
+				{
+					DrawFullScreenQuad(effectToUse, gpFullscreenQuadVB);
+				}
+
+				memcpy(gCheckerboardPasses, passes, numPostProcessPasses * sizeof(PostProcessPass));
+				gNumCheckerboardPasses = numPostProcessPasses;
+				gCheckerboardHistoryFrame = gFrameIndex;
+
+				// resolve the history into the destination, clamping the
+				// old half to this frame's neighbors
+				if (pDestination)
+				{
+					SetRenderTargetTexture(pDestination);
+				}
+				else
+				{
+					gpD3DDevice->SetRenderTarget(0, pOutput);
+				}
+
+				gpCheckerboardResolve->SetVector("gPixelOffset", &pixelOffset);
+				gpCheckerboardResolve->SetFloat("gCheckerboardParity", (float)(gFrameIndex & 1));
+				gpCheckerboardResolve->SetFloat("gIsHistoryValid", isHistoryValid ? 1.0f : 0.0f);
+				gpCheckerboardResolve->SetTexture("HistoryTexture_Tex", gpCheckerboardHistory);
+				DrawFullScreenQuad(gpCheckerboardResolve, gpFullscreenQuadVB);
+			}
+			else
+			{
+				if (pDestination)
+				{
+					SetRenderTargetTexture(pDestination);
+				}
+				else
+				{
+					gpD3DDevice->SetRenderTarget(0, pOutput);
+				}
+
+				DrawFullScreenQuad(effectToUse, gpFullscreenQuadVB);
+			}
+		}
+
+		// that was the last use of the source, so the next pass' output
+		// can alias it
+		if (pSource != pScene || releaseScene)
+		{
+			ReleaseRenderTarget(pSource);
+		}
+		pSource = pDestination;
 	}
-	else if (gPostProcessIndex == 3)
+
+	if (pSource && (pSource != pScene || releaseScene))
 	{
-		effectToUse = gpEdgeDetection;
+		ReleaseRenderTarget(pSource);
 	}
-	else if (gPostProcessIndex == 4)
+}
+
+// true if two post-process chains turned into the same passes
+bool IsSamePostProcessChain(const PostProcessPass * pPasses, int numPasses, const PostProcessPass * pOtherPasses, int numOtherPasses)
+{
+	if (numPasses != numOtherPasses)
 	{
-		effectToUse = gpEmboss;
+		return false;
 	}
 
-	D3DXVECTOR4 pixelOffset(1 / (float)WIN_WIDTH, 1 / (float)WIN_HEIGHT, 0, 0);
-	if (effectToUse == gpEdgeDetection || effectToUse == gpEmboss)
+	for (int i = 0; i < numPasses; ++i)
 	{
-		effectToUse->SetVector("gPixelOffset", &pixelOffset);
+		const PostProcessPass & pass = pPasses[i];
+		const PostProcessPass & other = pOtherPasses[i];
+		if (pass.mEffect != other.mEffect
+			|| pass.mLuminanceWeights != other.mLuminanceWeights
+			|| pass.mColorMatrix != other.mColorMatrix
+			|| pass.mInputColorMatrix != other.mInputColorMatrix)
+		{
+			return false;
+		}
 	}
 
-	effectToUse->SetTexture("SceneTexture_Tex", gpSceneRenderTarget);
-	effectToUse->Begin(&numPasses, NULL);
+	return true;
+}
+
+// draw a fullscreen quad with every pass of an effect
+void DrawFullScreenQuad(LPD3DXEFFECT effect, LPDIRECT3DVERTEXBUFFER9 pQuadVB)
+{
+	UINT numPasses = 0;
+	effect->Begin(&numPasses, NULL);
 	{
 		for (UINT i = 0; i < numPasses; ++i)
 		{
-			effectToUse->BeginPass(i);
+			effect->BeginPass(i);
 			{
-				// draw a fullscreen quad
-				gpD3DDevice->SetStreamSource(0, gpFullscreenQuadVB, 0, sizeof(float)* 5);
+				gpD3DDevice->SetStreamSource(0, pQuadVB, 0, sizeof(float)* 5);
 				gpD3DDevice->SetIndices(gpFullscreenQuadIB);
 				gpD3DDevice->SetVertexDeclaration(gpFullscreenQuadDecl);
 				gpD3DDevice->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 6, 0, 2);
 			}
-			effectToUse->EndPass();
+			effect->EndPass();
 		}
 	}
-	effectToUse->End();
+	effect->End();
+}
 
+void SetRenderTargetTexture(LPDIRECT3DTEXTURE9 pTexture)
+{
+	LPDIRECT3DSURFACE9 pSurface = NULL;
+	if (SUCCEEDED(pTexture->GetSurfaceLevel(0, &pSurface)))
+	{
+		gpD3DDevice->SetRenderTarget(0, pSurface);
+		pSurface->Release();
+	}
+}
+
+// bright pass, downsample, blur and add up the bloom levels. returns the
+// half resolution level holding the sum, which the caller releases.
+// NULL if the pool ran out of targets
+LPDIRECT3DTEXTURE9 RenderBloom(LPDIRECT3DTEXTURE9 pSource, const PostProcessPass * pPass)
+{
+	LPDIRECT3DTEXTURE9 levels[NUM_BLOOM_LEVELS];
+	UINT widths[NUM_BLOOM_LEVELS];
+	UINT heights[NUM_BLOOM_LEVELS];
+	for (int i = 0; i < NUM_BLOOM_LEVELS; ++i)
+	{
+		widths[i] = WIN_WIDTH >> (i + 1);
+		heights[i] = WIN_HEIGHT >> (i + 1);
+		levels[i] = AcquireRenderTarget(widths[i], heights[i], D3DFMT_X8R8G8B8);
+		if (!levels[i])
+		{
+			for (int j = 0; j < i; ++j)
+			{
+				ReleaseRenderTarget(levels[j]);
+			}
+			return NULL;
+		}
+	}
+
+	// 1. bright pass into the first level
+	SetRenderTargetTexture(levels[0]);
+	gpBloom->SetTechnique("BrightPass");
+	gpBloom->SetTexture("SceneTexture_Tex", pSource);
+	DrawFullScreenQuad(gpBloom, gpBloomQuadVB[0]);
+
+	// 2. each level is a downsample of the one before
+	gpBloom->SetTechnique("Downsample");
+	for (int i = 1; i < NUM_BLOOM_LEVELS; ++i)
+	{
+		D3DXVECTOR4 texelSize(1.0f / widths[i - 1], 1.0f / heights[i - 1], 0, 0);
+		SetRenderTargetTexture(levels[i]);
+		gpBloom->SetVector("gTexelSize", &texelSize);
+		gpBloom->SetTexture("BloomTexture_Tex", levels[i - 1]);
+		DrawFullScreenQuad(gpBloom, gpBloomQuadVB[i]);
+	}
+
+	// 3. blur every level horizontally into a temporary target, then
+	// vertically back. the same kernel is wider on smaller levels
+	gpBloom->SetTechnique("Blur");
+	gpBloom->SetFloatArray("gBlurWeights", gBloomBlurWeights, 3);
+	gpBloom->SetFloatArray("gBlurOffsets", gBloomBlurOffsets, 3);
+	for (int i = 0; i < NUM_BLOOM_LEVELS; ++i)
+	{
+		LPDIRECT3DTEXTURE9 pTemp = AcquireRenderTarget(widths[i], heights[i], D3DFMT_X8R8G8B8);
+		if (!pTemp)
+		{
+			break;
+		}
+
+		D3DXVECTOR4 horizontal(1.0f / widths[i], 0, 0, 0);
+		SetRenderTargetTexture(pTemp);
+		gpBloom->SetVector("gBlurDirection", &horizontal);
+		gpBloom->SetTexture("BloomTexture_Tex", levels[i]);
+		DrawFullScreenQuad(gpBloom, gpBloomQuadVB[i]);
+
+		D3DXVECTOR4 vertical(0, 1.0f / heights[i], 0, 0);
+		SetRenderTargetTexture(levels[i]);
+		gpBloom->SetVector("gBlurDirection", &vertical);
+		gpBloom->SetTexture("BloomTexture_Tex", pTemp);
+		DrawFullScreenQuad(gpBloom, gpBloomQuadVB[i]);
+
+		ReleaseRenderTarget(pTemp);
+	}
+
+	// 4. add every level onto the next larger one, smallest first
+	gpBloom->SetTechnique("Upsample");
+	for (int i = NUM_BLOOM_LEVELS - 1; i > 0; --i)
+	{
+		SetRenderTargetTexture(levels[i - 1]);
+		gpBloom->SetTexture("BloomTexture_Tex", levels[i]);
+		DrawFullScreenQuad(gpBloom, gpBloomQuadVB[i - 1]);
+
+		ReleaseRenderTarget(levels[i]);
+	}
+
+	return levels[0];
+}
+
+// fold a 9-tap Gaussian into 5 bilinear taps. a tap between texels i and
+// i+1, placed by their weights, reads both in one fetch
+void ComputeBloomBlurTaps(float sigma)
+{
+	float weights[5];
+	float sum = 0.0f;
+	for (int i = 0; i < 5; ++i)
+	{
+		weights[i] = expf(-(float)(i * i) / (2.0f * sigma * sigma));
+		sum += (i == 0) ? weights[i] : 2.0f * weights[i];
+	}
+
+	for (int i = 0; i < 5; ++i)
+	{
+		weights[i] /= sum;
+	}
+
+	gBloomBlurWeights[0] = weights[0];
+	gBloomBlurOffsets[0] = 0.0f;
+	for (int i = 1; i < 3; ++i)
+	{
+		int first = i * 2 - 1;
+		gBloomBlurWeights[i] = weights[first] + weights[first + 1];
+		gBloomBlurOffsets[i] = (first * weights[first] + (first + 1) * weights[first + 1]) / gBloomBlurWeights[i];
+	}
+}
+
+// print the texture fetches and memory traffic of every bloom pass to
+// the debug output, at the window size, 1080p and 4K. render targets are
+// 32-bit and every input is assumed to be read once thanks to the
+// texture cache. the measured GPU time is in the info panel
+void ReportBloomCost()
+{
+	const UINT resolutions[][2] = { { WIN_WIDTH, WIN_HEIGHT }, { 1920, 1080 }, { 3840, 2160 } };
+
+	char text[128];
+	for (int r = 0; r < 3; ++r)
+	{
+		UINT width = resolutions[r][0];
+		UINT height = resolutions[r][1];
+		sprintf(text, "bloom cost at %ux%u\n", width, height);
+		OutputDebugString(text);
+
+		UINT levelPixels[NUM_BLOOM_LEVELS];
+		for (int i = 0; i < NUM_BLOOM_LEVELS; ++i)
+		{
+			levelPixels[i] = (width >> (i + 1)) * (height >> (i + 1));
+		}
+
+		float megabytes = ReportBloomPassCost("bright pass", width / 2, height / 2, width * height, 1);
+		for (int i = 1; i < NUM_BLOOM_LEVELS; ++i)
+		{
+			megabytes += ReportBloomPassCost("downsample", width >> (i + 1), height >> (i + 1), levelPixels[i - 1], 4);
+		}
+		for (int i = 0; i < NUM_BLOOM_LEVELS; ++i)
+		{
+			megabytes += ReportBloomPassCost("blur x", width >> (i + 1), height >> (i + 1), levelPixels[i], 5);
+			megabytes += ReportBloomPassCost("blur y", width >> (i + 1), height >> (i + 1), levelPixels[i], 5);
+		}
+		for (int i = NUM_BLOOM_LEVELS - 1; i > 0; --i)
+		{
+			// blending reads the target as well
+			megabytes += ReportBloomPassCost("upsample", width >> i, height >> i, levelPixels[i] + levelPixels[i - 1], 1);
+		}
+		megabytes += ReportBloomPassCost("composite", width, height, width * height + levelPixels[0], 2);
+
+		sprintf(text, "  total %.1f MB\n", megabytes);
+		OutputDebugString(text);
+	}
+}
+
+// print one line of ReportBloomCost() and return its megabytes
+float ReportBloomPassCost(const char * name, UINT outputWidth, UINT outputHeight, UINT inputPixels, int tapsPerPixel)
+{
+	float megabytes = (inputPixels + outputWidth * outputHeight) * 4 / (1024.0f * 1024.0f);
+
+	char text[128];
+	sprintf(text, "  %-12s %4ux%-4u %d taps/pixel %6.1f MB\n", name, outputWidth, outputHeight, tapsPerPixel, megabytes);
+	OutputDebugString(text);
+
+	return megabytes;
+}
+
+// compare the output of a quality against the full quality reference.
+// reading render targets back stalls the GPU, so this only runs when asked
+void MeasureQualityError(LPDIRECT3DSURFACE9 pReference, LPDIRECT3DSURFACE9 pOutput, int quality)
+{
+	if (FAILED(gpD3DDevice->GetRenderTargetData(pReference, gpReferenceReadback))
+		|| FAILED(gpD3DDevice->GetRenderTargetData(pOutput, gpOutputReadback)))
+	{
+		return;
+	}
+
+	D3DLOCKED_RECT reference;
+	D3DLOCKED_RECT output;
+	if (FAILED(gpReferenceReadback->LockRect(&reference, NULL, D3DLOCK_READONLY)))
+	{
+		return;
+	}
+	if (FAILED(gpOutputReadback->LockRect(&output, NULL, D3DLOCK_READONLY)))
+	{
+		gpReferenceReadback->UnlockRect();
+		return;
+	}
+
+	double squaredError = 0.0;
+	for (int y = 0; y < WIN_HEIGHT; ++y)
+	{
+		DWORD * referenceRow = (DWORD*)((BYTE*)reference.pBits + y * reference.Pitch);
+		DWORD * outputRow = (DWORD*)((BYTE*)output.pBits + y * output.Pitch);
+		for (int x = 0; x < WIN_WIDTH; ++x)
+		{
+			for (int shift = 0; shift < 24; shift += 8)
+			{
+				int difference = (int)((referenceRow[x] >> shift) & 0xFF) - (int)((outputRow[x] >> shift) & 0xFF);
+				squaredError += difference * difference;
+			}
+		}
+	}
+
+	gpOutputReadback->UnlockRect();
+	gpReferenceReadback->UnlockRect();
+
+	// peak signal to noise ratio. higher is closer
+	double meanSquaredError = squaredError / (WIN_WIDTH * WIN_HEIGHT * 3);
+	gQualityPSNR[quality] = (meanSquaredError > 0.0) ? (float)(10.0 * log10(255.0 * 255.0 / meanSquaredError)) : -1.0f;
+	gQualityErrorMeasured[quality] = true;
+}
+
+// turn the post-process chain into as few fullscreen passes as possible.
+// color conversions are per-pixel and linear, so they are multiplied into
+// the luminance weights of the next neighborhood filter, the input of
+// bloom or the output color matrix of the previous pass. only the output of a neighborhood
+// filter read by another neighborhood filter needs a render target.
+// every stage of the unfused chain writes an 8-bit target, which
+// saturates. folding is only exact while the colors stay in [0,1], so
+// conversions that may leave it are written out before anything reads them
+int BuildPostProcessPasses(PostProcessPass * pPasses)
+{
+	D3DXVECTOR4 luminanceWeights(0.3f, 0.59f, 0.11f, 0);
+
+	// color conversions since the last neighborhood filter
+	D3DXMATRIXA16 matColor;
+	D3DXMatrixIdentity(&matColor);
+
+	// a chain of color conversions only is baked into the LUT, which
+	// saturates after every stage itself
+	bool colorStagesOnly = true;
+	for (int i = 0; i < gNumPostProcessStages; ++i)
+	{
+		D3DXMATRIXA16 matStage;
+		if (!GetColorStageMatrix(gPostProcessChain[i], &matStage))
+		{
+			colorStagesOnly = false;
+		}
+	}
+
+	int numPasses = 0;
+	for (int i = 0; i < gNumPostProcessStages; ++i)
+	{
+		int stage = gPostProcessChain[i];
+		if (!colorStagesOnly && !StaysInUnitRange(matColor))
+		{
+			numPasses = FlushColorStages(pPasses, numPasses, &matColor);
+		}
+
+		D3DXMATRIXA16 matStage;
+		if (GetColorStageMatrix(stage, &matStage))
+		{
+			D3DXMatrixMultiply(&matColor, &matColor, &matStage);
+		}
+		else if (stage == POSTPROCESS_EDGEDETECTION || stage == POSTPROCESS_EMBOSS)
+		{
+			// dot(rgb * M, w) == dot(rgb, M * w)
+			PostProcessPass & pass = pPasses[numPasses++];
+			pass.mEffect = (stage == POSTPROCESS_EDGEDETECTION) ? gpEdgeDetection : gpEmboss;
+			pass.mLuminanceWeights = D3DXVECTOR4(
+				matColor._11 * luminanceWeights.x + matColor._12 * luminanceWeights.y + matColor._13 * luminanceWeights.z,
+				matColor._21 * luminanceWeights.x + matColor._22 * luminanceWeights.y + matColor._23 * luminanceWeights.z,
+				matColor._31 * luminanceWeights.x + matColor._32 * luminanceWeights.y + matColor._33 * luminanceWeights.z,
+				0);
+			D3DXMatrixIdentity(&pass.mColorMatrix);
+			D3DXMatrixIdentity(&pass.mInputColorMatrix);
+			D3DXMatrixIdentity(&matColor);
+		}
+		else if (stage == POSTPROCESS_BLOOM)
+		{
+			// bloom needs the colors, not just luminance, so the color
+			// conversions before it are applied to its input
+			PostProcessPass & pass = pPasses[numPasses++];
+			pass.mEffect = gpBloom;
+			pass.mLuminanceWeights = luminanceWeights;
+			pass.mInputColorMatrix = matColor;
+			D3DXMatrixIdentity(&pass.mColorMatrix);
+			D3DXMatrixIdentity(&matColor);
+		}
+	}
+
+	// trailing color conversions go into the last pass. with no
+	// neighborhood filter, the whole chain is in the color grading LUT
+	if (numPasses > 0)
+	{
+		numPasses = FlushColorStages(pPasses, numPasses, &matColor);
+	}
+	else
+	{
+		PostProcessPass & pass = pPasses[numPasses++];
+		pass.mEffect = (gNumPostProcessStages > 0) ? gpColorGrading : gpNoEffect;
+		pass.mLuminanceWeights = luminanceWeights;
+		pass.mColorMatrix = matColor;
+		D3DXMatrixIdentity(&pass.mInputColorMatrix);
+	}
+
+	return numPasses;
+}
+
+// true if mul(rgb, M) of every color in [0,1] is in [0,1] too, so no
+// saturation between it and the next stage could change anything
+bool StaysInUnitRange(const D3DXMATRIX & mat)
+{
+	for (int column = 0; column < 3; ++column)
+	{
+		float sum = 0.0f;
+		for (int row = 0; row < 3; ++row)
+		{
+			if (mat.m[row][column] < 0.0f)
+			{
+				return false;
+			}
+			sum += mat.m[row][column];
+		}
+
+		// grayscale weights add up to 1 give or take rounding
+		if (sum > 1.0001f)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// write out the pending color conversions, saturated by the render target
+// of the last pass. if that pass already converts its output, they get a
+// pass of their own. returns the new number of passes
+int FlushColorStages(PostProcessPass * pPasses, int numPasses, D3DXMATRIX * pColor)
+{
+	if (D3DXMatrixIsIdentity(pColor))
+	{
+		return numPasses;
+	}
+
+	if (numPasses == 0 || !D3DXMatrixIsIdentity(&pPasses[numPasses - 1].mColorMatrix))
+	{
+		PostProcessPass & pass = pPasses[numPasses++];
+		pass.mEffect = gpNoEffect;
+		pass.mLuminanceWeights = D3DXVECTOR4(0.3f, 0.59f, 0.11f, 0);
+		D3DXMatrixIdentity(&pass.mColorMatrix);
+		D3DXMatrixIdentity(&pass.mInputColorMatrix);
+	}
+
+	pPasses[numPasses - 1].mColorMatrix = *pColor;
+	D3DXMatrixIdentity(pColor);
+	return numPasses;
+}
+
+// color conversion of a stage as a matrix applied as mul(rgb, M).
+// returns false if the stage isn't a color conversion
+bool GetColorStageMatrix(int stage, D3DXMATRIX * pOut)
+{
+	if (stage == POSTPROCESS_GRAYSCALE)
+	{
+		*pOut = D3DXMATRIX(
+			0.3f, 0.3f, 0.3f, 0,
+			0.59f, 0.59f, 0.59f, 0,
+			0.11f, 0.11f, 0.11f, 0,
+			0, 0, 0, 1);
+		return true;
+	}
+
+	if (stage == POSTPROCESS_SEPIA)
+	{
+		// same as Sepia.fx of 11_ColorConversion, which reads (r, b, b) for blue
+		*pOut = D3DXMATRIX(
+			0.393f, 0.349f, 0.272f, 0,
+			0.769f, 0.686f, 0.0f, 0,
+			0.189f, 0.168f, 0.131f + 0.534f, 0,
+			0, 0, 0, 1);
+		return true;
+	}
+
+	return false;
+}
+
+// run a color through every color conversion of the chain. each stage
+// saturates, like the 8-bit target its own pass would write
+D3DXVECTOR3 ApplyColorStages(const D3DXVECTOR3 & color)
+{
+	D3DXVECTOR3 ret = color;
+	for (int i = 0; i < gNumPostProcessStages; ++i)
+	{
+		D3DXMATRIXA16 matStage;
+		if (GetColorStageMatrix(gPostProcessChain[i], &matStage))
+		{
+			D3DXVec3TransformNormal(&ret, &ret, &matStage);
+
+			ret.x = max(0.0f, min(ret.x, 1.0f));
+			ret.y = max(0.0f, min(ret.y, 1.0f));
+			ret.z = max(0.0f, min(ret.z, 1.0f));
+		}
+	}
+
+	return ret;
+}
+
+// bake the color conversions of the chain into the color grading LUT,
+// then measure how far trilinear lookups are from the exact colors
+void BakeColorGradingLUT()
+{
+	const int size = COLOR_GRADING_LUT_SIZE;
+
+	D3DLOCKED_BOX lockedBox;
+	if (FAILED(gpColorGradingLUT->LockBox(0, &lockedBox, NULL, 0)))
+	{
+		return;
+	}
+
+	// red goes along u, green along v and blue along w
+	BYTE * lut = (BYTE*)lockedBox.pBits;
+	for (int b = 0; b < size; ++b)
+	{
+		for (int g = 0; g < size; ++g)
+		{
+			DWORD * row = (DWORD*)(lut + b * lockedBox.SlicePitch + g * lockedBox.RowPitch);
+			for (int r = 0; r < size; ++r)
+			{
+				D3DXVECTOR3 color = ApplyColorStages(D3DXVECTOR3((float)r, (float)g, (float)b) / (size - 1.0f));
+				row[r] = D3DCOLOR_XRGB((int)(color.x * 255 + 0.5f), (int)(color.y * 255 + 0.5f), (int)(color.z * 255 + 0.5f));
+			}
+		}
+	}
+
+	// colors halfway between texel centers are the worst case for trilinear
+	gColorGradingLUTError = 0.0f;
+	for (int b = 0; b < size - 1; ++b)
+	{
+		for (int g = 0; g < size - 1; ++g)
+		{
+			for (int r = 0; r < size - 1; ++r)
+			{
+				D3DXVECTOR3 lookup(0, 0, 0);
+				for (int corner = 0; corner < 8; ++corner)
+				{
+					int x = r + (corner & 1);
+					int y = g + ((corner >> 1) & 1);
+					int z = b + ((corner >> 2) & 1);
+					D3DCOLOR texel = ((DWORD*)(lut + z * lockedBox.SlicePitch + y * lockedBox.RowPitch))[x];
+					lookup += D3DXVECTOR3((BYTE)(texel >> 16), (BYTE)(texel >> 8), (BYTE)texel) / 8.0f;
+				}
+
+				D3DXVECTOR3 exact = ApplyColorStages(D3DXVECTOR3(r + 0.5f, g + 0.5f, b + 0.5f) / (size - 1.0f)) * 255.0f;
+				D3DXVECTOR3 error = lookup - exact;
+				gColorGradingLUTError = max(gColorGradingLUTError,
+					max(fabsf(error.x), max(fabsf(error.y), fabsf(error.z))));
+			}
+		}
+	}
+
+	gpColorGradingLUT->UnlockBox(0);
 }
 
 // display debug info
@@ -346,10 +1134,73 @@ void RenderInfo()
 	rct.left = 5;
 	rct.right = WIN_WIDTH / 3;
 	rct.top = 5;
-	rct.bottom = WIN_HEIGHT / 3;
+	rct.bottom = WIN_HEIGHT / 2;
 
 	// display debug key info
-	gpFont->DrawText(NULL, "Demo Framework\n\nESC: Exit\n1: Color\n2: Black and White\n3: Sepia\n4: Edge Detection\n5: Emboss", -1, &rct, 0, fontColor);
+	gpFont->DrawText(NULL, "Demo Framework\n\nESC: Exit\n1: Color\n2: Black and White\n3: Sepia\n4: Edge Detection\n5: Emboss\n6: Bloom\nShift: Add to Chain\nQ: Filter Quality\nM: Measure Error", -1, &rct, 0, fontColor);
+
+	// display the post-process chain and how much memory traffic it costs.
+	// every fullscreen pass reads and writes one 32-bit target
+	PostProcessPass passes[MAX_POSTPROCESS_STAGES];
+	int numPasses = BuildPostProcessPasses(passes);
+	int numNaivePasses = gNumPostProcessStages > 0 ? gNumPostProcessStages : 1;
+	float megabytesPerPass = WIN_WIDTH * WIN_HEIGHT * 4 * 2 / (1024.0f * 1024.0f);
+
+	char text[1024];
+	int length = sprintf(text, "Chain:");
+	for (int i = 0; i < gNumPostProcessStages; ++i)
+	{
+		length += sprintf(text + length, "\n  %s", gPostProcessNames[gPostProcessChain[i]]);
+	}
+	length += sprintf(text + length, "\nPasses: %d (naive %d)\nMB/frame: %.1f (naive %.1f)",
+		numPasses, numNaivePasses, numPasses * megabytesPerPass, numNaivePasses * megabytesPerPass);
+	length += sprintf(text + length, "\nTransient MB: %.1f (unaliased %.1f)",
+		gTransientBytesPeak / (1024.0f * 1024.0f), gTransientBytesUnaliased / (1024.0f * 1024.0f));
+	if (passes[0].mEffect == gpColorGrading)
+	{
+		length += sprintf(text + length, "\nLUT %d^3, max error: %.2f",
+			COLOR_GRADING_LUT_SIZE, gColorGradingLUTError);
+	}
+
+	// GPU time of the post-process and PSNR against full quality, for
+	// every quality measured so far
+	length += sprintf(text + length, "\nQuality: %s", gPostProcessQualityNames[gPostProcessQuality]);
+	for (int i = 0; i < NUM_POSTPROCESS_QUALITIES; ++i)
+	{
+		length += sprintf(text + length, "\n  %s: ", gPostProcessQualityNames[i]);
+		if (gPostProcessMilliseconds[i] >= 0.0f)
+		{
+			length += sprintf(text + length, "%.2f ms", gPostProcessMilliseconds[i]);
+		}
+		else
+		{
+			length += sprintf(text + length, "- ms");
+		}
+
+		if (gQualityErrorMeasured[i])
+		{
+			if (gQualityPSNR[i] < 0.0f)
+			{
+				length += sprintf(text + length, ", exact");
+			}
+			else
+			{
+				length += sprintf(text + length, ", %.1f dB", gQualityPSNR[i]);
+			}
+		}
+	}
+
+	rct.left = WIN_WIDTH * 2 / 3;
+	rct.right = WIN_WIDTH - 5;
+	rct.bottom = WIN_HEIGHT - 5;
+	gpFont->DrawText(NULL, text, -1, &rct, 0, fontColor);
+
+	// the device in use, at the bottom
+	rct.left = WIN_WIDTH / 3;
+	rct.right = WIN_WIDTH * 2 / 3;
+	rct.top = WIN_HEIGHT - 30;
+	rct.bottom = WIN_HEIGHT - 5;
+	gpFont->DrawText(NULL, gDeviceDescription, -1, &rct, 0, fontColor);
 }
 
 //------------------------------------------------------------
@@ -366,14 +1217,44 @@ bool InitEverything(HWND hWnd)
 	// create a fullscreen quad
 	InitFullScreenQuad();
 
-	// create a render target
+	// create the color grading lookup table
+	if (FAILED(gpD3DDevice->CreateVolumeTexture(COLOR_GRADING_LUT_SIZE, COLOR_GRADING_LUT_SIZE, COLOR_GRADING_LUT_SIZE,
+		1, 0, D3DFMT_A8R8G8B8, D3DPOOL_MANAGED, &gpColorGradingLUT, NULL)))
+	{
+		return false;
+	}
+	BakeColorGradingLUT();
+
+	// history of the checkerboard filter. starts out black
 	if (FAILED(gpD3DDevice->CreateTexture(WIN_WIDTH, WIN_HEIGHT,
 		1, D3DUSAGE_RENDERTARGET, D3DFMT_X8R8G8B8,
-		D3DPOOL_DEFAULT, &gpSceneRenderTarget, NULL)))
+		D3DPOOL_DEFAULT, &gpCheckerboardHistory, NULL)))
 	{
 		return false;
 	}
 
+	LPDIRECT3DSURFACE9 pHistorySurface = NULL;
+	if (SUCCEEDED(gpCheckerboardHistory->GetSurfaceLevel(0, &pHistorySurface)))
+	{
+		gpD3DDevice->ColorFill(pHistorySurface, NULL, D3DCOLOR_XRGB(0, 0, 0));
+		pHistorySurface->Release();
+	}
+
+	// system memory copies for measuring the error of the quality tiers
+	if (FAILED(gpD3DDevice->CreateOffscreenPlainSurface(WIN_WIDTH, WIN_HEIGHT,
+		D3DFMT_X8R8G8B8, D3DPOOL_SYSTEMMEM, &gpReferenceReadback, NULL))
+		|| FAILED(gpD3DDevice->CreateOffscreenPlainSurface(WIN_WIDTH, WIN_HEIGHT,
+		D3DFMT_X8R8G8B8, D3DPOOL_SYSTEMMEM, &gpOutputReadback, NULL)))
+	{
+		return false;
+	}
+
+	// timing the post-process is optional
+	InitGPUTimers();
+
+	ComputeBloomBlurTaps(2.0f);
+	ReportBloomCost();
+
 	// loading models, shaders and textures
 	if (!LoadAssets())
 	{
@@ -420,14 +1301,52 @@ bool InitD3D(HWND hWnd)
 	d3dpp.FullScreen_RefreshRateInHz = 0;
 	d3dpp.PresentationInterval = D3DPRESENT_INTERVAL_ONE;
 
+	// decide where the vs_2_0/ps_2_0 shaders get executed. without
+	// vertex shader 2.0 hardware, the runtime's software vertex processing
+	// runs them on the CPU. without ps_2_0 this falls back to the
+	// reference rasterizer, which is only installed with the DirectX SDK
+	// and takes seconds per frame. either way the choice is reported
+	// (the shader model 3 features are checked on their own, and are
+	// turned off without it)
+	D3DDEVTYPE deviceType = D3DDEVTYPE_HAL;
+	DWORD vertexProcessing = D3DCREATE_HARDWARE_VERTEXPROCESSING;
+
+	D3DCAPS9 caps;
+	if (FAILED(gpD3D->GetDeviceCaps(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, &caps))
+		|| caps.PixelShaderVersion < D3DPS_VERSION(2, 0))
+	{
+		deviceType = D3DDEVTYPE_REF;
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+	}
+	else if (!(caps.DevCaps & D3DDEVCAPS_HWTRANSFORMANDLIGHT)
+		|| caps.VertexShaderVersion < D3DVS_VERSION(2, 0))
+	{
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+	}
+
 	// create a D3D device
-	if (FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, hWnd,
-		D3DCREATE_HARDWARE_VERTEXPROCESSING,
+	if (FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, deviceType, hWnd,
+		vertexProcessing,
 		&d3dpp, &gpD3DDevice)))
 	{
-		return false;
+		// hardware vertex processing can still be refused (e.g. out of
+		// video memory), so try once more with software vertex processing
+		if (vertexProcessing == D3DCREATE_SOFTWARE_VERTEXPROCESSING
+			|| FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, deviceType, hWnd,
+			D3DCREATE_SOFTWARE_VERTEXPROCESSING,
+			&d3dpp, &gpD3DDevice)))
+		{
+			return false;
+		}
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
 	}
 
+	sprintf(gDeviceDescription, "Device: %s, %s VP",
+		(deviceType == D3DDEVTYPE_REF) ? "REF" : "HAL",
+		(vertexProcessing == D3DCREATE_SOFTWARE_VERTEXPROCESSING) ? "SW" : "HW");
+	OutputDebugString(gDeviceDescription);
+	OutputDebugString("\n");
+
 	return true;
 }
 
@@ -471,26 +1390,44 @@ bool LoadAssets()
 		return false;
 	}
 
-	gpGrayScale = LoadShader("Grayscale.fx");
-	if (!gpGrayScale)
+	gpEdgeDetection = LoadShader("EdgeDetection.fx");
+	if (!gpEdgeDetection)
 	{
 		return false;
 	}
 
-	gpSepia = LoadShader("Sepia.fx");
-	if (!gpSepia)
+	gpEmboss = LoadShader("Emboss.fx");
+	if (!gpEmboss)
 	{
 		return false;
 	}
 
-	gpEdgeDetection = LoadShader("EdgeDetection.fx");
-	if (!gpEdgeDetection)
+	gpColorGrading = LoadShader("ColorGrading.fx");
+	if (!gpColorGrading)
 	{
 		return false;
 	}
 
-	gpEmboss = LoadShader("Emboss.fx");
-	if (!gpEmboss)
+	gpBilateralUpsample = LoadShader("BilateralUpsample.fx");
+	if (!gpBilateralUpsample)
+	{
+		return false;
+	}
+
+	gpCheckerboardMask = LoadShader("CheckerboardMask.fx");
+	if (!gpCheckerboardMask)
+	{
+		return false;
+	}
+
+	gpCheckerboardResolve = LoadShader("CheckerboardResolve.fx");
+	if (!gpCheckerboardResolve)
+	{
+		return false;
+	}
+
+	gpBloom = LoadShader("Bloom.fx");
+	if (!gpBloom)
 	{
 		return false;
 	}
@@ -515,6 +1452,17 @@ LPD3DXEFFECT LoadShader(const char * filename)
 
 #if _DEBUG
 	dwShaderFlags |= D3DXSHADER_DEBUG;
+#else
+	// release builds use the effect precompiled by fxc at build time
+	// (custom build step in the project), so HLSL isn't parsed and
+	// compiled on every launch. fall back to the source if it's missing
+	char compiledFilename[MAX_PATH];
+	_snprintf(compiledFilename, MAX_PATH, "%so", filename);
+	compiledFilename[MAX_PATH - 1] = '\0';
+	if (GetFileAttributes(compiledFilename) != INVALID_FILE_ATTRIBUTES)
+	{
+		filename = compiledFilename;
+	}
 #endif
 
 	D3DXCreateEffectFromFile(gpD3DDevice, filename,
@@ -599,18 +1547,6 @@ void Cleanup()
 		gpNoEffect = NULL;
 	}
 
-	if (gpGrayScale)
-	{
-		gpGrayScale->Release();
-		gpGrayScale = NULL;
-	}
-
-	if (gpSepia)
-	{
-		gpSepia->Release();
-		gpSepia = NULL;
-	}
-
 	if (gpEdgeDetection)
 	{
 		gpEdgeDetection->Release();
@@ -622,6 +1558,36 @@ void Cleanup()
 		gpEmboss = NULL;
 	}
 
+	if (gpColorGrading)
+	{
+		gpColorGrading->Release();
+		gpColorGrading = NULL;
+	}
+
+	if (gpBilateralUpsample)
+	{
+		gpBilateralUpsample->Release();
+		gpBilateralUpsample = NULL;
+	}
+
+	if (gpCheckerboardMask)
+	{
+		gpCheckerboardMask->Release();
+		gpCheckerboardMask = NULL;
+	}
+
+	if (gpCheckerboardResolve)
+	{
+		gpCheckerboardResolve->Release();
+		gpCheckerboardResolve = NULL;
+	}
+
+	if (gpBloom)
+	{
+		gpBloom->Release();
+		gpBloom = NULL;
+	}
+
 	// release textures
 	if (gpStoneDM)
 	{
@@ -647,6 +1613,12 @@ void Cleanup()
 		gpSnowENV = NULL;
 	}
 
+	if (gpColorGradingLUT)
+	{
+		gpColorGradingLUT->Release();
+		gpColorGradingLUT = NULL;
+	}
+
 	// Release the fullscreen quad
 	if (gpFullscreenQuadDecl)
 	{
@@ -666,13 +1638,49 @@ void Cleanup()
 		gpFullscreenQuadIB = NULL;
 	}
 
-	// release the render target
-	if (gpSceneRenderTarget)
+	if (gpHalfResQuadVB)
+	{
+		gpHalfResQuadVB->Release();
+		gpHalfResQuadVB = NULL;
+	}
+
+	for (int i = 0; i < NUM_BLOOM_LEVELS; ++i)
 	{
-		gpSceneRenderTarget->Release();
-		gpSceneRenderTarget = NULL;
+		if (gpBloomQuadVB[i])
+		{
+			gpBloomQuadVB[i]->Release();
+			gpBloomQuadVB[i] = NULL;
+		}
+	}
+
+	// release the render targets
+	for (int i = 0; i < gNumPooledRenderTargets; ++i)
+	{
+		gRenderTargetPool[i].mTexture->Release();
+		gRenderTargetPool[i].mTexture = NULL;
+	}
+	gNumPooledRenderTargets = 0;
+
+	if (gpCheckerboardHistory)
+	{
+		gpCheckerboardHistory->Release();
+		gpCheckerboardHistory = NULL;
 	}
 
+	if (gpReferenceReadback)
+	{
+		gpReferenceReadback->Release();
+		gpReferenceReadback = NULL;
+	}
+
+	if (gpOutputReadback)
+	{
+		gpOutputReadback->Release();
+		gpOutputReadback = NULL;
+	}
+
+	ReleaseGPUTimers();
+
 	// release D3D
 	if (gpD3DDevice)
 	{
@@ -726,25 +1734,18 @@ void InitFullScreenQuad()
 
 	gpD3DDevice->CreateVertexDeclaration(vtxDesc, &gpFullscreenQuadDecl);
 
-	// create a vertex buffer
-	gpD3DDevice->CreateVertexBuffer(offset * 4, 0, 0, D3DPOOL_MANAGED, &gpFullscreenQuadVB, NULL);
-	void * vertexData = NULL;
-	gpFullscreenQuadVB->Lock(0, 0, &vertexData, 0);
-	{
-		float * data = (float*)vertexData;
-		*data++ = -1.0f;	*data++ = 1.0f;		*data++ = 0.0f;
-		*data++ = 0.0f;		*data++ = 0.0f;
+	gpFullscreenQuadVB = CreateFullScreenQuadVB(WIN_WIDTH, WIN_HEIGHT, 0.0f, 0.0f);
 
-		*data++ = 1.0f;		*data++ = 1.0f;		*data++ = 0.0f;
-		*data++ = 1.0f;		*data++ = 0;
+	// a half resolution pixel k is filtered at full resolution texel 2k
+	// rather than between texels 2k and 2k+1
+	gpHalfResQuadVB = CreateFullScreenQuadVB(WIN_WIDTH / 2, WIN_HEIGHT / 2, -0.5f / WIN_WIDTH, -0.5f / WIN_HEIGHT);
 
-		*data++ = 1.0f;		*data++ = -1.0f;	*data++ = 0.0f;
-		*data++ = 1.0f;		*data++ = 1.0f;
-
-		*data++ = -1.0f;	*data++ = -1.0f;	*data++ = 0.0f;
-		*data++ = 0.0f;		*data++ = 1.0f;
+	// bloom levels are bilinear filtered, so their pixel centers land
+	// between the texels of the larger level and average them
+	for (int i = 0; i < NUM_BLOOM_LEVELS; ++i)
+	{
+		gpBloomQuadVB[i] = CreateFullScreenQuadVB(WIN_WIDTH >> (i + 1), WIN_HEIGHT >> (i + 1), 0.0f, 0.0f);
 	}
-	gpFullscreenQuadVB->Unlock();
 
 	// create an index buffer
 	gpD3DDevice->CreateIndexBuffer(sizeof(short)* 6, 0, D3DFMT_INDEX16, D3DPOOL_MANAGED, &gpFullscreenQuadIB, NULL);
@@ -757,3 +1758,239 @@ void InitFullScreenQuad()
 	}
 	gpFullscreenQuadIB->Unlock();
 }
+
+// a fullscreen quad for a target of the given size, with its UVs moved by
+// the given offset
+LPDIRECT3DVERTEXBUFFER9 CreateFullScreenQuadVB(UINT width, UINT height, float uvOffsetX, float uvOffsetY)
+{
+	// D3D9 puts pixel centers on integer coordinates, so the quad is moved
+	// by half a pixel (1/size in clip space) to line texels up with pixels.
+	// otherwise every tap lands on a texel corner and gets rounded to
+	// either neighbor, which shifts the image and the 3x3 filters
+	float halfPixelX = 1.0f / width;
+	float halfPixelY = 1.0f / height;
+
+	// create a vertex buffer
+	LPDIRECT3DVERTEXBUFFER9 ret = NULL;
+	if (FAILED(gpD3DDevice->CreateVertexBuffer(sizeof(float)* 5 * 4, 0, 0, D3DPOOL_MANAGED, &ret, NULL)))
+	{
+		return NULL;
+	}
+
+	void * vertexData = NULL;
+	ret->Lock(0, 0, &vertexData, 0);
+	{
+		float * data = (float*)vertexData;
+		*data++ = -1.0f - halfPixelX;	*data++ = 1.0f + halfPixelY;	*data++ = 0.0f;
+		*data++ = 0.0f + uvOffsetX;		*data++ = 0.0f + uvOffsetY;
+
+		*data++ = 1.0f - halfPixelX;	*data++ = 1.0f + halfPixelY;	*data++ = 0.0f;
+		*data++ = 1.0f + uvOffsetX;		*data++ = 0.0f + uvOffsetY;
+
+		*data++ = 1.0f - halfPixelX;	*data++ = -1.0f + halfPixelY;	*data++ = 0.0f;
+		*data++ = 1.0f + uvOffsetX;		*data++ = 1.0f + uvOffsetY;
+
+		*data++ = -1.0f - halfPixelX;	*data++ = -1.0f + halfPixelY;	*data++ = 0.0f;
+		*data++ = 0.0f + uvOffsetX;		*data++ = 1.0f + uvOffsetY;
+	}
+	ret->Unlock();
+
+	return ret;
+}
+
+//------------------------------------------------------------
+// GPU timers
+//------------------------------------------------------------
+
+// timestamp queries aren't supported everywhere. without them the
+// timers are left empty and the timings show as unknown
+void InitGPUTimers()
+{
+	for (int i = 0; i < NUM_GPU_TIMERS; ++i)
+	{
+		GPUTimer & timer = gGPUTimers[i];
+		ZeroMemory(&timer, sizeof(timer));
+
+		if (FAILED(gpD3DDevice->CreateQuery(D3DQUERYTYPE_TIMESTAMPDISJOINT, &timer.mDisjoint))
+			|| FAILED(gpD3DDevice->CreateQuery(D3DQUERYTYPE_TIMESTAMPFREQ, &timer.mFrequency))
+			|| FAILED(gpD3DDevice->CreateQuery(D3DQUERYTYPE_TIMESTAMP, &timer.mBegin))
+			|| FAILED(gpD3DDevice->CreateQuery(D3DQUERYTYPE_TIMESTAMP, &timer.mEnd)))
+		{
+			OutputDebugString("GPU timestamps aren't supported\n");
+			ReleaseGPUTimers();
+			return;
+		}
+	}
+}
+
+void ReleaseGPUTimers()
+{
+	for (int i = 0; i < NUM_GPU_TIMERS; ++i)
+	{
+		GPUTimer & timer = gGPUTimers[i];
+		LPDIRECT3DQUERY9 * queries[] = { &timer.mDisjoint, &timer.mFrequency, &timer.mBegin, &timer.mEnd };
+		for (int j = 0; j < 4; ++j)
+		{
+			if (*queries[j])
+			{
+				(*queries[j])->Release();
+				*queries[j] = NULL;
+			}
+		}
+		timer.mIssued = false;
+	}
+}
+
+// timers are used round robin, so a timer's results are read
+// NUM_GPU_TIMERS frames after it was issued, when the GPU is usually done
+// with them and reading doesn't stall
+void BeginGPUTimer(int quality)
+{
+	GPUTimer & timer = gGPUTimers[gCurrentGPUTimer];
+	if (!timer.mBegin)
+	{
+		return;
+	}
+
+	if (timer.mIssued)
+	{
+		ReadGPUTimer(&timer);
+	}
+
+	timer.mDisjoint->Issue(D3DISSUE_BEGIN);
+	timer.mBegin->Issue(D3DISSUE_END);
+	timer.mQuality = quality;
+}
+
+void EndGPUTimer()
+{
+	GPUTimer & timer = gGPUTimers[gCurrentGPUTimer];
+	if (timer.mBegin)
+	{
+		timer.mEnd->Issue(D3DISSUE_END);
+		timer.mFrequency->Issue(D3DISSUE_END);
+		timer.mDisjoint->Issue(D3DISSUE_END);
+		timer.mIssued = true;
+	}
+
+	gCurrentGPUTimer = (gCurrentGPUTimer + 1) % NUM_GPU_TIMERS;
+}
+
+// add the timer's result to the running average of its quality. results
+// that aren't ready yet, or were disturbed by a clock change, are skipped
+void ReadGPUTimer(GPUTimer * pTimer)
+{
+	BOOL disjoint = TRUE;
+	UINT64 frequency = 0;
+	UINT64 begin = 0;
+	UINT64 end = 0;
+	if (pTimer->mDisjoint->GetData(&disjoint, sizeof(disjoint), 0) != S_OK
+		|| pTimer->mFrequency->GetData(&frequency, sizeof(frequency), 0) != S_OK
+		|| pTimer->mBegin->GetData(&begin, sizeof(begin), 0) != S_OK
+		|| pTimer->mEnd->GetData(&end, sizeof(end), 0) != S_OK)
+	{
+		return;
+	}
+
+	if (disjoint || frequency == 0)
+	{
+		return;
+	}
+
+	float milliseconds = (float)((end - begin) * 1000.0 / frequency);
+	float & average = gPostProcessMilliseconds[pTimer->mQuality];
+	average = (average < 0.0f) ? milliseconds : average * 0.9f + milliseconds * 0.1f;
+}
+
+//------------------------------------------------------------
+// render target pool
+//------------------------------------------------------------
+
+// get a render target nobody is using in this frame. a new one is only
+// created when every pooled target of that size and format is in use
+LPDIRECT3DTEXTURE9 AcquireRenderTarget(UINT width, UINT height, D3DFORMAT format)
+{
+	for (int i = 0; i < gNumPooledRenderTargets; ++i)
+	{
+		RenderTargetPoolEntry & entry = gRenderTargetPool[i];
+		if (!entry.mInUse && entry.mWidth == width && entry.mHeight == height && entry.mFormat == format)
+		{
+			entry.mInUse = true;
+			CountTransientBytes(width, height, format);
+			return entry.mTexture;
+		}
+	}
+
+	if (gNumPooledRenderTargets >= MAX_POOLED_RENDER_TARGETS)
+	{
+		OutputDebugString("render target pool is full\n");
+		return NULL;
+	}
+
+	RenderTargetPoolEntry & entry = gRenderTargetPool[gNumPooledRenderTargets];
+	if (FAILED(gpD3DDevice->CreateTexture(width, height,
+		1, D3DUSAGE_RENDERTARGET, format,
+		D3DPOOL_DEFAULT, &entry.mTexture, NULL)))
+	{
+		OutputDebugString("failed at creating a render target\n");
+		return NULL;
+	}
+
+	entry.mWidth = width;
+	entry.mHeight = height;
+	entry.mFormat = format;
+	entry.mInUse = true;
+	++gNumPooledRenderTargets;
+	CountTransientBytes(width, height, format);
+
+	return entry.mTexture;
+}
+
+// only targets actually handed out count, so a failed acquire doesn't
+// leave bytes live that nobody will release
+void CountTransientBytes(UINT width, UINT height, D3DFORMAT format)
+{
+	UINT size = width * height * GetBytesPerPixel(format);
+	gTransientBytesUnaliased += size;
+	gTransientBytesLive += size;
+	gTransientBytesPeak = max(gTransientBytesPeak, gTransientBytesLive);
+}
+
+// call after the last use of a render target in this frame
+void ReleaseRenderTarget(LPDIRECT3DTEXTURE9 pTexture)
+{
+	for (int i = 0; i < gNumPooledRenderTargets; ++i)
+	{
+		RenderTargetPoolEntry & entry = gRenderTargetPool[i];
+		if (entry.mTexture == pTexture && entry.mInUse)
+		{
+			entry.mInUse = false;
+			gTransientBytesLive -= entry.mWidth * entry.mHeight * GetBytesPerPixel(entry.mFormat);
+			return;
+		}
+	}
+}
+
+UINT GetBytesPerPixel(D3DFORMAT format)
+{
+	switch (format)
+	{
+	case D3DFMT_A8:
+	case D3DFMT_L8:
+		return 1;
+
+	case D3DFMT_R16F:
+	case D3DFMT_R5G6B5:
+		return 2;
+
+	case D3DFMT_A16B16G16R16F:
+	case D3DFMT_G32R32F:
+		return 8;
+
+	case D3DFMT_A32B32G32R32F:
+		return 16;
+
+	default:
+		return 4;
+	}
+}
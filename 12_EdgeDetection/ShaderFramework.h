@@ -19,6 +19,69 @@
 #define WIN_WIDTH		800
 #define WIN_HEIGHT		600
 
+// post-process stages
+#define POSTPROCESS_NOEFFECT		0
+#define POSTPROCESS_GRAYSCALE		1
+#define POSTPROCESS_SEPIA			2
+#define POSTPROCESS_EDGEDETECTION	3
+#define POSTPROCESS_EMBOSS			4
+#define POSTPROCESS_BLOOM			5
+
+#define MAX_POSTPROCESS_STAGES		4
+
+// size of the color grading lookup table along each axis
+#define COLOR_GRADING_LUT_SIZE		32
+
+// full resolution targets (scene, post-process ping-pong, quality
+// reference), a half resolution one, and every bloom level with its
+// blur temporary. pooled targets are never freed within a run
+#define MAX_POOLED_RENDER_TARGETS	16
+
+// bloom is blurred at 1/2, 1/4, 1/8 and 1/16 resolution
+#define NUM_BLOOM_LEVELS			4
+
+// how the first neighborhood filter (edge detection, emboss) of the
+// chain is evaluated
+#define POSTPROCESS_QUALITY_FULL			0	// every pixel
+#define POSTPROCESS_QUALITY_HALF			1	// half resolution, bilateral upsample
+#define POSTPROCESS_QUALITY_CHECKERBOARD	2	// half the pixels, rest from last frame
+#define NUM_POSTPROCESS_QUALITIES			3
+
+// frames of GPU timestamp queries in flight
+#define NUM_GPU_TIMERS				3
+
+// ---------- types ----------------------------------------
+
+// a fullscreen pass running one or more fused post-process stages
+struct PostProcessPass
+{
+	LPD3DXEFFECT	mEffect;
+	D3DXVECTOR4		mLuminanceWeights;	// color stages before a neighborhood filter
+	D3DXMATRIXA16	mColorMatrix;		// color stages applied to the output
+	D3DXMATRIXA16	mInputColorMatrix;	// color stages before bloom
+};
+
+// a render target shared by transient targets of the same size and format
+struct RenderTargetPoolEntry
+{
+	LPDIRECT3DTEXTURE9	mTexture;
+	UINT				mWidth;
+	UINT				mHeight;
+	D3DFORMAT			mFormat;
+	bool				mInUse;
+};
+
+// GPU timestamps around the post-process of one frame
+struct GPUTimer
+{
+	LPDIRECT3DQUERY9	mDisjoint;
+	LPDIRECT3DQUERY9	mFrequency;
+	LPDIRECT3DQUERY9	mBegin;
+	LPDIRECT3DQUERY9	mEnd;
+	int					mQuality;		// quality the frame was drawn with
+	bool				mIssued;
+};
+
 // ---------------- function prototype  ------------------------
 
 // Message procedure related
@@ -41,9 +104,38 @@ void Update();
 void RenderFrame();
 void RenderScene();
 void RenderInfo();
+void RenderPostProcess(LPDIRECT3DTEXTURE9 pScene, LPDIRECT3DSURFACE9 pOutput, int quality, bool releaseScene);
+bool IsSamePostProcessChain(const PostProcessPass * pPasses, int numPasses, const PostProcessPass * pOtherPasses, int numOtherPasses);
+void DrawFullScreenQuad(LPD3DXEFFECT effect, LPDIRECT3DVERTEXBUFFER9 pQuadVB);
+void SetRenderTargetTexture(LPDIRECT3DTEXTURE9 pTexture);
+LPDIRECT3DTEXTURE9 RenderBloom(LPDIRECT3DTEXTURE9 pSource, const PostProcessPass * pPass);
+void ComputeBloomBlurTaps(float sigma);
+void ReportBloomCost();
+float ReportBloomPassCost(const char * name, UINT outputWidth, UINT outputHeight, UINT inputPixels, int tapsPerPixel);
+void MeasureQualityError(LPDIRECT3DSURFACE9 pReference, LPDIRECT3DSURFACE9 pOutput, int quality);
+int BuildPostProcessPasses(PostProcessPass * pPasses);
+bool StaysInUnitRange(const D3DXMATRIX & mat);
+int FlushColorStages(PostProcessPass * pPasses, int numPasses, D3DXMATRIX * pColor);
+bool GetColorStageMatrix(int stage, D3DXMATRIX * pOut);
+D3DXVECTOR3 ApplyColorStages(const D3DXVECTOR3 & color);
+void BakeColorGradingLUT();
 
 // cleanup related
 void Cleanup();
 
 
-void InitFullScreenQuad();
\ No newline at end of file
+void InitFullScreenQuad();
+LPDIRECT3DVERTEXBUFFER9 CreateFullScreenQuadVB(UINT width, UINT height, float uvOffsetX, float uvOffsetY);
+
+// GPU timers
+void InitGPUTimers();
+void ReleaseGPUTimers();
+void BeginGPUTimer(int quality);
+void EndGPUTimer();
+void ReadGPUTimer(GPUTimer * pTimer);
+
+// render target pool
+LPDIRECT3DTEXTURE9 AcquireRenderTarget(UINT width, UINT height, D3DFORMAT format);
+void ReleaseRenderTarget(LPDIRECT3DTEXTURE9 pTexture);
+void CountTransientBytes(UINT width, UINT height, D3DFORMAT format);
+UINT GetBytesPerPixel(D3DFORMAT format);
@@ -0,0 +1,1054 @@
+//**********************************************************************
+//
+// BatchPostProcess.cpp
+//
+// Command line tool running the post-process effects of 12_EdgeDetection
+// over a directory of images.
+// (same super simple C-style as the shader demo framework)
+//
+// usage: BatchPostProcess <input dir> <output dir> <effect> [<effect>...]
+//        effects: grayscale, sepia, edge, emboss
+//        BatchPostProcess -strip <edge|emboss> <input.ppm> <output.pgm>
+//
+// images flow through three stages connected by bounded queues:
+// reader threads load files from disk, the main thread runs the effects
+// on the GPU and encodes the result, and writer threads save it to disk.
+// since the queues are bounded, memory use doesn't grow with the number
+// of images.
+//
+// -strip is for images too big to fit in memory or in a texture. edge
+// detection and emboss only look at the rows right above and below, so
+// the image is streamed through a three-row luminance buffer on the CPU
+// and memory use depends only on the width.
+//
+//**********************************************************************
+
+#include "BatchPostProcess.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+
+//----------------------------------------------------------------------
+// Global variables
+//----------------------------------------------------------------------
+
+// D3D-related
+LPDIRECT3D9             gpD3D = NULL;					// D3D
+LPDIRECT3DDEVICE9       gpD3DDevice = NULL;				// D3D device
+HWND					gHWnd = NULL;					// hidden window for the device
+
+// Shaders
+LPD3DXEFFECT			gpEffects[NUM_POSTPROCESS_EFFECTS] = { NULL, };
+const char*				gEffectFilenames[NUM_POSTPROCESS_EFFECTS] = { "Grayscale.fx", "Sepia.fx", "EdgeDetection.fx", "Emboss.fx" };
+const char*				gEffectNames[NUM_POSTPROCESS_EFFECTS] = { "grayscale", "sepia", "edge", "emboss" };
+
+// post-process chain. stages are applied in this order
+int						gPostProcessChain[MAX_POSTPROCESS_STAGES];
+int						gNumPostProcessStages = 0;
+
+// fullscreen quad
+LPDIRECT3DVERTEXDECLARATION9	gpFullscreenQuadDecl = NULL;
+
+// render targets the chain ping-pongs between, and a system memory copy
+// of the result for encoding
+LPDIRECT3DTEXTURE9		gpRenderTargets[2] = { NULL, NULL };
+LPDIRECT3DSURFACE9		gpReadbackSurface = NULL;
+UINT					gRenderTargetWidth = 0;
+UINT					gRenderTargetHeight = 0;
+
+// directories
+char					gInputDirectory[MAX_PATH];
+char					gOutputDirectory[MAX_PATH];
+
+// input files are handed out to reader threads one at a time
+CRITICAL_SECTION		gInputLock;
+HANDLE					gFindHandle = INVALID_HANDLE_VALUE;
+WIN32_FIND_DATA			gFindData;
+
+// queues between reader -> GPU -> writer
+ImageQueue				gReadQueue;
+ImageQueue				gWriteQueue;
+
+// number of images in memory right now and at most
+volatile LONG			gImagesInMemory = 0;
+volatile LONG			gPeakImagesInMemory = 0;
+
+//-----------------------------------------------------------------------
+// Program entry point
+//-----------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+	if (argc == 5 && !_stricmp(argv[1], "-strip"))
+	{
+		int stage = -1;
+		if (!_stricmp(argv[2], gEffectNames[POSTPROCESS_EDGEDETECTION]))
+		{
+			stage = POSTPROCESS_EDGEDETECTION;
+		}
+		else if (!_stricmp(argv[2], gEffectNames[POSTPROCESS_EMBOSS]))
+		{
+			stage = POSTPROCESS_EMBOSS;
+		}
+		else
+		{
+			fprintf(stderr, "strip mode only supports edge and emboss\n");
+			return 1;
+		}
+
+		return FilterImageInStrips(stage, argv[3], argv[4]) ? 0 : 1;
+	}
+
+	if (!ParseArguments(argc, argv))
+	{
+		printf("usage: BatchPostProcess <input dir> <output dir> <effect> [<effect>...]\n");
+		printf("       BatchPostProcess -strip <edge|emboss> <input.ppm> <output.pgm>\n");
+		printf("effects: grayscale, sepia, edge, emboss\n");
+		return 1;
+	}
+
+	if (!InitD3D() || !LoadAssets())
+	{
+		fprintf(stderr, "failed at initializing D3D\n");
+		Cleanup();
+		return 1;
+	}
+
+	// find the first input file
+	char pattern[MAX_PATH];
+	_snprintf(pattern, MAX_PATH, "%s\\*", gInputDirectory);
+	pattern[MAX_PATH - 1] = '\0';
+	gFindHandle = FindFirstFile(pattern, &gFindData);
+	if (gFindHandle == INVALID_HANDLE_VALUE)
+	{
+		fprintf(stderr, "failed at opening %s\n", gInputDirectory);
+		Cleanup();
+		return 1;
+	}
+
+	InitializeCriticalSection(&gInputLock);
+	InitQueue(&gReadQueue);
+	InitQueue(&gWriteQueue);
+
+	HANDLE threads[NUM_READER_THREADS + NUM_WRITER_THREADS];
+	int numThreads = 0;
+	for (int i = 0; i < NUM_READER_THREADS; ++i)
+	{
+		threads[numThreads++] = CreateThread(NULL, 0, ReaderThread, NULL, 0, NULL);
+	}
+	for (int i = 0; i < NUM_WRITER_THREADS; ++i)
+	{
+		threads[numThreads++] = CreateThread(NULL, 0, WriterThread, NULL, 0, NULL);
+	}
+
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER start;
+	LARGE_INTEGER end;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+
+	// every reader sends NULL when it runs out of files
+	int numFinishedReaders = 0;
+	int numFrames = 0;
+	int numFailed = 0;
+	while (numFinishedReaders < NUM_READER_THREADS)
+	{
+		ImageFile * pImage = PopQueue(&gReadQueue);
+		if (!pImage)
+		{
+			++numFinishedReaders;
+			continue;
+		}
+
+		if (ProcessImage(pImage))
+		{
+			PushQueue(&gWriteQueue, pImage);
+			++numFrames;
+		}
+		else
+		{
+			fprintf(stderr, "failed at processing %s\n", pImage->mFilename);
+			DeleteImage(pImage);
+			++numFailed;
+		}
+	}
+
+	// tell the writers to finish
+	for (int i = 0; i < NUM_WRITER_THREADS; ++i)
+	{
+		PushQueue(&gWriteQueue, NULL);
+	}
+
+	WaitForMultipleObjects(numThreads, threads, TRUE, INFINITE);
+	for (int i = 0; i < numThreads; ++i)
+	{
+		CloseHandle(threads[i]);
+	}
+
+	QueryPerformanceCounter(&end);
+	double seconds = (end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+	printf("%d frames in %.2f seconds: %.1f frames/sec\n",
+		numFrames, seconds, seconds > 0 ? numFrames / seconds : 0.0);
+	printf("at most %d images in memory\n", gPeakImagesInMemory);
+
+	DestroyQueue(&gReadQueue);
+	DestroyQueue(&gWriteQueue);
+	DeleteCriticalSection(&gInputLock);
+	if (gFindHandle != INVALID_HANDLE_VALUE)
+	{
+		FindClose(gFindHandle);
+		gFindHandle = INVALID_HANDLE_VALUE;
+	}
+
+	Cleanup();
+	return numFailed > 0 ? 1 : 0;
+}
+
+//------------------------------------------------------------
+// Initialization code
+//------------------------------------------------------------
+
+bool ParseArguments(int argc, char* argv[])
+{
+	if (argc < 4)
+	{
+		return false;
+	}
+
+	strncpy(gInputDirectory, argv[1], MAX_PATH);
+	gInputDirectory[MAX_PATH - 1] = '\0';
+	strncpy(gOutputDirectory, argv[2], MAX_PATH);
+	gOutputDirectory[MAX_PATH - 1] = '\0';
+
+	for (int i = 3; i < argc; ++i)
+	{
+		if (gNumPostProcessStages >= MAX_POSTPROCESS_STAGES)
+		{
+			fprintf(stderr, "at most %d effects can be chained\n", MAX_POSTPROCESS_STAGES);
+			return false;
+		}
+
+		int stage = -1;
+		for (int j = 0; j < NUM_POSTPROCESS_EFFECTS; ++j)
+		{
+			if (!_stricmp(argv[i], gEffectNames[j]))
+			{
+				stage = j;
+				break;
+			}
+		}
+
+		if (stage < 0)
+		{
+			fprintf(stderr, "unknown effect: %s\n", argv[i]);
+			return false;
+		}
+
+		gPostProcessChain[gNumPostProcessStages++] = stage;
+	}
+
+	CreateDirectory(gOutputDirectory, NULL);
+
+	return true;
+}
+
+// init D3D object and device on a window that is never shown
+bool InitD3D()
+{
+	gHWnd = CreateWindow("STATIC", "BatchPostProcess", WS_OVERLAPPEDWINDOW,
+		0, 0, 1, 1, NULL, NULL, GetModuleHandle(NULL), NULL);
+	if (!gHWnd)
+	{
+		return false;
+	}
+
+	// D3D object
+	gpD3D = Direct3DCreate9(D3D_SDK_VERSION);
+	if (!gpD3D)
+	{
+		return false;
+	}
+
+	// fill in the structure needed to create a D3D device.
+	// everything is drawn into render targets, so the backbuffer is tiny
+	D3DPRESENT_PARAMETERS d3dpp;
+	ZeroMemory(&d3dpp, sizeof(d3dpp));
+
+	d3dpp.BackBufferWidth = 1;
+	d3dpp.BackBufferHeight = 1;
+	d3dpp.BackBufferFormat = D3DFMT_X8R8G8B8;
+	d3dpp.BackBufferCount = 1;
+	d3dpp.MultiSampleType = D3DMULTISAMPLE_NONE;
+	d3dpp.MultiSampleQuality = 0;
+	d3dpp.SwapEffect = D3DSWAPEFFECT_DISCARD;
+	d3dpp.hDeviceWindow = gHWnd;
+	d3dpp.Windowed = TRUE;
+	d3dpp.EnableAutoDepthStencil = FALSE;
+	d3dpp.PresentationInterval = D3DPRESENT_INTERVAL_IMMEDIATE;
+
+	// same fallbacks as the demo framework for hardware without 2.0 shaders
+	D3DDEVTYPE deviceType = D3DDEVTYPE_HAL;
+	DWORD vertexProcessing = D3DCREATE_HARDWARE_VERTEXPROCESSING;
+
+	D3DCAPS9 caps;
+	if (FAILED(gpD3D->GetDeviceCaps(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, &caps))
+		|| caps.PixelShaderVersion < D3DPS_VERSION(2, 0))
+	{
+		deviceType = D3DDEVTYPE_REF;
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+	}
+	else if (!(caps.DevCaps & D3DDEVCAPS_HWTRANSFORMANDLIGHT)
+		|| caps.VertexShaderVersion < D3DVS_VERSION(2, 0))
+	{
+		vertexProcessing = D3DCREATE_SOFTWARE_VERTEXPROCESSING;
+	}
+
+	// create a D3D device
+	if (FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, deviceType, gHWnd,
+		vertexProcessing,
+		&d3dpp, &gpD3DDevice)))
+	{
+		if (vertexProcessing == D3DCREATE_SOFTWARE_VERTEXPROCESSING
+			|| FAILED(gpD3D->CreateDevice(D3DADAPTER_DEFAULT, deviceType, gHWnd,
+			D3DCREATE_SOFTWARE_VERTEXPROCESSING,
+			&d3dpp, &gpD3DDevice)))
+		{
+			return false;
+		}
+	}
+
+	// vertex declaration of the fullscreen quad: position and UV
+	D3DVERTEXELEMENT9 vtxDesc[] =
+	{
+		{ 0, 0, D3DDECLTYPE_FLOAT3, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0 },
+		{ 0, sizeof(float)* 3, D3DDECLTYPE_FLOAT2, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0 },
+		D3DDECL_END()
+	};
+
+	if (FAILED(gpD3DDevice->CreateVertexDeclaration(vtxDesc, &gpFullscreenQuadDecl)))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+// load the effects used by the chain
+bool LoadAssets()
+{
+	for (int i = 0; i < gNumPostProcessStages; ++i)
+	{
+		int stage = gPostProcessChain[i];
+		if (!gpEffects[stage])
+		{
+			gpEffects[stage] = LoadShader(gEffectFilenames[stage]);
+			if (!gpEffects[stage])
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+// loading shaders
+LPD3DXEFFECT LoadShader(const char * filename)
+{
+	LPD3DXEFFECT ret = NULL;
+
+	LPD3DXBUFFER pError = NULL;
+	DWORD dwShaderFlags = 0;
+
+#if _DEBUG
+	dwShaderFlags |= D3DXSHADER_DEBUG;
+#else
+	// prefer the effect precompiled by fxc at build time
+	char compiledFilename[MAX_PATH];
+	_snprintf(compiledFilename, MAX_PATH, "%so", filename);
+	compiledFilename[MAX_PATH - 1] = '\0';
+	if (GetFileAttributes(compiledFilename) != INVALID_FILE_ATTRIBUTES)
+	{
+		filename = compiledFilename;
+	}
+#endif
+
+	D3DXCreateEffectFromFile(gpD3DDevice, filename,
+		NULL, NULL, dwShaderFlags, NULL, &ret, &pError);
+
+	// if failed at loading shaders, display compile error
+	if (!ret)
+	{
+		fprintf(stderr, "failed at loading a shader: %s\n", filename);
+		if (pError)
+		{
+			fprintf(stderr, "%s\n", (const char*)pError->GetBufferPointer());
+		}
+	}
+
+	if (pError)
+	{
+		pError->Release();
+	}
+
+	return ret;
+}
+
+//------------------------------------------------------------
+// pipeline
+//------------------------------------------------------------
+
+// reads input files into memory
+DWORD WINAPI ReaderThread(LPVOID param)
+{
+	char filename[MAX_PATH];
+	while (GetNextInputFile(filename))
+	{
+		char path[MAX_PATH];
+		_snprintf(path, MAX_PATH, "%s\\%s", gInputDirectory, filename);
+		path[MAX_PATH - 1] = '\0';
+
+		HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			fprintf(stderr, "failed at opening %s\n", path);
+			continue;
+		}
+
+		ImageFile * pImage = new ImageFile;
+		strcpy(pImage->mFilename, filename);
+		pImage->mSize = GetFileSize(file, NULL);
+		pImage->mData = new BYTE[pImage->mSize];
+
+		LONG count = InterlockedIncrement(&gImagesInMemory);
+		LONG peak = gPeakImagesInMemory;
+		while (count > peak && InterlockedCompareExchange(&gPeakImagesInMemory, count, peak) != peak)
+		{
+			peak = gPeakImagesInMemory;
+		}
+
+		DWORD bytesRead = 0;
+		BOOL success = ReadFile(file, pImage->mData, pImage->mSize, &bytesRead, NULL);
+		CloseHandle(file);
+
+		if (!success || bytesRead != pImage->mSize)
+		{
+			fprintf(stderr, "failed at reading %s\n", path);
+			DeleteImage(pImage);
+			continue;
+		}
+
+		// waits while the GPU stage is behind
+		PushQueue(&gReadQueue, pImage);
+	}
+
+	PushQueue(&gReadQueue, NULL);
+	return 0;
+}
+
+// writes processed images to the output directory
+DWORD WINAPI WriterThread(LPVOID param)
+{
+	for (;;)
+	{
+		ImageFile * pImage = PopQueue(&gWriteQueue);
+		if (!pImage)
+		{
+			break;
+		}
+
+		char path[MAX_PATH];
+		_snprintf(path, MAX_PATH, "%s\\%s", gOutputDirectory, pImage->mFilename);
+		path[MAX_PATH - 1] = '\0';
+
+		HANDLE file = CreateFile(path, GENERIC_WRITE, 0, NULL,
+			CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		DWORD bytesWritten = 0;
+		if (file == INVALID_HANDLE_VALUE
+			|| !WriteFile(file, pImage->mData, pImage->mSize, &bytesWritten, NULL)
+			|| bytesWritten != pImage->mSize)
+		{
+			fprintf(stderr, "failed at writing %s\n", path);
+		}
+
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file);
+		}
+
+		DeleteImage(pImage);
+	}
+
+	return 0;
+}
+
+// hand out the next file of the input directory. returns false when
+// there's none left
+bool GetNextInputFile(char * filename)
+{
+	bool found = false;
+
+	EnterCriticalSection(&gInputLock);
+	while (!found && gFindHandle != INVALID_HANDLE_VALUE)
+	{
+		if (!(gFindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		{
+			strcpy(filename, gFindData.cFileName);
+			found = true;
+		}
+
+		if (!FindNextFile(gFindHandle, &gFindData))
+		{
+			FindClose(gFindHandle);
+			gFindHandle = INVALID_HANDLE_VALUE;
+		}
+	}
+	LeaveCriticalSection(&gInputLock);
+
+	return found;
+}
+
+// the output keeps the file format of the input
+D3DXIMAGE_FILEFORMAT GetImageFileFormat(const char * filename)
+{
+	const char * extension = strrchr(filename, '.');
+	if (extension)
+	{
+		if (!_stricmp(extension, ".bmp"))
+		{
+			return D3DXIFF_BMP;
+		}
+		if (!_stricmp(extension, ".jpg") || !_stricmp(extension, ".jpeg"))
+		{
+			return D3DXIFF_JPG;
+		}
+		if (!_stricmp(extension, ".tga"))
+		{
+			return D3DXIFF_TGA;
+		}
+		if (!_stricmp(extension, ".dds"))
+		{
+			return D3DXIFF_DDS;
+		}
+	}
+
+	return D3DXIFF_PNG;
+}
+
+// decode an image, run the post-process chain on it and replace the
+// file contents with the encoded result
+bool ProcessImage(ImageFile * pImage)
+{
+	D3DXIMAGE_INFO info;
+	LPDIRECT3DTEXTURE9 pImageTexture = NULL;
+	if (FAILED(D3DXCreateTextureFromFileInMemoryEx(gpD3DDevice, pImage->mData, pImage->mSize,
+		D3DX_DEFAULT_NONPOW2, D3DX_DEFAULT_NONPOW2, 1, 0, D3DFMT_X8R8G8B8, D3DPOOL_MANAGED,
+		D3DX_FILTER_NONE, D3DX_FILTER_NONE, 0, &info, NULL, &pImageTexture)))
+	{
+		return false;
+	}
+
+	if (!ResizeRenderTargets(info.Width, info.Height))
+	{
+		pImageTexture->Release();
+		return false;
+	}
+
+	// fullscreen quad moved by half a pixel so texels line up with pixels
+	float halfPixelX = 1.0f / info.Width;
+	float halfPixelY = 1.0f / info.Height;
+	float quad[] =
+	{
+		-1.0f - halfPixelX, 1.0f + halfPixelY, 0.0f, 0.0f, 0.0f,
+		1.0f - halfPixelX, 1.0f + halfPixelY, 0.0f, 1.0f, 0.0f,
+		-1.0f - halfPixelX, -1.0f + halfPixelY, 0.0f, 0.0f, 1.0f,
+		1.0f - halfPixelX, -1.0f + halfPixelY, 0.0f, 1.0f, 1.0f,
+	};
+
+	D3DXVECTOR4 pixelOffset(1.0f / info.Width, 1.0f / info.Height, 0, 0);
+
+	// every stage reads the output of the previous one
+	LPDIRECT3DTEXTURE9 pSource = pImageTexture;
+	LPDIRECT3DTEXTURE9 pDestination = NULL;
+
+	gpD3DDevice->BeginScene();
+	for (int i = 0; i < gNumPostProcessStages; ++i)
+	{
+		pDestination = gpRenderTargets[i % 2];
+
+		LPDIRECT3DSURFACE9 pDestinationSurface = NULL;
+		if (SUCCEEDED(pDestination->GetSurfaceLevel(0, &pDestinationSurface)))
+		{
+			gpD3DDevice->SetRenderTarget(0, pDestinationSurface);
+			pDestinationSurface->Release();
+			pDestinationSurface = NULL;
+		}
+
+		int stage = gPostProcessChain[i];
+		LPD3DXEFFECT effectToUse = gpEffects[stage];
+		if (stage == POSTPROCESS_EDGEDETECTION || stage == POSTPROCESS_EMBOSS)
+		{
+			effectToUse->SetVector("gPixelOffset", &pixelOffset);
+		}
+
+		effectToUse->SetTexture("SceneTexture_Tex", pSource);
+
+		UINT numPasses = 0;
+		effectToUse->Begin(&numPasses, NULL);
+		{
+			for (UINT j = 0; j < numPasses; ++j)
+			{
+				effectToUse->BeginPass(j);
+				{
+					gpD3DDevice->SetVertexDeclaration(gpFullscreenQuadDecl);
+					gpD3DDevice->DrawPrimitiveUP(D3DPT_TRIANGLESTRIP, 2, quad, sizeof(float)* 5);
+				}
+				effectToUse->EndPass();
+			}
+		}
+		effectToUse->End();
+		effectToUse->SetTexture("SceneTexture_Tex", NULL);
+
+		pSource = pDestination;
+	}
+	gpD3DDevice->EndScene();
+
+	pImageTexture->Release();
+	pImageTexture = NULL;
+
+	// copy the result to system memory and encode it
+	LPDIRECT3DSURFACE9 pResultSurface = NULL;
+	if (FAILED(pDestination->GetSurfaceLevel(0, &pResultSurface)))
+	{
+		return false;
+	}
+
+	HRESULT hr = gpD3DDevice->GetRenderTargetData(pResultSurface, gpReadbackSurface);
+	pResultSurface->Release();
+	pResultSurface = NULL;
+
+	LPD3DXBUFFER pEncoded = NULL;
+	if (FAILED(hr)
+		|| FAILED(D3DXSaveSurfaceToFileInMemory(&pEncoded, GetImageFileFormat(pImage->mFilename),
+		gpReadbackSurface, NULL, NULL)))
+	{
+		return false;
+	}
+
+	delete[] pImage->mData;
+	pImage->mSize = pEncoded->GetBufferSize();
+	pImage->mData = new BYTE[pImage->mSize];
+	memcpy(pImage->mData, pEncoded->GetBufferPointer(), pImage->mSize);
+	pEncoded->Release();
+
+	return true;
+}
+
+// make the render targets match the image size. sequences usually have
+// one size, so they are only created for the first frame
+bool ResizeRenderTargets(UINT width, UINT height)
+{
+	if (width == gRenderTargetWidth && height == gRenderTargetHeight)
+	{
+		return true;
+	}
+
+	ReleaseRenderTargets();
+
+	for (int i = 0; i < 2; ++i)
+	{
+		if (FAILED(gpD3DDevice->CreateTexture(width, height,
+			1, D3DUSAGE_RENDERTARGET, D3DFMT_X8R8G8B8,
+			D3DPOOL_DEFAULT, &gpRenderTargets[i], NULL)))
+		{
+			fprintf(stderr, "failed at creating a %ux%u render target\n", width, height);
+			ReleaseRenderTargets();
+			return false;
+		}
+	}
+
+	if (FAILED(gpD3DDevice->CreateOffscreenPlainSurface(width, height,
+		D3DFMT_X8R8G8B8, D3DPOOL_SYSTEMMEM, &gpReadbackSurface, NULL)))
+	{
+		ReleaseRenderTargets();
+		return false;
+	}
+
+	gRenderTargetWidth = width;
+	gRenderTargetHeight = height;
+
+	return true;
+}
+
+void DeleteImage(ImageFile * pImage)
+{
+	delete[] pImage->mData;
+	delete pImage;
+	InterlockedDecrement(&gImagesInMemory);
+}
+
+//------------------------------------------------------------
+// bounded queue
+//------------------------------------------------------------
+
+void InitQueue(ImageQueue * pQueue)
+{
+	pQueue->mHead = 0;
+	pQueue->mTail = 0;
+	InitializeCriticalSection(&pQueue->mLock);
+	pQueue->mFreeSlots = CreateSemaphore(NULL, QUEUE_CAPACITY, QUEUE_CAPACITY, NULL);
+	pQueue->mUsedSlots = CreateSemaphore(NULL, 0, QUEUE_CAPACITY, NULL);
+}
+
+void DestroyQueue(ImageQueue * pQueue)
+{
+	CloseHandle(pQueue->mFreeSlots);
+	CloseHandle(pQueue->mUsedSlots);
+	DeleteCriticalSection(&pQueue->mLock);
+}
+
+// blocks while the queue is full
+void PushQueue(ImageQueue * pQueue, ImageFile * pImage)
+{
+	WaitForSingleObject(pQueue->mFreeSlots, INFINITE);
+
+	EnterCriticalSection(&pQueue->mLock);
+	pQueue->mItems[pQueue->mTail] = pImage;
+	pQueue->mTail = (pQueue->mTail + 1) % QUEUE_CAPACITY;
+	LeaveCriticalSection(&pQueue->mLock);
+
+	ReleaseSemaphore(pQueue->mUsedSlots, 1, NULL);
+}
+
+// blocks while the queue is empty
+ImageFile * PopQueue(ImageQueue * pQueue)
+{
+	WaitForSingleObject(pQueue->mUsedSlots, INFINITE);
+
+	EnterCriticalSection(&pQueue->mLock);
+	ImageFile * pImage = pQueue->mItems[pQueue->mHead];
+	pQueue->mHead = (pQueue->mHead + 1) % QUEUE_CAPACITY;
+	LeaveCriticalSection(&pQueue->mLock);
+
+	ReleaseSemaphore(pQueue->mFreeSlots, 1, NULL);
+	return pImage;
+}
+
+//------------------------------------------------------------
+// strip mode
+//------------------------------------------------------------
+
+// run edge detection or emboss over a binary PPM, writing a binary PGM.
+// only three rows of luminance and one strip of file data are in memory
+bool FilterImageInStrips(int stage, const char * inputFilename, const char * outputFilename)
+{
+	FILE * input = fopen(inputFilename, "rb");
+	if (!input)
+	{
+		fprintf(stderr, "failed at opening %s\n", inputFilename);
+		return false;
+	}
+
+	UINT width = 0;
+	UINT height = 0;
+	if (!ReadPPMHeader(input, &width, &height))
+	{
+		fprintf(stderr, "%s is not a binary PPM with 8 bits per channel\n", inputFilename);
+		fclose(input);
+		return false;
+	}
+
+	FILE * output = fopen(outputFilename, "wb");
+	if (!output)
+	{
+		fprintf(stderr, "failed at opening %s\n", outputFilename);
+		fclose(input);
+		return false;
+	}
+
+	fprintf(output, "P5\n%u %u\n255\n", width, height);
+
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER start;
+	LARGE_INTEGER end;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&start);
+
+	StripReader reader;
+	reader.mFile = input;
+	reader.mStrip = new BYTE[width * 3 * STRIP_ROWS];
+	reader.mWidth = width;
+	reader.mRowsLeft = height;
+	reader.mRowsInStrip = 0;
+	reader.mNextRow = 0;
+
+	BYTE * pOutputStrip = new BYTE[width * STRIP_ROWS];
+	UINT outputRows = 0;
+
+	float * pRows[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		pRows[i] = new float[width];
+	}
+
+	// rows above and below the image repeat the border row, same as the
+	// CLAMP addressing the shaders use
+	float * pTop = pRows[0];
+	float * pMiddle = pRows[1];
+	float * pBottom = pRows[2];
+
+	bool success = ReadLuminanceRow(&reader, pMiddle);
+	memcpy(pTop, pMiddle, sizeof(float) * width);
+
+	for (UINT y = 0; success && y < height; ++y)
+	{
+		if (y + 1 < height)
+		{
+			success = ReadLuminanceRow(&reader, pBottom);
+		}
+		else
+		{
+			memcpy(pBottom, pMiddle, sizeof(float) * width);
+		}
+
+		FilterRow(stage, pTop, pMiddle, pBottom, width, pOutputStrip + outputRows * width);
+		++outputRows;
+
+		if (outputRows == STRIP_ROWS || y + 1 == height)
+		{
+			if (fwrite(pOutputStrip, width, outputRows, output) != outputRows)
+			{
+				fprintf(stderr, "failed at writing %s\n", outputFilename);
+				success = false;
+			}
+			outputRows = 0;
+		}
+
+		// roll the buffer down by one row
+		float * pOldTop = pTop;
+		pTop = pMiddle;
+		pMiddle = pBottom;
+		pBottom = pOldTop;
+	}
+
+	if (!success)
+	{
+		fprintf(stderr, "failed at filtering %s\n", inputFilename);
+	}
+
+	for (int i = 0; i < 3; ++i)
+	{
+		delete[] pRows[i];
+	}
+	delete[] pOutputStrip;
+	delete[] reader.mStrip;
+
+	fclose(input);
+	fclose(output);
+
+	QueryPerformanceCounter(&end);
+	double seconds = (end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+	if (success)
+	{
+		double megapixels = (double)width * height / 1000000.0;
+		printf("%ux%u in %.2f seconds: %.1f megapixels/sec\n",
+			width, height, seconds, seconds > 0 ? megapixels / seconds : 0.0);
+		printf("%.1f MB of buffers\n",
+			(width * (3 * STRIP_ROWS + STRIP_ROWS) + sizeof(float) * width * 3) / (1024.0 * 1024.0));
+	}
+
+	return success;
+}
+
+// parse "P6 <width> <height> 255" followed by a single whitespace
+bool ReadPPMHeader(FILE * file, UINT * pWidth, UINT * pHeight)
+{
+	if (fgetc(file) != 'P' || fgetc(file) != '6')
+	{
+		return false;
+	}
+
+	UINT maxValue = 0;
+	if (!ReadPPMNumber(file, pWidth) || !ReadPPMNumber(file, pHeight)
+		|| !ReadPPMNumber(file, &maxValue))
+	{
+		return false;
+	}
+
+	return *pWidth > 0 && *pHeight > 0 && maxValue == 255;
+}
+
+// read a decimal number, skipping whitespace and # comments before it.
+// eats the single whitespace after it
+bool ReadPPMNumber(FILE * file, UINT * pValue)
+{
+	int c = fgetc(file);
+	for (;;)
+	{
+		if (c == '#')
+		{
+			while (c != '\n' && c != EOF)
+			{
+				c = fgetc(file);
+			}
+		}
+		else if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+		{
+			c = fgetc(file);
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if (c < '0' || c > '9')
+	{
+		return false;
+	}
+
+	*pValue = 0;
+	while (c >= '0' && c <= '9')
+	{
+		*pValue = *pValue * 10 + (c - '0');
+		c = fgetc(file);
+	}
+
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// convert the next row of the image to luminance, reading a new strip
+// from the file when the current one is used up
+bool ReadLuminanceRow(StripReader * pReader, float * pLuminance)
+{
+	if (pReader->mNextRow == pReader->mRowsInStrip)
+	{
+		UINT rows = pReader->mRowsLeft < STRIP_ROWS ? pReader->mRowsLeft : STRIP_ROWS;
+		if (rows == 0 || fread(pReader->mStrip, pReader->mWidth * 3, rows, pReader->mFile) != rows)
+		{
+			return false;
+		}
+
+		pReader->mRowsLeft -= rows;
+		pReader->mRowsInStrip = rows;
+		pReader->mNextRow = 0;
+	}
+
+	// same weights as gLuminanceWeights in the shaders
+	const BYTE * pRGB = pReader->mStrip + pReader->mNextRow * pReader->mWidth * 3;
+	for (UINT x = 0; x < pReader->mWidth; ++x)
+	{
+		pLuminance[x] = (0.3f * pRGB[0] + 0.59f * pRGB[1] + 0.11f * pRGB[2]) / 255.0f;
+		pRGB += 3;
+	}
+
+	++pReader->mNextRow;
+	return true;
+}
+
+// one output row of EdgeDetection.fx or Emboss.fx from the luminance of
+// the rows above, at and below it
+void FilterRow(int stage, const float * pTop, const float * pMiddle, const float * pBottom,
+	UINT width, BYTE * pOutput)
+{
+	for (UINT x = 0; x < width; ++x)
+	{
+		UINT left = x > 0 ? x - 1 : 0;
+		UINT right = x + 1 < width ? x + 1 : width - 1;
+
+		float res;
+		if (stage == POSTPROCESS_EDGEDETECTION)
+		{
+			float Lx = (pTop[right] + 2 * pMiddle[right] + pBottom[right])
+				- (pTop[left] + 2 * pMiddle[left] + pBottom[left]);
+			float Ly = (pTop[left] + 2 * pTop[x] + pTop[right])
+				- (pBottom[left] + 2 * pBottom[x] + pBottom[right]);
+			res = sqrtf((Lx * Lx) + (Ly * Ly));
+		}
+		else
+		{
+			res = 2 * (pBottom[right] - pTop[left]) + (pMiddle[right] - pMiddle[left])
+				+ (pBottom[x] - pTop[x]) + 0.5f;
+		}
+
+		// saturate like the render target does
+		if (res < 0.0f)
+		{
+			res = 0.0f;
+		}
+		else if (res > 1.0f)
+		{
+			res = 1.0f;
+		}
+
+		pOutput[x] = (BYTE)(res * 255.0f + 0.5f);
+	}
+}
+
+//------------------------------------------------------------
+// cleanup code
+//------------------------------------------------------------
+
+void ReleaseRenderTargets()
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		if (gpRenderTargets[i])
+		{
+			gpRenderTargets[i]->Release();
+			gpRenderTargets[i] = NULL;
+		}
+	}
+
+	if (gpReadbackSurface)
+	{
+		gpReadbackSurface->Release();
+		gpReadbackSurface = NULL;
+	}
+
+	gRenderTargetWidth = 0;
+	gRenderTargetHeight = 0;
+}
+
+void Cleanup()
+{
+	// release shaders
+	for (int i = 0; i < NUM_POSTPROCESS_EFFECTS; ++i)
+	{
+		if (gpEffects[i])
+		{
+			gpEffects[i]->Release();
+			gpEffects[i] = NULL;
+		}
+	}
+
+	// release render targets
+	ReleaseRenderTargets();
+
+	if (gpFullscreenQuadDecl)
+	{
+		gpFullscreenQuadDecl->Release();
+		gpFullscreenQuadDecl = NULL;
+	}
+
+	// release D3D
+	if (gpD3DDevice)
+	{
+		gpD3DDevice->Release();
+		gpD3DDevice = NULL;
+	}
+
+	if (gpD3D)
+	{
+		gpD3D->Release();
+		gpD3D = NULL;
+	}
+
+	if (gHWnd)
+	{
+		DestroyWindow(gHWnd);
+		gHWnd = NULL;
+	}
+}
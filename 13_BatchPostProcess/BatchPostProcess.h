@@ -0,0 +1,105 @@
+//**********************************************************************
+//
+// BatchPostProcess.h
+//
+// Command line tool running the post-process effects of 12_EdgeDetection
+// over a directory of images.
+// (same super simple C-style as the shader demo framework)
+//
+//**********************************************************************
+
+
+#pragma once
+
+#include <d3d9.h>
+#include <d3dx9.h>
+#include <stdio.h>
+
+// ---------- constants ------------------------------------
+
+// post-process stages
+#define POSTPROCESS_GRAYSCALE		0
+#define POSTPROCESS_SEPIA			1
+#define POSTPROCESS_EDGEDETECTION	2
+#define POSTPROCESS_EMBOSS			3
+#define NUM_POSTPROCESS_EFFECTS		4
+
+#define MAX_POSTPROCESS_STAGES		4
+
+// images waiting between two pipeline stages. together with the number
+// of threads, this bounds how many images are in memory at once
+#define QUEUE_CAPACITY				4
+
+// threads reading images from disk and writing them back
+#define NUM_READER_THREADS			2
+#define NUM_WRITER_THREADS			2
+
+// rows read from / written to disk at once in strip mode
+#define STRIP_ROWS					16
+
+// ---------- types ----------------------------------------
+
+// an image file moving through the pipeline
+struct ImageFile
+{
+	char		mFilename[MAX_PATH];	// without the directory
+	BYTE*		mData;					// file contents
+	DWORD		mSize;
+};
+
+// bounded queue between two pipeline stages
+struct ImageQueue
+{
+	ImageFile*			mItems[QUEUE_CAPACITY];
+	int					mHead;
+	int					mTail;
+	CRITICAL_SECTION	mLock;
+	HANDLE				mFreeSlots;		// semaphore counting empty slots
+	HANDLE				mUsedSlots;		// semaphore counting queued images
+};
+
+// reads an RGB image a strip of rows at a time
+struct StripReader
+{
+	FILE*		mFile;
+	BYTE*		mStrip;			// STRIP_ROWS rows of RGB
+	UINT		mWidth;
+	UINT		mRowsLeft;		// rows not read from the file yet
+	UINT		mRowsInStrip;
+	UINT		mNextRow;		// next row in mStrip to hand out
+};
+
+// ---------------- function prototype  ------------------------
+
+// Initialization-related
+bool ParseArguments(int argc, char* argv[]);
+bool InitD3D();
+bool LoadAssets();
+LPD3DXEFFECT LoadShader(const char * filename);
+
+// pipeline related
+DWORD WINAPI ReaderThread(LPVOID param);
+DWORD WINAPI WriterThread(LPVOID param);
+bool GetNextInputFile(char * filename);
+D3DXIMAGE_FILEFORMAT GetImageFileFormat(const char * filename);
+bool ProcessImage(ImageFile * pImage);
+bool ResizeRenderTargets(UINT width, UINT height);
+void DeleteImage(ImageFile * pImage);
+
+// queue related
+void InitQueue(ImageQueue * pQueue);
+void DestroyQueue(ImageQueue * pQueue);
+void PushQueue(ImageQueue * pQueue, ImageFile * pImage);
+ImageFile * PopQueue(ImageQueue * pQueue);
+
+// strip mode related
+bool FilterImageInStrips(int stage, const char * inputFilename, const char * outputFilename);
+bool ReadPPMHeader(FILE * file, UINT * pWidth, UINT * pHeight);
+bool ReadPPMNumber(FILE * file, UINT * pValue);
+bool ReadLuminanceRow(StripReader * pReader, float * pLuminance);
+void FilterRow(int stage, const float * pTop, const float * pMiddle, const float * pBottom,
+	UINT width, BYTE * pOutput);
+
+// cleanup related
+void ReleaseRenderTargets();
+void Cleanup();
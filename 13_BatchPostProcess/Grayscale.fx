@@ -61,13 +61,15 @@ sampler2D SceneSampler = sampler_state
 	Texture = (SceneTexture_Tex);
 };
 
-float4 ColorConversion_Grayscale_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+// the scene target only holds 8 bits per channel, so half precision
+// stays within 1 LSB of float here and runs at partial precision (_pp)
+half4 ColorConversion_Grayscale_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
 {
-	float4 tex = tex2D(SceneSampler, Input.mUV);
+	half4 tex = tex2D(SceneSampler, Input.mUV);
 
 	//tex.rgb = (tex.r + tex.g + tex.b ) / 3;
 	//tex.rgb = tex.r * 0.3 + tex.g * 0.59 + tex.b * 0.11;
-	tex.rgb = dot(tex.rgb, float3(0.3, 0.59, 0.11));
+	tex.rgb = dot(tex.rgb, half3(0.3, 0.59, 0.11));
 
 	return tex;
 }
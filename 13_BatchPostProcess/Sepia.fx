@@ -61,19 +61,21 @@ sampler2D SceneSampler = sampler_state
 	Texture = (SceneTexture_Tex);
 };
 
-float4 ColorConversion_Sepia_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
+// computed in half precision: sepia of an 8-bit color is off by less than
+// 1 LSB compared to float, and partial precision math is cheaper
+half4 ColorConversion_Sepia_Pixel_Shader_ps_main(PS_INPUT Input) : COLOR
 {
-	float4 tex = tex2D(SceneSampler, Input.mUV);
+	half4 tex = tex2D(SceneSampler, Input.mUV);
 
-	float4 sepia;
+	half4 sepia;
 	sepia.a = tex.a;
 	//sepia.r = tex.r * 0.393f + tex.g * 0.769f + tex.b * 0.189f;
 	//sepia.g = tex.g * 0.349f + tex.g * 0.686f + tex.b * 0.168f;
 	//sepia.b = tex.b * 0.272f + tex.g * 0.534f + tex.b * 0.131f;
 
-	sepia.r = dot(tex.rgb, float3(0.393f, 0.769f, 0.189f));
-	sepia.g = dot(tex.rgb, float3(0.349f, 0.686f, 0.168f));
-	sepia.b = dot(tex.rbb, float3(0.272f, 0.534f, 0.131f));
+	sepia.r = dot(tex.rgb, half3(0.393f, 0.769f, 0.189f));
+	sepia.g = dot(tex.rgb, half3(0.349f, 0.686f, 0.168f));
+	sepia.b = dot(tex.rbb, half3(0.272f, 0.534f, 0.131f));
 
 	return sepia;
 }